@@ -0,0 +1,150 @@
+// Per-child accounting harvested from the leaked process handles before they're released
+
+#include <Windows.h>
+#include <algorithm>
+#include <thread>
+#include "ChildAccounting.h"
+#include "LatencyStats.h"
+#include "Utilities.h"
+#include "WorkerThreads.h"
+
+/// <summary>
+/// Converts a FILETIME (an absolute time or a duration) to a count of 100-nanosecond units.
+/// </summary>
+static ULONGLONG FileTimeToULongLong(const FILETIME& ft)
+{
+	ULARGE_INTEGER uli;
+	uli.LowPart = ft.dwLowDateTime;
+	uli.HighPart = ft.dwHighDateTime;
+	return uli.QuadPart;
+}
+
+/// <summary>
+/// Body of each harvesting thread: claims batches of handles and queries each process handle in the batch.
+/// </summary>
+static void HarvestThread(const std::vector<HANDLE>& handles, SharedWorkBudget& budget, ChildAccountingResults_t& threadResults)
+{
+	// Collect into a local and copy out at the end, so that harvesting threads don't share cache lines.
+	ChildAccountingResults_t results;
+	ProcessClaimedItems(budget, [&](size_t ixHandle)
+	{
+		const HANDLE hProcess = handles[ixHandle];
+		// Thread handles (and any other type) have no process ID.
+		if (0 == GetProcessId(hProcess))
+			return true;
+		++results.nProcesses;
+		if (WAIT_OBJECT_0 != WaitForSingleObject(hProcess, 0))
+		{
+			++results.nRunning;
+			return true;
+		}
+		FILETIME ftCreation, ftExit, ftKernel, ftUser;
+		DWORD dwExitCode = 0;
+		if (!GetProcessTimes(hProcess, &ftCreation, &ftExit, &ftKernel, &ftUser) || !GetExitCodeProcess(hProcess, &dwExitCode))
+		{
+			++results.nFailed;
+			return true;
+		}
+		results.lifetimes.push_back(FileTimeToULongLong(ftExit) - FileTimeToULongLong(ftCreation));
+		results.cpuTimes.push_back(FileTimeToULongLong(ftKernel) + FileTimeToULongLong(ftUser));
+		++results.exitCodes[dwExitCode];
+		return true;
+	});
+	threadResults = std::move(results);
+}
+
+/// <summary>
+/// Queries every process handle in handles, in batches claimed by nThreads threads, and the job's accounting.
+/// </summary>
+ChildAccountingResults_t HarvestChildAccounting(const std::vector<HANDLE>& handles, HANDLE hJob, unsigned int nThreads)
+{
+	if (0 == nThreads)
+		nThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+	std::vector<ChildAccountingResults_t> perThreadResults(nThreads);
+	// Handles claimed at a time, so that the threads rarely touch the shared index
+	SharedWorkBudget budget(handles.size(), 1024);
+
+	const LONGLONG llStart = PerfCounterNow();
+	RunWorkerThreads(nThreads, [&](unsigned int ixThread)
+	{
+		HarvestThread(handles, budget, perThreadResults[ixThread]);
+	});
+
+	ChildAccountingResults_t results;
+	results.nThreads = nThreads;
+	for (const ChildAccountingResults_t& threadResults : perThreadResults)
+	{
+		results.nProcesses += threadResults.nProcesses;
+		results.nRunning += threadResults.nRunning;
+		results.nFailed += threadResults.nFailed;
+		results.lifetimes.insert(results.lifetimes.end(), threadResults.lifetimes.begin(), threadResults.lifetimes.end());
+		results.cpuTimes.insert(results.cpuTimes.end(), threadResults.cpuTimes.begin(), threadResults.cpuTimes.end());
+		for (const auto& exitCode : threadResults.exitCodes)
+			results.exitCodes[exitCode.first] += exitCode.second;
+	}
+	if (nullptr != hJob)
+	{
+		results.bJobAccounting = FALSE != QueryInformationJobObject(hJob, JobObjectBasicAccountingInformation,
+			&results.jobAccounting, sizeof(results.jobAccounting), nullptr);
+	}
+	results.llElapsed = PerfCounterNow() - llStart;
+	return results;
+}
+
+/// <summary>
+/// Sorts the values (100-nanosecond units) and writes their p50, p90, p99, and max in milliseconds.
+/// </summary>
+static void WriteDistributionMs(std::wostream& os, const wchar_t* szLabel, std::vector<ULONGLONG>& values)
+{
+	if (values.empty())
+		return;
+	std::sort(values.begin(), values.end());
+	const auto percentileMs = [&values](double dPercentile)
+	{
+		return double(values[NearestRankIndex(values.size(), dPercentile)]) / 10000.0;
+	};
+	FixedFormatGuard format(os, 2);
+	os << szLabel
+		<< L"p50 " << percentileMs(50)
+		<< L"  p90 " << percentileMs(90)
+		<< L"  p99 " << percentileMs(99)
+		<< L"  max " << double(values.back()) / 10000.0 << L" ms"
+		<< std::endl;
+}
+
+/// <summary>
+/// Writes the harvest's counts and timing, the distribution of child lifetimes and CPU times, the exit codes, and the
+/// job accounting.
+/// </summary>
+void WriteChildAccountingReport(std::wostream& os, ChildAccountingResults_t& results)
+{
+	const double dSeconds = PerfCounterToSeconds(results.llElapsed);
+	os
+		<< L"Child accounting (" << results.nThreads << L" threads):" << std::endl
+		<< L"  Process handles:   " << results.nProcesses << std::endl
+		<< L"  Exited:            " << results.lifetimes.size() << std::endl;
+	if (0 != results.nRunning)
+		os << L"  Still running:     " << results.nRunning << std::endl;
+	if (0 != results.nFailed)
+		os << L"  Query failures:    " << results.nFailed << std::endl;
+	os
+		<< L"  Harvest seconds:   " << dSeconds << std::endl
+		<< L"  Handles/sec:       " << (dSeconds > 0 ? double(results.nProcesses) / dSeconds : 0) << std::endl;
+	WriteDistributionMs(os, L"  Creation to exit:  ", results.lifetimes);
+	WriteDistributionMs(os, L"  CPU (user+kernel): ", results.cpuTimes);
+	for (const auto& exitCode : results.exitCodes)
+	{
+		os << L"  Exit code " << exitCode.first << L": " << exitCode.second << L" processes" << std::endl;
+	}
+	if (results.bJobAccounting)
+	{
+		const JOBOBJECT_BASIC_ACCOUNTING_INFORMATION& job = results.jobAccounting;
+		os
+			<< L"  Job processes:     " << job.TotalProcesses << L" total, " << job.ActiveProcesses << L" active, "
+			<< job.TotalTerminatedProcesses << L" terminated" << std::endl
+			<< L"  Job CPU seconds:   " << double(job.TotalUserTime.QuadPart) / 1e7 << L" user, "
+			<< double(job.TotalKernelTime.QuadPart) / 1e7 << L" kernel" << std::endl
+			<< L"  Job page faults:   " << job.TotalPageFaultCount << std::endl;
+	}
+	os << std::endl;
+}
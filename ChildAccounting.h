@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <map>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------
+// Per-child accounting harvested from the leaked process handles before they're released
+
+/// <summary>
+/// Accounting collected from every leaked process handle, and from the job if there is one.
+/// </summary>
+struct ChildAccountingResults_t
+{
+	// Process handles queried; handles of other types (such as the children's thread handles) are skipped
+	size_t nProcesses = 0;
+	// Processes that hadn't exited yet, and processes whose times couldn't be queried
+	size_t nRunning = 0;
+	size_t nFailed = 0;
+	// Creation-to-exit time, and user plus kernel CPU time, of each exited process, in 100-nanosecond units
+	std::vector<ULONGLONG> lifetimes;
+	std::vector<ULONGLONG> cpuTimes;
+	// Number of exited processes with each exit code
+	std::map<DWORD, size_t> exitCodes;
+	// Job-wide accounting, if the children were in a job
+	bool bJobAccounting = false;
+	JOBOBJECT_BASIC_ACCOUNTING_INFORMATION jobAccounting = { 0 };
+	// Threads that did the harvest, and its wall time in performance counter units
+	unsigned int nThreads = 1;
+	LONGLONG llElapsed = 0;
+};
+
+/// <summary>
+/// Queries GetProcessTimes and GetExitCodeProcess on every process handle in handles, in batches claimed by nThreads
+/// threads, and the job's basic accounting information if hJob isn't nullptr.
+/// </summary>
+/// <param name="handles">Input: leaked handles; those that aren't process handles are skipped</param>
+/// <param name="hJob">Input: job object the children were assigned to, or nullptr</param>
+/// <param name="nThreads">Input: number of harvesting threads, or 0 for one per logical processor</param>
+/// <returns>Accounting for all exited processes</returns>
+ChildAccountingResults_t HarvestChildAccounting(const std::vector<HANDLE>& handles, HANDLE hJob, unsigned int nThreads);
+
+/// <summary>
+/// Writes the harvest's counts and timing, the distribution of child lifetimes and CPU times, the exit codes, and the
+/// job accounting.
+/// </summary>
+void WriteChildAccountingReport(std::wostream& os, ChildAccountingResults_t& results);
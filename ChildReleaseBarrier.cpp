@@ -0,0 +1,62 @@
+// Barrier that parks ZombieProc children until ZombieMaker releases them all at once
+
+#include <Windows.h>
+#include <sstream>
+#include "ChildReleaseBarrier.h"
+
+ChildReleaseBarrier::~ChildReleaseBarrier()
+{
+	if (nullptr != m_hReleaseEvent)
+		CloseHandle(m_hReleaseEvent);
+	if (nullptr != m_hParkedSemaphore)
+		CloseHandle(m_hParkedSemaphore);
+}
+
+/// <summary>
+/// Creates the named event and semaphore.
+/// </summary>
+bool ChildReleaseBarrier::Create()
+{
+	// Names are unique to this ZombieMaker instance.
+	std::wstringstream strPrefix;
+	strPrefix << L"Local\\ZombieMaker-" << GetCurrentProcessId();
+	m_sEventName = strPrefix.str() + L"-Release";
+	m_sSemaphoreName = strPrefix.str() + L"-Parked";
+
+	// Manual-reset, so that one SetEvent releases every waiting child.
+	m_hReleaseEvent = CreateEventW(nullptr, TRUE, FALSE, m_sEventName.c_str());
+	if (nullptr == m_hReleaseEvent)
+		return false;
+	m_hParkedSemaphore = CreateSemaphoreW(nullptr, 0, 0x7FFFFFFF, m_sSemaphoreName.c_str());
+	return nullptr != m_hParkedSemaphore;
+}
+
+/// <summary>
+/// Returns the ZombieProc command-line arguments that make a child park on this barrier.
+/// </summary>
+std::wstring ChildReleaseBarrier::ChildArgs() const
+{
+	return L"-release:" + m_sEventName + L" -parked:" + m_sSemaphoreName;
+}
+
+/// <summary>
+/// Waits until nChildren children have reported that they are parked, giving up if no child reports within dwTimeoutMs.
+/// </summary>
+int ChildReleaseBarrier::WaitUntilParked(int nChildren, DWORD dwTimeoutMs)
+{
+	int nParked = 0;
+	// Each successful wait consumes one child's ReleaseSemaphore.
+	while (nParked < nChildren && WAIT_OBJECT_0 == WaitForSingleObject(m_hParkedSemaphore, dwTimeoutMs))
+	{
+		++nParked;
+	}
+	return nParked;
+}
+
+/// <summary>
+/// Releases all parked children (and any child that tries to park afterward).
+/// </summary>
+bool ChildReleaseBarrier::Release()
+{
+	return FALSE != SetEvent(m_hReleaseEvent);
+}
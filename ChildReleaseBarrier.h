@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+
+// ------------------------------------------------------------------------------------------
+// Barrier that parks ZombieProc children until ZombieMaker releases them all at once
+
+/// <summary>
+/// Named manual-reset event that parked ZombieProc children wait on, plus a named semaphore that each child releases once
+/// it is parked, so that ZombieMaker can tell when all children are waiting before it releases them.
+/// </summary>
+class ChildReleaseBarrier
+{
+public:
+	ChildReleaseBarrier() = default;
+	~ChildReleaseBarrier();
+
+	/// <summary>
+	/// Creates the named event and semaphore.
+	/// </summary>
+	/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+	bool Create();
+
+	/// <summary>
+	/// Returns the ZombieProc command-line arguments that make a child park on this barrier.
+	/// </summary>
+	std::wstring ChildArgs() const;
+
+	/// <summary>
+	/// Waits until nChildren children have reported that they are parked, giving up if no child reports within dwTimeoutMs.
+	/// </summary>
+	/// <returns>Number of children that reported that they are parked</returns>
+	int WaitUntilParked(int nChildren, DWORD dwTimeoutMs);
+
+	/// <summary>
+	/// Releases all parked children (and any child that tries to park afterward).
+	/// </summary>
+	/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+	bool Release();
+
+private:
+	std::wstring m_sEventName, m_sSemaphoreName;
+	HANDLE m_hReleaseEvent = nullptr;
+	HANDLE m_hParkedSemaphore = nullptr;
+
+	ChildReleaseBarrier(const ChildReleaseBarrier&) = delete;
+	ChildReleaseBarrier& operator=(const ChildReleaseBarrier&) = delete;
+};
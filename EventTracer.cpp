@@ -0,0 +1,304 @@
+// Low-overhead event tracer: fixed-size events in per-thread buffers, written to a binary trace file at the end of a run
+
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "EventTracer.h"
+#include "HEX.h"
+#include "StringUtils.h"
+#include "Utilities.h"
+
+std::atomic<bool> g_bTracing{ false };
+
+/// <summary>
+/// Header at the start of a binary trace file; TraceEvent_t records follow it, sorted by timestamp.
+/// </summary>
+struct TraceFileHeader_t
+{
+	char szMagic[8];
+	DWORD dwVersion;
+	DWORD cbEvent;
+	// Performance counter frequency, and a performance counter value with the corresponding UTC FILETIME,
+	// for converting event timestamps to wall-clock time
+	LONGLONG llFrequency;
+	LONGLONG llQpcReference;
+	LONGLONG llFileTimeReference;
+	ULONGLONG nEvents;
+	// Events overwritten because a thread's buffer was full, or not recorded because the memory cap left no buffer
+	ULONGLONG nDropped;
+};
+static const char TraceFileMagic[8] = { 'Z', 'M', 'T', 'R', 'A', 'C', 'E', '1' };
+
+/// <summary>
+/// One thread's event buffer. Only the owning thread writes; nWritten is published with release semantics so that
+/// WriteTraceFile sees complete events. When the thread exits, the buffer goes to the next thread that records, which
+/// carries on from nWritten.
+/// </summary>
+struct TraceBuffer_t
+{
+	std::vector<TraceEvent_t> events;
+	std::atomic<ULONGLONG> nWritten{ 0 };
+	WORD wIndex = 0;
+};
+
+// Registry of all buffers, and those whose threads have exited; the lock is taken only when a thread records its first
+// event, when it exits, and when writing the file.
+static std::mutex s_mtxBuffers;
+static std::vector<std::unique_ptr<TraceBuffer_t>> s_buffers;
+static std::vector<TraceBuffer_t*> s_freeBuffers;
+// Events per buffer, a power of two so that the write index is a mask rather than a division
+static size_t s_nEventsPerThread = 0;
+// Most buffers to allocate
+static size_t s_nMaxBuffers = 0;
+// Events not recorded because every buffer was in use
+static std::atomic<ULONGLONG> s_nUnbuffered{ 0 };
+static LONGLONG s_llQpcReference = 0;
+static LONGLONG s_llFileTimeReference = 0;
+
+/// <summary>
+/// The calling thread's buffer, which goes back to the free list when the thread exits.
+/// </summary>
+class ThreadBufferLease
+{
+public:
+	~ThreadBufferLease()
+	{
+		if (nullptr == pBuffer)
+			return;
+		std::lock_guard<std::mutex> lock(s_mtxBuffers);
+		s_freeBuffers.push_back(pBuffer);
+	}
+
+	TraceBuffer_t* pBuffer = nullptr;
+	// Set when the cap left no buffer for this thread, so that it doesn't try again on every event
+	bool bUnbuffered = false;
+};
+
+static thread_local ThreadBufferLease t_lease;
+
+/// <summary>
+/// Gets a buffer for the calling thread: one whose thread has exited, or a new one if the cap allows.
+/// </summary>
+/// <returns>The buffer, or nullptr if every buffer the cap allows is in use</returns>
+static TraceBuffer_t* RegisterThreadBuffer()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_mtxBuffers);
+		if (!s_freeBuffers.empty())
+		{
+			TraceBuffer_t* pBuffer = s_freeBuffers.back();
+			s_freeBuffers.pop_back();
+			return pBuffer;
+		}
+		if (s_buffers.size() >= s_nMaxBuffers)
+			return nullptr;
+		// Reserve the slot now, and allocate outside the lock.
+		s_buffers.push_back(nullptr);
+	}
+	std::unique_ptr<TraceBuffer_t> pBuffer(new TraceBuffer_t);
+	// Allocating (and zeroing) the whole buffer now keeps page faults out of later TraceEvent calls.
+	pBuffer->events.resize(s_nEventsPerThread);
+	std::lock_guard<std::mutex> lock(s_mtxBuffers);
+	const auto itSlot = std::find(s_buffers.begin(), s_buffers.end(), nullptr);
+	pBuffer->wIndex = WORD(itSlot - s_buffers.begin());
+	*itSlot = std::move(pBuffer);
+	return itSlot->get();
+}
+
+/// <summary>
+/// Records an event into the calling thread's buffer: no locks, no allocation (after the thread's first event), no I/O.
+/// </summary>
+void RecordTraceEvent(TraceEventKind_t kind, DWORD dwPid, DWORD dwTid, HANDLE h, DWORD dwError)
+{
+	TraceBuffer_t* pBuffer = t_lease.pBuffer;
+	if (nullptr == pBuffer)
+	{
+		if (!t_lease.bUnbuffered)
+			pBuffer = t_lease.pBuffer = RegisterThreadBuffer();
+		if (nullptr == pBuffer)
+		{
+			t_lease.bUnbuffered = true;
+			s_nUnbuffered.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	const ULONGLONG nWritten = pBuffer->nWritten.load(std::memory_order_relaxed);
+	TraceEvent_t& ev = pBuffer->events[size_t(nWritten) & (s_nEventsPerThread - 1)];
+	ev.llTimestamp = PerfCounterNow();
+	ev.ullHandle = ULONGLONG(reinterpret_cast<ULONG_PTR>(h));
+	ev.dwPid = dwPid;
+	ev.dwTid = dwTid;
+	ev.dwError = dwError;
+	ev.kind = kind;
+	ev.wBuffer = pBuffer->wIndex;
+	pBuffer->nWritten.store(nWritten + 1, std::memory_order_release);
+}
+
+/// <summary>
+/// Enables tracing. Each thread that records events gets a buffer of nEventsPerThread events, allocated on its first event;
+/// when a buffer is full, the oldest events are overwritten.
+/// </summary>
+void StartTracing(size_t nEventsPerThread, size_t cbMaxMemory)
+{
+	s_nEventsPerThread = 1;
+	while (s_nEventsPerThread < nEventsPerThread)
+		s_nEventsPerThread <<= 1;
+	// Buffer indexes are stored in a WORD in each event.
+	s_nMaxBuffers = (std::min)((std::max)(cbMaxMemory / (s_nEventsPerThread * sizeof(TraceEvent_t)), size_t(1)), size_t(0xFFFF));
+	FILETIME ft;
+	GetSystemTimePreciseAsFileTime(&ft);
+	s_llQpcReference = PerfCounterNow();
+	ULARGE_INTEGER uli;
+	uli.LowPart = ft.dwLowDateTime;
+	uli.HighPart = ft.dwHighDateTime;
+	s_llFileTimeReference = LONGLONG(uli.QuadPart);
+	g_bTracing = true;
+}
+
+/// <summary>
+/// Writes cb bytes to the file, in chunks that fit WriteFile's DWORD length.
+/// </summary>
+static bool WriteAll(HANDLE hFile, const void* pv, size_t cb)
+{
+	const size_t cbMaxChunk = 0x40000000;
+	const BYTE* pb = static_cast<const BYTE*>(pv);
+	while (cb > 0)
+	{
+		DWORD cbChunk = DWORD((std::min)(cb, cbMaxChunk));
+		DWORD cbWritten = 0;
+		if (!WriteFile(hFile, pb, cbChunk, &cbWritten, nullptr) || cbWritten != cbChunk)
+			return false;
+		pb += cbWritten;
+		cb -= cbWritten;
+	}
+	return true;
+}
+
+/// <summary>
+/// Disables tracing and writes all buffered events, sorted by time, to a binary trace file.
+/// Call only after the threads that recorded events have stopped recording.
+/// </summary>
+bool WriteTraceFile(const std::wstring& sFilePath)
+{
+	g_bTracing = false;
+
+	std::vector<TraceEvent_t> events;
+	ULONGLONG nDropped = s_nUnbuffered.load();
+	{
+		std::lock_guard<std::mutex> lock(s_mtxBuffers);
+		for (const std::unique_ptr<TraceBuffer_t>& pBuffer : s_buffers)
+		{
+			// A slot reserved by a thread that is still allocating its buffer
+			if (nullptr == pBuffer)
+				continue;
+			const ULONGLONG nWritten = pBuffer->nWritten.load(std::memory_order_acquire);
+			const ULONGLONG nKept = (std::min)(nWritten, ULONGLONG(s_nEventsPerThread));
+			nDropped += nWritten - nKept;
+			for (ULONGLONG ix = nWritten - nKept; ix < nWritten; ++ix)
+			{
+				events.push_back(pBuffer->events[size_t(ix) & (s_nEventsPerThread - 1)]);
+			}
+		}
+	}
+	std::stable_sort(events.begin(), events.end(),
+		[](const TraceEvent_t& a, const TraceEvent_t& b) { return a.llTimestamp < b.llTimestamp; });
+
+	TraceFileHeader_t header = { { 0 } };
+	memcpy(header.szMagic, TraceFileMagic, sizeof(header.szMagic));
+	header.dwVersion = 1;
+	header.cbEvent = sizeof(TraceEvent_t);
+	header.llFrequency = PerfCounterFrequency();
+	header.llQpcReference = s_llQpcReference;
+	header.llFileTimeReference = s_llFileTimeReference;
+	header.nEvents = events.size();
+	header.nDropped = nDropped;
+
+	HANDLE hFile = CreateFileW(sFilePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == hFile)
+		return false;
+	bool bSuccess = WriteAll(hFile, &header, sizeof(header)) && WriteAll(hFile, events.data(), events.size() * sizeof(TraceEvent_t));
+	DWORD dwLastErr = GetLastError();
+	CloseHandle(hFile);
+	SetLastError(dwLastErr);
+	return bSuccess;
+}
+
+/// <summary>
+/// Returns the CSV name of an event kind.
+/// </summary>
+static const char* TraceEventKindName(TraceEventKind_t kind)
+{
+	switch (kind)
+	{
+	case TraceEventKind_t::ProcessSpawn: return "ProcessSpawn";
+	case TraceEventKind_t::ProcessSpawnFailed: return "ProcessSpawnFailed";
+	case TraceEventKind_t::ThreadSpawn: return "ThreadSpawn";
+	case TraceEventKind_t::ThreadSpawnFailed: return "ThreadSpawnFailed";
+	case TraceEventKind_t::ProcessExit: return "ProcessExit";
+	case TraceEventKind_t::HandleDuplicate: return "HandleDuplicate";
+	case TraceEventKind_t::HandleRelease: return "HandleRelease";
+	default: return "Unknown";
+	}
+}
+
+/// <summary>
+/// Converts a binary trace file to CSV, with UTC timestamps and times relative to the start of tracing.
+/// </summary>
+bool ConvertTraceFileToCsv(const std::wstring& sTraceFilePath, const std::wstring& sCsvFilePath)
+{
+	HANDLE hFile = CreateFileW(sTraceFilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == hFile)
+		return false;
+
+	TraceFileHeader_t header = { { 0 } };
+	DWORD cbRead = 0;
+	if (!ReadFile(hFile, &header, sizeof(header), &cbRead, nullptr) || sizeof(header) != cbRead ||
+		0 != memcmp(header.szMagic, TraceFileMagic, sizeof(header.szMagic)) || sizeof(TraceEvent_t) != header.cbEvent || 0 == header.llFrequency)
+	{
+		CloseHandle(hFile);
+		SetLastError(ERROR_INVALID_DATA);
+		return false;
+	}
+
+	std::stringstream csv;
+	csv << "TimestampUTC,RelativeUs,Kind,Pid,Tid,Handle,Error,Buffer" << std::endl;
+	// Read and convert events in chunks.
+	const size_t nChunkEvents = 65536;
+	std::vector<TraceEvent_t> chunk(nChunkEvents);
+	ULONGLONG nRemaining = header.nEvents;
+	bool bSuccess = true;
+	while (bSuccess && nRemaining > 0)
+	{
+		const DWORD nEvents = DWORD((std::min)(nRemaining, ULONGLONG(nChunkEvents)));
+		const DWORD cbChunk = nEvents * DWORD(sizeof(TraceEvent_t));
+		bSuccess = ReadFile(hFile, chunk.data(), cbChunk, &cbRead, nullptr) && cbRead == cbChunk;
+		if (!bSuccess)
+			break;
+		for (DWORD ix = 0; ix < nEvents; ++ix)
+		{
+			const TraceEvent_t& ev = chunk[ix];
+			const double dRelativeSeconds = double(ev.llTimestamp - header.llQpcReference) / double(header.llFrequency);
+			LARGE_INTEGER liFileTime;
+			liFileTime.QuadPart = header.llFileTimeReference + LONGLONG(dRelativeSeconds * 10000000.0);
+			csv << WStringToUtf8(LargeIntegerToDateTimeString(liFileTime)) << ","
+				<< LONGLONG(dRelativeSeconds * 1000000.0) << ","
+				<< TraceEventKindName(ev.kind) << ","
+				<< ev.dwPid << "," << ev.dwTid << ","
+				<< HEXA(ev.ullHandle, 0, false, true) << ","
+				<< ev.dwError << "," << ev.wBuffer << std::endl;
+		}
+		nRemaining -= nEvents;
+	}
+	DWORD dwLastErr = GetLastError();
+	CloseHandle(hFile);
+	if (!bSuccess)
+	{
+		SetLastError(0 != dwLastErr ? dwLastErr : ERROR_HANDLE_EOF);
+		return false;
+	}
+	return WriteTextFile(sCsvFilePath, csv.str());
+}
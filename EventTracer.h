@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <string>
+
+// ------------------------------------------------------------------------------------------
+// Low-overhead event tracer: fixed-size events in per-thread buffers, written to a binary trace file at the end of a run
+
+/// <summary>
+/// Kinds of traced events.
+/// </summary>
+enum class TraceEventKind_t : WORD
+{
+	ProcessSpawn = 1,
+	ProcessSpawnFailed,
+	ThreadSpawn,
+	ThreadSpawnFailed,
+	ProcessExit,
+	HandleDuplicate,
+	HandleRelease
+};
+
+/// <summary>
+/// One traced event, as stored in memory and in the trace file (32 bytes).
+/// </summary>
+struct TraceEvent_t
+{
+	// Performance counter value
+	LONGLONG llTimestamp;
+	// Handle value, if any
+	ULONGLONG ullHandle;
+	// Process and thread ID of the object the event is about, if any
+	DWORD dwPid;
+	DWORD dwTid;
+	// Win32 error code for failures; for ProcessExit, 1 if the job reported an abnormal exit
+	DWORD dwError;
+	TraceEventKind_t kind;
+	// Index of the recording thread's buffer
+	WORD wBuffer;
+};
+static_assert(32 == sizeof(TraceEvent_t), "TraceEvent_t must match the trace file format");
+
+/// <summary>
+/// True while tracing is enabled. Read on every TraceEvent call, from any thread; set by StartTracing and cleared by
+/// WriteTraceFile.
+/// </summary>
+extern std::atomic<bool> g_bTracing;
+
+/// <summary>
+/// Records an event into the calling thread's buffer: no locks, no allocation (after the thread's first event), no I/O.
+/// If every buffer the memory cap allows is in use by another thread, the event is counted as dropped.
+/// </summary>
+void RecordTraceEvent(TraceEventKind_t kind, DWORD dwPid, DWORD dwTid, HANDLE h, DWORD dwError);
+
+/// <summary>
+/// Records an event if tracing is enabled.
+/// </summary>
+inline void TraceEvent(TraceEventKind_t kind, DWORD dwPid = 0, DWORD dwTid = 0, HANDLE h = nullptr, DWORD dwError = 0)
+{
+	if (g_bTracing.load(std::memory_order_relaxed))
+		RecordTraceEvent(kind, dwPid, dwTid, h, dwError);
+}
+
+/// <summary>
+/// Enables tracing. Each thread that records events gets a buffer of nEventsPerThread events on its first event; when a
+/// buffer is full, the oldest events are overwritten. A thread's buffer, with the events in it, is handed to the next new
+/// thread once the thread exits, so the number of buffers follows the number of threads recording at the same time rather
+/// than the number of threads over the run. At most cbMaxMemory bytes of buffers are allocated (at least one buffer).
+/// </summary>
+void StartTracing(size_t nEventsPerThread, size_t cbMaxMemory);
+
+/// <summary>
+/// Disables tracing and writes all buffered events, sorted by time, to a binary trace file.
+/// Call only after the threads that recorded events have stopped recording.
+/// </summary>
+/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+bool WriteTraceFile(const std::wstring& sFilePath);
+
+/// <summary>
+/// Converts a binary trace file to CSV, with UTC timestamps and times relative to the start of tracing.
+/// </summary>
+/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+bool ConvertTraceFileToCsv(const std::wstring& sTraceFilePath, const std::wstring& sCsvFilePath);
@@ -0,0 +1,167 @@
+// Event-driven tracking of child process exits through a job object's I/O completion port
+
+#include <Windows.h>
+#include <chrono>
+#include <iomanip>
+#include "ExitTracker.h"
+#include "LatencyStats.h"
+#include "Utilities.h"
+#include "EventTracer.h"
+
+// Completion keys distinguishing job notifications from the stop request
+static const ULONG_PTR JobCompletionKey = 1;
+static const ULONG_PTR StopCompletionKey = 2;
+
+ExitTracker::~ExitTracker()
+{
+	Stop();
+	if (nullptr != m_hPort)
+		CloseHandle(m_hPort);
+}
+
+/// <summary>
+/// Associates a new completion port with the job and starts the tracker thread.
+/// Must be called before any process is assigned to the job.
+/// </summary>
+bool ExitTracker::Start(HANDLE hJob, size_t nExpected)
+{
+	m_hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+	if (nullptr == m_hPort)
+		return false;
+	JOBOBJECT_ASSOCIATE_COMPLETION_PORT jobPort = { 0 };
+	jobPort.CompletionKey = reinterpret_cast<PVOID>(JobCompletionKey);
+	jobPort.CompletionPort = m_hPort;
+	if (!SetInformationJobObject(hJob, JobObjectAssociateCompletionPortInformation, &jobPort, sizeof(jobPort)))
+		return false;
+
+	m_newProcessTimes.reserve(nExpected);
+	m_exitTimes.reserve(nExpected);
+	m_lifetimes.reserve(nExpected);
+	m_llStart = PerfCounterNow();
+	m_thread = std::thread(&ExitTracker::TrackerThread, this);
+	return true;
+}
+
+/// <summary>
+/// Dequeues job notifications in batches until Stop is called.
+/// </summary>
+void ExitTracker::TrackerThread()
+{
+	const ULONG nMaxEntries = 256;
+	OVERLAPPED_ENTRY entries[nMaxEntries];
+	for (;;)
+	{
+		ULONG nEntries = 0;
+		if (!GetQueuedCompletionStatusEx(m_hPort, entries, nMaxEntries, &nEntries, INFINITE, FALSE))
+			return;
+		const LONGLONG llNow = PerfCounterNow();
+		bool bNewExits = false;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			for (ULONG ixEntry = 0; ixEntry < nEntries; ++ixEntry)
+			{
+				const OVERLAPPED_ENTRY& entry = entries[ixEntry];
+				if (StopCompletionKey == entry.lpCompletionKey)
+					return;
+				// For job notifications, the message ID is in the byte count and the process ID is in the overlapped pointer.
+				const DWORD dwPid = DWORD(reinterpret_cast<ULONG_PTR>(entry.lpOverlapped));
+				switch (entry.dwNumberOfBytesTransferred)
+				{
+				case JOB_OBJECT_MSG_NEW_PROCESS:
+					m_newProcessTimes[dwPid] = llNow;
+					break;
+				case JOB_OBJECT_MSG_ABNORMAL_EXIT_PROCESS:
+					++m_nAbnormalExits;
+					// fall through
+				case JOB_OBJECT_MSG_EXIT_PROCESS:
+				{
+					TraceEvent(TraceEventKind_t::ProcessExit, dwPid, 0, nullptr, JOB_OBJECT_MSG_ABNORMAL_EXIT_PROCESS == entry.dwNumberOfBytesTransferred ? 1 : 0);
+					m_exitTimes.push_back(llNow);
+					auto iter = m_newProcessTimes.find(dwPid);
+					if (m_newProcessTimes.end() != iter)
+					{
+						m_lifetimes.push_back(llNow - iter->second);
+						m_newProcessTimes.erase(iter);
+					}
+					bNewExits = true;
+					break;
+				}
+				default:
+					break;
+				}
+			}
+		}
+		if (bNewExits)
+			m_cvExit.notify_all();
+	}
+}
+
+/// <summary>
+/// Waits until at least nExits processes have exited, or until no exit has been seen for dwIdleTimeoutMs.
+/// </summary>
+size_t ExitTracker::WaitForExits(size_t nExits, DWORD dwIdleTimeoutMs)
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	while (m_exitTimes.size() < nExits)
+	{
+		const size_t nBefore = m_exitTimes.size();
+		m_cvExit.wait_for(lock, std::chrono::milliseconds(dwIdleTimeoutMs), [&] { return m_exitTimes.size() >= nExits; });
+		if (m_exitTimes.size() == nBefore)
+			break;
+	}
+	return m_exitTimes.size();
+}
+
+/// <summary>
+/// Stops the tracker thread. Exits after this point are not recorded.
+/// </summary>
+void ExitTracker::Stop()
+{
+	if (m_thread.joinable())
+	{
+		PostQueuedCompletionStatus(m_hPort, 0, StopCompletionKey, nullptr);
+		m_thread.join();
+	}
+}
+
+/// <summary>
+/// Writes the exit timeline (exits per interval since tracking started) and the distribution of process lifetimes.
+/// </summary>
+void ExitTracker::WriteReport(std::wostream& os) const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	os << L"Exits tracked:     " << m_exitTimes.size();
+	if (m_nAbnormalExits > 0)
+		os << L" (" << m_nAbnormalExits << L" abnormal)";
+	os << std::endl;
+	if (m_exitTimes.empty())
+	{
+		os << std::endl;
+		return;
+	}
+
+	// Pick a timeline interval that gives at most about 50 rows.
+	const double dSpan = PerfCounterToSeconds(m_exitTimes.back() - m_llStart);
+	double dInterval = 0.01;
+	while (dSpan / dInterval > 50)
+		dInterval *= 10;
+	os << L"Exit timeline (seconds since tracking started):" << std::endl
+		<< L"     From s        Exits   Cumulative" << std::endl;
+	size_t nCumulative = 0, ixExit = 0;
+	for (double dFrom = 0; ixExit < m_exitTimes.size(); dFrom += dInterval)
+	{
+		size_t nExits = 0;
+		while (ixExit < m_exitTimes.size() && PerfCounterToSeconds(m_exitTimes[ixExit] - m_llStart) < dFrom + dInterval)
+		{
+			++nExits;
+			++ixExit;
+		}
+		nCumulative += nExits;
+		FixedFormatGuard format(os, 2);
+		os << std::setw(11) << dFrom << std::setw(13) << nExits << std::setw(13) << nCumulative << std::endl;
+	}
+
+	os << L"Process lifetime in job (" << m_lifetimes.size() << L" processes): ";
+	WriteLatencySummary(os, SummarizeLatencies(m_lifetimes));
+	os << std::endl << std::endl;
+}
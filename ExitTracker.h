@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Windows.h>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------
+// Event-driven tracking of child process exits through a job object's I/O completion port
+
+/// <summary>
+/// Watches every process in a job object for exit, without polling and without a thread or wait per child: the job posts
+/// JOB_OBJECT_MSG_NEW_PROCESS and JOB_OBJECT_MSG_EXIT_PROCESS notifications to an I/O completion port, and one tracker
+/// thread dequeues them in batches. Records the time of each exit and how long each process lived in the job.
+/// </summary>
+class ExitTracker
+{
+public:
+	ExitTracker() = default;
+	~ExitTracker();
+
+	/// <summary>
+	/// Associates a new completion port with the job and starts the tracker thread.
+	/// Must be called before any process is assigned to the job.
+	/// </summary>
+	/// <param name="hJob">Input: job object to track</param>
+	/// <param name="nExpected">Input: expected number of processes, to preallocate storage</param>
+	/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+	bool Start(HANDLE hJob, size_t nExpected);
+
+	/// <summary>
+	/// Waits until at least nExits processes have exited, or until no exit has been seen for dwIdleTimeoutMs.
+	/// </summary>
+	/// <returns>Number of exits seen so far</returns>
+	size_t WaitForExits(size_t nExits, DWORD dwIdleTimeoutMs);
+
+	/// <summary>
+	/// Stops the tracker thread. Exits after this point are not recorded.
+	/// </summary>
+	void Stop();
+
+	/// <summary>
+	/// Writes the exit timeline (exits per interval since tracking started) and the distribution of process lifetimes.
+	/// </summary>
+	void WriteReport(std::wostream& os) const;
+
+private:
+	void TrackerThread();
+
+	HANDLE m_hPort = nullptr;
+	std::thread m_thread;
+	LONGLONG m_llStart = 0;
+
+	// Protects the following members
+	mutable std::mutex m_mtx;
+	std::condition_variable m_cvExit;
+	// Performance counter value at which each process currently in the job was reported as new
+	std::unordered_map<DWORD, LONGLONG> m_newProcessTimes;
+	// Performance counter value of each exit, in order
+	std::vector<LONGLONG> m_exitTimes;
+	// Time from JOB_OBJECT_MSG_NEW_PROCESS to the exit notification, for processes whose new-process notification was seen
+	std::vector<LONGLONG> m_lifetimes;
+	size_t m_nAbnormalExits = 0;
+
+	ExitTracker(const ExitTracker&) = delete;
+	ExitTracker& operator=(const ExitTracker&) = delete;
+};
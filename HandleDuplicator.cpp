@@ -0,0 +1,63 @@
+// Handle amplification: one zombie object, referenced by many duplicated handles
+
+#include <Windows.h>
+#include <Psapi.h>
+#include <iostream>
+#include "HandleDuplicator.h"
+#include "Utilities.h"
+#include "EventTracer.h"
+
+/// <summary>
+/// Returns this process' current paged pool quota usage, or 0 if it can't be retrieved.
+/// </summary>
+static SIZE_T CurrentPagedPoolUsage()
+{
+	PROCESS_MEMORY_COUNTERS pmc = { 0 };
+	pmc.cb = sizeof(pmc);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.QuotaPagedPoolUsage;
+}
+
+/// <summary>
+/// Duplicates hSource within this process nCopies times, keeping the duplicates open.
+/// Stops at the first DuplicateHandle failure.
+/// </summary>
+DuplicationResults_t DuplicateHandleRepeatedly(HANDLE hSource, int nCopies, std::vector<HANDLE>& duplicates)
+{
+	// Progress is reported once per batch rather than per handle, to keep console output out of the timing.
+	const int nBatchSize = 10000;
+
+	DuplicationResults_t results;
+	const HANDLE hThisProcess = GetCurrentProcess();
+	GetProcessHandleCount(hThisProcess, &results.dwHandleCountBefore);
+	results.cbPagedPoolBefore = CurrentPagedPoolUsage();
+	// Allocate all of the storage up front so that the timed loop only duplicates.
+	duplicates.reserve(duplicates.size() + size_t(nCopies));
+
+	const LONGLONG llStart = PerfCounterNow();
+	while (results.nDuplicated < nCopies && 0 == results.dwLastError)
+	{
+		int nBatchEnd = results.nDuplicated + nBatchSize;
+		if (nBatchEnd > nCopies)
+			nBatchEnd = nCopies;
+		for (; results.nDuplicated < nBatchEnd; ++results.nDuplicated)
+		{
+			HANDLE hDup = nullptr;
+			if (!DuplicateHandle(hThisProcess, hSource, hThisProcess, &hDup, 0, FALSE, DUPLICATE_SAME_ACCESS))
+			{
+				results.dwLastError = GetLastError();
+				break;
+			}
+			TraceEvent(TraceEventKind_t::HandleDuplicate, 0, 0, hDup);
+			duplicates.push_back(hDup);
+		}
+		// Write progress to the console with CR but no LF to overwrite previous lines
+		std::wcout << L"Progress: " << results.nDuplicated << L" ...          \r" << std::flush;
+	}
+	results.llElapsed = PerfCounterNow() - llStart;
+
+	GetProcessHandleCount(hThisProcess, &results.dwHandleCountAfter);
+	results.cbPagedPoolAfter = CurrentPagedPoolUsage();
+	return results;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------
+// Handle amplification: one zombie object, referenced by many duplicated handles
+
+/// <summary>
+/// Results of duplicating one handle many times within this process.
+/// </summary>
+struct DuplicationResults_t
+{
+	int nDuplicated = 0;
+	// Error code from a failed DuplicateHandle, or 0 if none failed
+	DWORD dwLastError = 0;
+	// Time spent duplicating, in performance counter units
+	LONGLONG llElapsed = 0;
+	// This process' handle count before and after duplication
+	DWORD dwHandleCountBefore = 0, dwHandleCountAfter = 0;
+	// This process' paged pool quota usage before and after duplication (the handle table is charged to it)
+	SIZE_T cbPagedPoolBefore = 0, cbPagedPoolAfter = 0;
+};
+
+/// <summary>
+/// Duplicates hSource within this process nCopies times, keeping the duplicates open.
+/// Stops at the first DuplicateHandle failure.
+/// </summary>
+/// <param name="hSource">Input: handle to duplicate</param>
+/// <param name="nCopies">Input: number of duplicates to create</param>
+/// <param name="duplicates">Output: the duplicated handles are appended to this vector</param>
+/// <returns>Counts, timing, and memory measurements for the duplication</returns>
+DuplicationResults_t DuplicateHandleRepeatedly(HANDLE hSource, int nCopies, std::vector<HANDLE>& duplicates);
@@ -0,0 +1,418 @@
+// Detached handle holder: a long-lived process that keeps the handles of zombies created by short-lived makers
+
+#include <Windows.h>
+#include <algorithm>
+#include "HandleHolder.h"
+#include "KernelMemory.h"
+#include "SysErrorMessage.h"
+#include "Utilities.h"
+
+/// <summary>
+/// First field of every request and reply
+/// </summary>
+static const DWORD HolderMagic = 0x444D485A; // "ZHMD"
+
+/// <summary>
+/// Converts a controller command name to the command.
+/// </summary>
+bool ParseHolderCommand(const wchar_t* szName, HolderCommand_t& command)
+{
+	if (0 == wcscmp(szName, L"release"))
+		command = HolderCommand_t::Release;
+	else if (0 == wcscmp(szName, L"stats"))
+		command = HolderCommand_t::Stats;
+	else if (0 == wcscmp(szName, L"quit"))
+		command = HolderCommand_t::Quit;
+	else
+		return false;
+	return true;
+}
+
+/// <summary>
+/// Returns the pipe name of the holder with the specified name.
+/// </summary>
+std::wstring HandleHolderPipeName(const std::wstring& sName)
+{
+	return L"\\\\.\\pipe\\ZombieMaker-Holder-" + sName;
+}
+
+/// <summary>
+/// Creates one instance of the holder's pipe. The first must be the first instance of that name, so that two holders
+/// can't share a name.
+/// </summary>
+/// <returns>Pipe handle, or INVALID_HANDLE_VALUE with GetLastError() set</returns>
+static HANDLE CreateHolderPipe(const std::wstring& sPipeName, bool bFirst)
+{
+	const DWORD cbBuffer = DWORD(sizeof(HolderRequest_t) + MaxHandlesPerTransfer * sizeof(ULONGLONG));
+	return CreateNamedPipeW(sPipeName.c_str(), PIPE_ACCESS_DUPLEX | (bFirst ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+		PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES,
+		cbBuffer, cbBuffer, 0, nullptr);
+}
+
+/// <summary>
+/// The holder's state across connections.
+/// </summary>
+struct HolderState_t
+{
+	std::vector<HANDLE> held;
+	ULONGLONG nReceived = 0;
+	ReleaseSettings_t releaseSettings;
+	KernelMemorySnapshot_t memStart;
+	bool bQuit = false;
+};
+
+/// <summary>
+/// Closes every held handle, writing the release report and the kernel memory change, and fills in the reply's counts.
+/// </summary>
+static void ReleaseHeldHandles(HolderState_t& state, HolderReply_t& reply)
+{
+	const size_t nHeld = state.held.size();
+	const ReleaseResults_t releaseResults = ReleaseHandles(state.releaseSettings, state.held);
+	reply.nReleased = releaseResults.nClosed;
+	reply.nReleaseFailures = releaseResults.nFailed;
+	reply.dReleaseSeconds = PerfCounterToSeconds(releaseResults.llElapsed);
+	if (0 != nHeld)
+		WriteReleaseReport(std::wcout, state.releaseSettings, releaseResults);
+	WriteKernelMemoryDelta(std::wcout, L"Kernel memory since the holder started", state.memStart, TakeKernelMemorySnapshot(), 0);
+}
+
+/// <summary>
+/// Reads and answers requests on one connection until the other end disconnects, then writes what it transferred.
+/// </summary>
+static void ServeConnection(HANDLE hPipe, std::vector<BYTE>& buffer, HolderState_t& state)
+{
+	DWORD dwSenderPid = 0;
+	size_t nBatches = 0, nTransferred = 0;
+	LONGLONG llFirstTransfer = 0, llLastTransfer = 0;
+	while (!state.bQuit)
+	{
+		DWORD cbRead = 0;
+		if (!ReadFile(hPipe, buffer.data(), DWORD(buffer.size()), &cbRead, nullptr))
+			break;
+		const HolderRequest_t* pRequest = reinterpret_cast<const HolderRequest_t*>(buffer.data());
+		HolderReply_t reply = { 0 };
+		reply.dwMagic = HolderMagic;
+		if (cbRead < sizeof(HolderRequest_t) || HolderMagic != pRequest->dwMagic)
+		{
+			reply.dwError = ERROR_INVALID_DATA;
+		}
+		else
+		{
+			dwSenderPid = pRequest->dwSenderPid;
+			switch (pRequest->command)
+			{
+			case HolderCommand_t::Transfer:
+				if (pRequest->nHandles > MaxHandlesPerTransfer || cbRead != sizeof(HolderRequest_t) + pRequest->nHandles * sizeof(ULONGLONG))
+				{
+					reply.dwError = ERROR_INVALID_DATA;
+				}
+				else
+				{
+					// The sender already duplicated the handles into this process; they only need to be kept.
+					const ULONGLONG* pValues = reinterpret_cast<const ULONGLONG*>(pRequest + 1);
+					for (DWORD ixHandle = 0; ixHandle < pRequest->nHandles; ++ixHandle)
+					{
+						state.held.push_back(reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(pValues[ixHandle])));
+					}
+					state.nReceived += pRequest->nHandles;
+					nTransferred += pRequest->nHandles;
+					if (0 == nBatches++)
+						llFirstTransfer = PerfCounterNow();
+					llLastTransfer = PerfCounterNow();
+				}
+				break;
+			case HolderCommand_t::Release:
+				std::wcout << L"Release requested by process " << dwSenderPid << std::endl;
+				ReleaseHeldHandles(state, reply);
+				break;
+			case HolderCommand_t::Stats:
+				break;
+			case HolderCommand_t::Quit:
+				std::wcout << L"Quit requested by process " << dwSenderPid << std::endl;
+				ReleaseHeldHandles(state, reply);
+				state.bQuit = true;
+				break;
+			default:
+				reply.dwError = ERROR_INVALID_DATA;
+				break;
+			}
+		}
+		reply.nHeld = state.held.size();
+		reply.nReceived = state.nReceived;
+		DWORD cbWritten = 0;
+		if (!WriteFile(hPipe, &reply, sizeof(reply), &cbWritten, nullptr))
+			break;
+	}
+	if (0 != nBatches)
+	{
+		// From the arrival of the first batch to the last, so this is the rate at which batches are absorbed.
+		const double dSeconds = PerfCounterToSeconds(llLastTransfer - llFirstTransfer);
+		FixedFormatGuard format(std::wcout, 1);
+		std::wcout << L"Received " << nTransferred << L" handles from process " << dwSenderPid << L" in " << nBatches << L" batches";
+		if (dSeconds > 0)
+			std::wcout << L" (" << double(nTransferred) / dSeconds << L" handles/sec)";
+		std::wcout << L"; holding " << state.held.size() << std::endl;
+	}
+}
+
+/// <summary>
+/// Runs this process as the holder until a Quit command.
+/// </summary>
+int RunHandleHolder(const std::wstring& sName, const ReleaseSettings_t& releaseSettings)
+{
+	const std::wstring sPipeName = HandleHolderPipeName(sName);
+	HolderState_t state;
+	state.releaseSettings = releaseSettings;
+	state.memStart = TakeKernelMemorySnapshot();
+	std::vector<BYTE> buffer(sizeof(HolderRequest_t) + MaxHandlesPerTransfer * sizeof(ULONGLONG));
+
+	HANDLE hPipe = CreateHolderPipe(sPipeName, true);
+	if (INVALID_HANDLE_VALUE == hPipe)
+	{
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot create " << sPipeName << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		return -2;
+	}
+	std::wcout << L"Holder " << GetCurrentProcessId() << L" listening on " << sPipeName << std::endl;
+	int nExitCode = 0;
+	while (!state.bQuit)
+	{
+		if (!ConnectNamedPipe(hPipe, nullptr) && ERROR_PIPE_CONNECTED != GetLastError())
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"ConnectNamedPipe failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			nExitCode = -2;
+			break;
+		}
+		// Create the next instance before serving this connection, so that the next maker can connect (and wait) meanwhile.
+		HANDLE hNextPipe = state.bQuit ? INVALID_HANDLE_VALUE : CreateHolderPipe(sPipeName, false);
+		const DWORD dwNextPipeErr = GetLastError();
+		ServeConnection(hPipe, buffer, state);
+		FlushFileBuffers(hPipe);
+		DisconnectNamedPipe(hPipe);
+		CloseHandle(hPipe);
+		hPipe = hNextPipe;
+		if (INVALID_HANDLE_VALUE == hPipe && !state.bQuit)
+		{
+			std::wcerr << L"Cannot create " << sPipeName << L": " << SysErrorMessageWithCode(dwNextPipeErr) << std::endl;
+			nExitCode = -2;
+			break;
+		}
+	}
+	if (INVALID_HANDLE_VALUE != hPipe)
+		CloseHandle(hPipe);
+	if (!state.held.empty())
+	{
+		HolderReply_t reply = { 0 };
+		ReleaseHeldHandles(state, reply);
+	}
+	return nExitCode;
+}
+
+/// <summary>
+/// Connects to the holder's pipe in message mode, waiting while all instances are busy.
+/// </summary>
+/// <returns>Pipe handle, or INVALID_HANDLE_VALUE with GetLastError() set</returns>
+static HANDLE ConnectToHolder(const std::wstring& sName, DWORD& dwHolderPid)
+{
+	// How long to wait for the holder to finish with another connection
+	const DWORD dwBusyWaitMs = 30000;
+	const std::wstring sPipeName = HandleHolderPipeName(sName);
+	for (;;)
+	{
+		HANDLE hPipe = CreateFileW(sPipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (INVALID_HANDLE_VALUE != hPipe)
+		{
+			DWORD dwMode = PIPE_READMODE_MESSAGE;
+			ULONG ulHolderPid = 0;
+			if (!SetNamedPipeHandleState(hPipe, &dwMode, nullptr, nullptr) || !GetNamedPipeServerProcessId(hPipe, &ulHolderPid))
+			{
+				DWORD dwLastErr = GetLastError();
+				CloseHandle(hPipe);
+				SetLastError(dwLastErr);
+				return INVALID_HANDLE_VALUE;
+			}
+			dwHolderPid = DWORD(ulHolderPid);
+			return hPipe;
+		}
+		if (ERROR_PIPE_BUSY != GetLastError() || !WaitNamedPipeW(sPipeName.c_str(), dwBusyWaitMs))
+			return INVALID_HANDLE_VALUE;
+	}
+}
+
+/// <summary>
+/// Writes one request message and reads the holder's reply.
+/// </summary>
+/// <returns>true if the holder replied without error; false otherwise, with GetLastError() set</returns>
+static bool TransactWithHolder(HANDLE hPipe, const void* pRequest, DWORD cbRequest, HolderReply_t& reply)
+{
+	DWORD cbWritten = 0, cbRead = 0;
+	if (!WriteFile(hPipe, pRequest, cbRequest, &cbWritten, nullptr) || !ReadFile(hPipe, &reply, sizeof(reply), &cbRead, nullptr))
+		return false;
+	if (sizeof(reply) != cbRead || HolderMagic != reply.dwMagic)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return false;
+	}
+	if (0 != reply.dwError)
+	{
+		SetLastError(reply.dwError);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Duplicates every handle into the holder and sends the holder's handle values in batches, closing each batch's handles
+/// here once the holder has accepted it.
+/// </summary>
+bool HandOffHandles(const std::wstring& sName, std::vector<HANDLE>& handles, HandoffResults_t& results)
+{
+	results = HandoffResults_t();
+	const LONGLONG llStart = PerfCounterNow();
+	DWORD dwHolderPid = 0;
+	HANDLE hPipe = ConnectToHolder(sName, dwHolderPid);
+	HANDLE hHolder = (INVALID_HANDLE_VALUE == hPipe) ? nullptr : OpenProcess(PROCESS_DUP_HANDLE, FALSE, dwHolderPid);
+	if (nullptr == hHolder)
+	{
+		// Keep ownership rules simple: the handles are gone either way.
+		results.dwLastError = GetLastError();
+		if (INVALID_HANDLE_VALUE != hPipe)
+			CloseHandle(hPipe);
+		for (HANDLE h : handles)
+			CloseHandle(h);
+		results.nFailed = handles.size();
+		handles.clear();
+		results.llElapsed = PerfCounterNow() - llStart;
+		SetLastError(results.dwLastError);
+		return false;
+	}
+
+	std::vector<BYTE> message(sizeof(HolderRequest_t) + MaxHandlesPerTransfer * sizeof(ULONGLONG));
+	HolderRequest_t* pRequest = reinterpret_cast<HolderRequest_t*>(message.data());
+	ULONGLONG* pValues = reinterpret_cast<ULONGLONG*>(pRequest + 1);
+	pRequest->dwMagic = HolderMagic;
+	pRequest->command = HolderCommand_t::Transfer;
+	pRequest->dwSenderPid = GetCurrentProcessId();
+	// This process's handles for the batch being sent; they're closed only once the holder has its copies.
+	std::vector<HANDLE> batch;
+	batch.reserve(MaxHandlesPerTransfer);
+	bool bSuccess = true;
+	size_t ixHandle = 0;
+	while (bSuccess && ixHandle < handles.size())
+	{
+		const size_t ixEnd = (std::min)(handles.size(), ixHandle + MaxHandlesPerTransfer);
+		DWORD nValues = 0;
+		batch.clear();
+		const LONGLONG llDuplicateStart = PerfCounterNow();
+		for (; ixHandle < ixEnd; ++ixHandle)
+		{
+			HANDLE hInHolder = nullptr;
+			if (DuplicateHandle(GetCurrentProcess(), handles[ixHandle], hHolder, &hInHolder, 0, FALSE, DUPLICATE_SAME_ACCESS))
+			{
+				pValues[nValues++] = static_cast<ULONGLONG>(reinterpret_cast<ULONG_PTR>(hInHolder));
+				batch.push_back(handles[ixHandle]);
+			}
+			else
+			{
+				results.dwLastError = GetLastError();
+				++results.nFailed;
+				CloseHandle(handles[ixHandle]);
+			}
+		}
+		results.llDuplicate += PerfCounterNow() - llDuplicateStart;
+		if (0 == nValues)
+			continue;
+		pRequest->nHandles = nValues;
+		HolderReply_t reply = { 0 };
+		bSuccess = TransactWithHolder(hPipe, message.data(), DWORD(sizeof(HolderRequest_t) + nValues * sizeof(ULONGLONG)), reply);
+		if (bSuccess)
+		{
+			results.nTransferred += nValues;
+			++results.nBatches;
+			results.nHeldByHolder = reply.nHeld;
+		}
+		else
+		{
+			results.dwLastError = GetLastError();
+			results.nFailed += nValues;
+			// A holder that replied with an error didn't keep the batch, so close its copies rather than orphan them. If
+			// the connection broke instead, the holder may or may not have kept them, and closing them could close
+			// handles it holds; they're left to the holder's release or exit.
+			if (HolderMagic == reply.dwMagic && 0 != reply.dwError)
+			{
+				for (DWORD ixValue = 0; ixValue < nValues; ++ixValue)
+				{
+					DuplicateHandle(hHolder, reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(pValues[ixValue])), nullptr, nullptr, 0, FALSE, DUPLICATE_CLOSE_SOURCE);
+				}
+			}
+		}
+		for (HANDLE h : batch)
+			CloseHandle(h);
+	}
+	// Handles not reached after a failed batch are still open here.
+	for (; ixHandle < handles.size(); ++ixHandle)
+	{
+		CloseHandle(handles[ixHandle]);
+		++results.nFailed;
+	}
+	handles.clear();
+	CloseHandle(hHolder);
+	CloseHandle(hPipe);
+	results.llElapsed = PerfCounterNow() - llStart;
+	if (!bSuccess)
+		SetLastError(results.dwLastError);
+	return bSuccess;
+}
+
+/// <summary>
+/// Writes the handoff's counts and transfer rate.
+/// </summary>
+void WriteHandoffReport(std::wostream& os, const HandoffResults_t& results)
+{
+	const double dSeconds = PerfCounterToSeconds(results.llElapsed);
+	FixedFormatGuard format(os, 3);
+	os
+		<< L"Handles handed off:  " << results.nTransferred << L" in " << results.nBatches << L" batches" << std::endl
+		<< L"Elapsed seconds:     " << dSeconds << L" (" << PerfCounterToSeconds(results.llDuplicate) << L" in DuplicateHandle)" << std::endl
+		<< L"Handles/sec:         " << (dSeconds > 0 ? double(results.nTransferred) / dSeconds : 0) << std::endl
+		<< L"Held by the holder:  " << results.nHeldByHolder << std::endl;
+	if (0 != results.nFailed)
+	{
+		os << L"Handoff failures:    " << results.nFailed << L" (last: " << SysErrorMessageWithCode(results.dwLastError) << L")" << std::endl;
+	}
+	os << std::endl;
+}
+
+/// <summary>
+/// Sends a Release, Stats, or Quit command to the holder and waits for its reply.
+/// </summary>
+bool SendHolderCommand(const std::wstring& sName, HolderCommand_t command, HolderReply_t& reply)
+{
+	DWORD dwHolderPid = 0;
+	HANDLE hPipe = ConnectToHolder(sName, dwHolderPid);
+	if (INVALID_HANDLE_VALUE == hPipe)
+		return false;
+	HolderRequest_t request = { HolderMagic, command, GetCurrentProcessId(), 0 };
+	const bool bSuccess = TransactWithHolder(hPipe, &request, sizeof(request), reply);
+	DWORD dwLastErr = GetLastError();
+	CloseHandle(hPipe);
+	SetLastError(dwLastErr);
+	return bSuccess;
+}
+
+/// <summary>
+/// Writes the holder's reply to a controller command.
+/// </summary>
+void WriteHolderReply(std::wostream& os, const HolderReply_t& reply)
+{
+	os
+		<< L"Holder handles held:     " << reply.nHeld << std::endl
+		<< L"Holder handles received: " << reply.nReceived << std::endl;
+	if (0 != reply.nReleased || 0 != reply.nReleaseFailures)
+	{
+		os
+			<< L"Handles released:        " << reply.nReleased << L" in " << reply.dReleaseSeconds << L" seconds" << std::endl
+			<< L"CloseHandle failures:    " << reply.nReleaseFailures << std::endl;
+	}
+}
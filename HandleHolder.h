@@ -0,0 +1,124 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "HandleReleaser.h"
+
+// ------------------------------------------------------------------------------------------
+// Detached handle holder: a long-lived process that keeps the handles of zombies created by short-lived makers
+
+/// <summary>
+/// Commands that a maker or controller sends to the holder.
+/// </summary>
+enum class HolderCommand_t : DWORD
+{
+	// The request is followed by nHandles handle values, already duplicated into the holder
+	Transfer = 1,
+	// Close every held handle
+	Release = 2,
+	// Report the held count and totals
+	Stats = 3,
+	// Close every held handle and exit
+	Quit = 4
+};
+
+/// <summary>
+/// Converts a controller command name (release, stats, or quit) to the command.
+/// </summary>
+/// <returns>true if szName is one of those names; false otherwise</returns>
+bool ParseHolderCommand(const wchar_t* szName, HolderCommand_t& command);
+
+/// <summary>
+/// Most handle values in one Transfer message.
+/// </summary>
+const DWORD MaxHandlesPerTransfer = 8192;
+
+/// <summary>
+/// Header of every message to the holder.
+/// </summary>
+struct HolderRequest_t
+{
+	DWORD dwMagic;
+	HolderCommand_t command;
+	DWORD dwSenderPid;
+	// For Transfer: number of handle values (as ULONGLONG, so that 32-bit makers can feed a 64-bit holder) that follow
+	DWORD nHandles;
+};
+
+/// <summary>
+/// The holder's reply to every message.
+/// </summary>
+struct HolderReply_t
+{
+	DWORD dwMagic;
+	// 0, or the error that made the holder reject the request
+	DWORD dwError;
+	// Handles held after the request, and handles received since the holder started
+	ULONGLONG nHeld;
+	ULONGLONG nReceived;
+	// For Release and Quit: handles closed, CloseHandle failures, and seconds spent closing
+	ULONGLONG nReleased;
+	ULONGLONG nReleaseFailures;
+	double dReleaseSeconds;
+};
+
+/// <summary>
+/// Returns the pipe name of the holder with the specified name: \\.\pipe\ZombieMaker-Holder-name.
+/// </summary>
+std::wstring HandleHolderPipeName(const std::wstring& sName);
+
+/// <summary>
+/// Runs this process as the holder: serves makers and controllers on the holder's pipe, one connection at a time, until
+/// a Quit command. Makers transfer handles in batches; Release closes all of them with the settings' strategy.
+/// </summary>
+/// <param name="sName">Input: holder name</param>
+/// <param name="releaseSettings">Input: how to close the held handles (JobClose isn't supported)</param>
+/// <returns>Process exit code</returns>
+int RunHandleHolder(const std::wstring& sName, const ReleaseSettings_t& releaseSettings);
+
+/// <summary>
+/// Handoff counts and timing.
+/// </summary>
+struct HandoffResults_t
+{
+	size_t nTransferred = 0;
+	// Handles that couldn't be duplicated into the holder (they're closed anyway)
+	size_t nFailed = 0;
+	DWORD dwLastError = 0;
+	size_t nBatches = 0;
+	// Wall time for the whole handoff, and the part of it spent in DuplicateHandle, in performance counter units
+	LONGLONG llElapsed = 0;
+	LONGLONG llDuplicate = 0;
+	// Handles the holder held after the last batch
+	ULONGLONG nHeldByHolder = 0;
+};
+
+/// <summary>
+/// Connects to the holder, duplicates every handle into it, and sends the holder's handle values in batches of up to
+/// MaxHandlesPerTransfer, closing each batch's handles here once the holder has accepted it. If the holder rejects a
+/// batch, its copies are closed in the holder; if the connection breaks, whatever the holder got stays there until it
+/// releases or exits. handles is empty on return, even if the handoff failed partway.
+/// </summary>
+/// <param name="sName">Input: holder name</param>
+/// <param name="handles">Input/output: handles to hand off</param>
+/// <param name="results">Output: counts and timing</param>
+/// <returns>true if every batch was accepted; false otherwise, with GetLastError() set</returns>
+bool HandOffHandles(const std::wstring& sName, std::vector<HANDLE>& handles, HandoffResults_t& results);
+
+/// <summary>
+/// Writes the handoff's counts and transfer rate.
+/// </summary>
+void WriteHandoffReport(std::wostream& os, const HandoffResults_t& results);
+
+/// <summary>
+/// Sends a Release, Stats, or Quit command to the holder and waits for its reply.
+/// </summary>
+/// <returns>true if the holder replied; false otherwise, with GetLastError() set</returns>
+bool SendHolderCommand(const std::wstring& sName, HolderCommand_t command, HolderReply_t& reply);
+
+/// <summary>
+/// Writes the holder's reply to a controller command.
+/// </summary>
+void WriteHolderReply(std::wostream& os, const HolderReply_t& reply);
@@ -0,0 +1,214 @@
+// Release phase: closes the leaked handles with a selectable strategy, and times the teardown
+
+#include <Windows.h>
+#include <algorithm>
+#include <iomanip>
+#include <thread>
+#include "HandleReleaser.h"
+#include "EventTracer.h"
+#include "LiveStats.h"
+#include "Utilities.h"
+#include "WorkerThreads.h"
+
+/// <summary>
+/// Returns the command-line name of a release strategy: serial, parallel, batch, or job.
+/// </summary>
+const wchar_t* ReleaseStrategyName(ReleaseStrategy_t strategy)
+{
+	switch (strategy)
+	{
+	case ReleaseStrategy_t::Serial: return L"serial";
+	case ReleaseStrategy_t::Parallel: return L"parallel";
+	case ReleaseStrategy_t::Batched: return L"batch";
+	case ReleaseStrategy_t::JobClose: return L"job";
+	default: return L"unknown";
+	}
+}
+
+/// <summary>
+/// Converts a release strategy's command-line form to the strategy and its parameters.
+/// </summary>
+bool ParseReleaseStrategy(const wchar_t* szStrategy, ReleaseSettings_t& settings)
+{
+	unsigned int nThreads = 0, nBatchSize = 0, dwBatchPauseMs = 0;
+	if (0 == wcscmp(szStrategy, L"serial"))
+		settings.strategy = ReleaseStrategy_t::Serial;
+	else if (0 == wcscmp(szStrategy, L"parallel"))
+		settings.strategy = ReleaseStrategy_t::Parallel;
+	else if (1 == swscanf_s(szStrategy, L"parallel:%u", &nThreads) && 0 != nThreads)
+	{
+		settings.strategy = ReleaseStrategy_t::Parallel;
+		settings.nThreads = nThreads;
+	}
+	else if (0 == wcscmp(szStrategy, L"batch"))
+		settings.strategy = ReleaseStrategy_t::Batched;
+	else if (2 == swscanf_s(szStrategy, L"batch:%u:%u", &nBatchSize, &dwBatchPauseMs) && 0 != nBatchSize)
+	{
+		settings.strategy = ReleaseStrategy_t::Batched;
+		settings.nBatchSize = nBatchSize;
+		settings.dwBatchPauseMs = dwBatchPauseMs;
+	}
+	else if (0 == wcscmp(szStrategy, L"job"))
+		settings.strategy = ReleaseStrategy_t::JobClose;
+	else
+		return false;
+	return true;
+}
+
+/// <summary>
+/// Closes handles[ixBegin, ixEnd), appending the latency of each close to latencies.
+/// </summary>
+/// <returns>Number of CloseHandle failures</returns>
+static size_t CloseRange(const std::vector<HANDLE>& handles, size_t ixBegin, size_t ixEnd, LiveStats* pLiveStats, std::vector<LONGLONG>& latencies)
+{
+	size_t nFailed = 0;
+	for (size_t ixHandle = ixBegin; ixHandle < ixEnd; ++ixHandle)
+	{
+		TraceEvent(TraceEventKind_t::HandleRelease, 0, 0, handles[ixHandle]);
+		const LONGLONG llStart = PerfCounterNow();
+		if (!CloseHandle(handles[ixHandle]))
+			++nFailed;
+		latencies.push_back(PerfCounterNow() - llStart);
+		if (nullptr != pLiveStats)
+			pLiveStats->OnHandlesReleased(1);
+	}
+	return nFailed;
+}
+
+/// <summary>
+/// Closes every handle in handles with the settings' strategy, then empties handles.
+/// </summary>
+ReleaseResults_t ReleaseHandles(const ReleaseSettings_t& settings, std::vector<HANDLE>& handles)
+{
+	ReleaseResults_t results;
+	std::vector<LONGLONG> latencies;
+	latencies.reserve(handles.size());
+	const LONGLONG llStart = PerfCounterNow();
+	switch (settings.strategy)
+	{
+	case ReleaseStrategy_t::Parallel:
+	{
+		results.nThreads = (0 != settings.nThreads) ? settings.nThreads : (std::max)(std::thread::hardware_concurrency(), 1u);
+		// Each thread records into its own vector, so that the threads share nothing while closing.
+		std::vector<std::vector<LONGLONG>> perThreadLatencies(results.nThreads);
+		std::vector<size_t> perThreadFailures(results.nThreads);
+		// Threads claim handles in batches, so that one thread stuck on slow closes doesn't hold up a fixed share.
+		SharedWorkBudget budget(handles.size(), 256);
+		RunWorkerThreads(results.nThreads, [&](unsigned int ixThread)
+			{
+				perThreadLatencies[ixThread].reserve(handles.size() / results.nThreads + 1);
+				ProcessClaimedItems(budget, [&](size_t ixHandle)
+					{
+						perThreadFailures[ixThread] += CloseRange(handles, ixHandle, ixHandle + 1, settings.pLiveStats, perThreadLatencies[ixThread]);
+						return true;
+					});
+			});
+		for (unsigned int ixThread = 0; ixThread < results.nThreads; ++ixThread)
+		{
+			latencies.insert(latencies.end(), perThreadLatencies[ixThread].begin(), perThreadLatencies[ixThread].end());
+			results.nFailed += perThreadFailures[ixThread];
+		}
+		break;
+	}
+	case ReleaseStrategy_t::Batched:
+		for (size_t ixBatch = 0; ixBatch < handles.size(); ixBatch += settings.nBatchSize)
+		{
+			if (0 != ixBatch)
+				Sleep(settings.dwBatchPauseMs);
+			results.nFailed += CloseRange(handles, ixBatch, (std::min)(ixBatch + settings.nBatchSize, handles.size()), settings.pLiveStats, latencies);
+		}
+		break;
+	case ReleaseStrategy_t::JobClose:
+		if (nullptr != settings.hJob)
+		{
+			CloseHandle(settings.hJob);
+			// Terminated processes and threads are signaled once the kernel has torn them down.
+			for (HANDLE h : handles)
+			{
+				WaitForSingleObject(h, INFINITE);
+			}
+			results.llJobClose = PerfCounterNow() - llStart;
+		}
+		results.nFailed += CloseRange(handles, 0, handles.size(), settings.pLiveStats, latencies);
+		break;
+	case ReleaseStrategy_t::Serial:
+	default:
+		results.nFailed += CloseRange(handles, 0, handles.size(), settings.pLiveStats, latencies);
+		break;
+	}
+	results.llElapsed = PerfCounterNow() - llStart;
+	results.nClosed = handles.size() - results.nFailed;
+	results.closeLatency = SummarizeLatencies(std::move(latencies));
+	handles.clear();
+	return results;
+}
+
+/// <summary>
+/// Writes the release phase's counts and timing.
+/// </summary>
+void WriteReleaseReport(std::wostream& os, const ReleaseSettings_t& settings, const ReleaseResults_t& results)
+{
+	const double dSeconds = PerfCounterToSeconds(results.llElapsed);
+	os << L"Release strategy:  " << ReleaseStrategyName(settings.strategy);
+	if (ReleaseStrategy_t::Parallel == settings.strategy)
+		os << L" (" << results.nThreads << L" threads)";
+	else if (ReleaseStrategy_t::Batched == settings.strategy)
+		os << L" (" << settings.nBatchSize << L" handles, then " << settings.dwBatchPauseMs << L" ms pause)";
+	os
+		<< std::endl
+		<< L"Handles closed:    " << results.nClosed << std::endl;
+	if (0 != results.nFailed)
+		os << L"Close failures:    " << results.nFailed << std::endl;
+	if (ReleaseStrategy_t::JobClose == settings.strategy)
+		os << L"Job close seconds: " << PerfCounterToSeconds(results.llJobClose) << std::endl;
+	os
+		<< L"Elapsed seconds:   " << dSeconds << std::endl
+		<< L"Closes/sec:        " << (dSeconds > 0 ? double(results.nClosed) / dSeconds : 0) << std::endl
+		<< L"Close latency:     ";
+	WriteLatencySummary(os, results.closeLatency);
+	os << std::endl << std::endl;
+}
+
+/// <summary>
+/// Returns the percentage of the growth from before to spawned that has been given back at now.
+/// </summary>
+static double PercentReclaimed(ULONGLONG before, ULONGLONG spawned, ULONGLONG now)
+{
+	if (spawned <= before)
+		return 100.0;
+	return 100.0 * (double(LONGLONG(spawned) - LONGLONG(now)) / double(spawned - before));
+}
+
+/// <summary>
+/// Samples the system-wide kernel memory counters every quarter second after a release, and writes how much of the
+/// growth caused by spawning has been reclaimed at each sample.
+/// </summary>
+void TrackMemoryReclaim(std::wostream& os, const KernelMemorySnapshot_t& memBeforeSpawn, const KernelMemorySnapshot_t& memAfterSpawn,
+	LONGLONG llReleaseStart, double dMaxSeconds)
+{
+	if (!memBeforeSpawn.bValid || !memAfterSpawn.bValid)
+		return;
+	const DWORD dwIntervalMs = 250;
+	os
+		<< L"Kernel memory reclaimed after release (percent of the growth from spawning):" << std::endl
+		<< L"   Seconds  Nonpaged %   Paged %  Commit %" << std::endl;
+	for (;;)
+	{
+		const KernelMemorySnapshot_t memNow = TakeKernelMemorySnapshot();
+		const double dSeconds = PerfCounterToSeconds(PerfCounterNow() - llReleaseStart);
+		if (!memNow.bValid)
+			break;
+		const double dCommitPercent = PercentReclaimed(memBeforeSpawn.cbCommit, memAfterSpawn.cbCommit, memNow.cbCommit);
+		FixedFormatGuard format(os, 2);
+		os << std::setw(10) << dSeconds
+			<< std::setprecision(1)
+			<< std::setw(12) << PercentReclaimed(memBeforeSpawn.cbNonpagedPool, memAfterSpawn.cbNonpagedPool, memNow.cbNonpagedPool)
+			<< std::setw(10) << PercentReclaimed(memBeforeSpawn.cbPagedPool, memAfterSpawn.cbPagedPool, memNow.cbPagedPool)
+			<< std::setw(10) << dCommitPercent
+			<< std::endl;
+		if (dCommitPercent >= 100.0 || dSeconds >= dMaxSeconds)
+			break;
+		Sleep(dwIntervalMs);
+	}
+	os << std::endl;
+}
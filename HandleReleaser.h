@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <vector>
+#include "KernelMemory.h"
+#include "LatencyStats.h"
+
+class LiveStats;
+
+// ------------------------------------------------------------------------------------------
+// Release phase: closes the leaked handles with a selectable strategy, and times the teardown
+
+/// <summary>
+/// Ways to close the leaked handles at the end of a run.
+/// </summary>
+enum class ReleaseStrategy_t
+{
+	// CloseHandle on each handle in turn, on one thread
+	Serial,
+	// CloseHandle spread across several threads, each closing a contiguous share of the handles
+	Parallel,
+	// CloseHandle in fixed-size batches, pausing after each batch
+	Batched,
+	// Close the job object first, so that its kill-on-close limit terminates any children still running, then close
+	// the handles on one thread
+	JobClose
+};
+
+/// <summary>
+/// Returns the command-line name of a release strategy: serial, parallel, batch, or job.
+/// </summary>
+const wchar_t* ReleaseStrategyName(ReleaseStrategy_t strategy);
+
+/// <summary>
+/// Settings for the release phase.
+/// </summary>
+struct ReleaseSettings_t
+{
+	ReleaseStrategy_t strategy = ReleaseStrategy_t::Serial;
+	// Closing threads for Parallel, or 0 for one per logical processor
+	unsigned int nThreads = 0;
+	// Handles per batch, and milliseconds to pause after each batch, for Batched
+	size_t nBatchSize = 1000;
+	DWORD dwBatchPauseMs = 100;
+	// Job object to close first for JobClose (created with JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE); closed by ReleaseHandles
+	HANDLE hJob = nullptr;
+	// Receives released-handle counts for the live statistics page, or nullptr
+	LiveStats* pLiveStats = nullptr;
+};
+
+/// <summary>
+/// Converts a release strategy's command-line form (serial, parallel[:threads], batch[:size:ms], or job) to the
+/// strategy and its parameters in settings.
+/// </summary>
+/// <returns>true if szStrategy is a valid strategy; false otherwise, with settings unchanged</returns>
+bool ParseReleaseStrategy(const wchar_t* szStrategy, ReleaseSettings_t& settings);
+
+/// <summary>
+/// Timing of the release phase.
+/// </summary>
+struct ReleaseResults_t
+{
+	size_t nClosed = 0;
+	// CloseHandle failures
+	size_t nFailed = 0;
+	// Closing threads actually used
+	unsigned int nThreads = 1;
+	// Wall time for the whole release, including batch pauses and the job close, in performance counter units
+	LONGLONG llElapsed = 0;
+	// For JobClose: time to close the job and for all the handles' objects to be signaled
+	LONGLONG llJobClose = 0;
+	// Latency of each CloseHandle
+	LatencySummary_t closeLatency;
+};
+
+/// <summary>
+/// Closes every handle in handles with the settings' strategy, recording a trace event and the latency of each close,
+/// then empties handles.
+/// </summary>
+/// <param name="settings">Input: strategy and its parameters</param>
+/// <param name="handles">Input/output: handles to close; empty on return</param>
+/// <returns>Counts and timing</returns>
+ReleaseResults_t ReleaseHandles(const ReleaseSettings_t& settings, std::vector<HANDLE>& handles);
+
+/// <summary>
+/// Writes the release phase's counts and timing.
+/// </summary>
+void WriteReleaseReport(std::wostream& os, const ReleaseSettings_t& settings, const ReleaseResults_t& results);
+
+/// <summary>
+/// Samples the system-wide kernel memory counters every quarter second after a release, for up to dMaxSeconds or until
+/// the commit charge is back to where it was before spawning, and writes how much of the growth between memBeforeSpawn
+/// and memAfterSpawn has been reclaimed at each sample, timed from llReleaseStart.
+/// </summary>
+void TrackMemoryReclaim(std::wostream& os, const KernelMemorySnapshot_t& memBeforeSpawn, const KernelMemorySnapshot_t& memAfterSpawn,
+	LONGLONG llReleaseStart, double dMaxSeconds);
@@ -0,0 +1,65 @@
+// System-wide kernel memory counters, for measuring the cost of each zombie
+
+#include <Windows.h>
+#include <Psapi.h>
+#include <iomanip>
+#include "KernelMemory.h"
+#include "Utilities.h"
+
+/// <summary>
+/// Captures the current system-wide kernel memory counters.
+/// </summary>
+KernelMemorySnapshot_t TakeKernelMemorySnapshot()
+{
+	KernelMemorySnapshot_t snapshot;
+	PERFORMANCE_INFORMATION perfInfo = { 0 };
+	perfInfo.cb = sizeof(perfInfo);
+	if (GetPerformanceInfo(&perfInfo, sizeof(perfInfo)))
+	{
+		// GetPerformanceInfo reports memory sizes in pages.
+		const ULONGLONG cbPage = perfInfo.PageSize;
+		snapshot.cbNonpagedPool = perfInfo.KernelNonpaged * cbPage;
+		snapshot.cbPagedPool = perfInfo.KernelPaged * cbPage;
+		snapshot.cbCommit = perfInfo.CommitTotal * cbPage;
+		snapshot.nHandles = perfInfo.HandleCount;
+		snapshot.nProcesses = perfInfo.ProcessCount;
+		snapshot.nThreads = perfInfo.ThreadCount;
+		snapshot.bValid = true;
+	}
+	return snapshot;
+}
+
+/// <summary>
+/// Internal helper to write one line of the delta report.
+/// </summary>
+static void WriteDeltaLine(std::wostream& os, const wchar_t* szCounter, ULONGLONG before, ULONGLONG after, size_t nZombies)
+{
+	const LONGLONG delta = LONGLONG(after) - LONGLONG(before);
+	os << L"  " << std::left << std::setw(15) << szCounter << std::right
+		<< std::setw(16) << before << L" -> " << std::setw(16) << after
+		<< L"  (" << std::showpos << delta << std::noshowpos << L")";
+	if (nZombies > 0)
+	{
+		FixedFormatGuard format(os, 1);
+		os << L"  " << double(delta) / double(nZombies) << L" bytes/zombie";
+	}
+	os << std::endl;
+}
+
+/// <summary>
+/// Writes the change in kernel memory counters between two snapshots, and the change per zombie.
+/// Nothing is written if either snapshot is invalid.
+/// </summary>
+void WriteKernelMemoryDelta(std::wostream& os, const wchar_t* szTitle, const KernelMemorySnapshot_t& before, const KernelMemorySnapshot_t& after, size_t nZombies)
+{
+	if (!before.bValid || !after.bValid)
+		return;
+	os << szTitle << L" (system-wide):" << std::endl;
+	WriteDeltaLine(os, L"Nonpaged pool:", before.cbNonpagedPool, after.cbNonpagedPool, nZombies);
+	WriteDeltaLine(os, L"Paged pool:", before.cbPagedPool, after.cbPagedPool, nZombies);
+	WriteDeltaLine(os, L"Commit:", before.cbCommit, after.cbCommit, nZombies);
+	WriteDeltaLine(os, L"Handles:", before.nHandles, after.nHandles, 0);
+	WriteDeltaLine(os, L"Processes:", before.nProcesses, after.nProcesses, 0);
+	WriteDeltaLine(os, L"Threads:", before.nThreads, after.nThreads, 0);
+	os << std::endl;
+}
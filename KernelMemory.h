@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+
+// ------------------------------------------------------------------------------------------
+// System-wide kernel memory counters, for measuring the cost of each zombie
+
+/// <summary>
+/// System-wide memory and object counters at one point in time, from GetPerformanceInfo.
+/// </summary>
+struct KernelMemorySnapshot_t
+{
+	bool bValid = false;
+	ULONGLONG cbNonpagedPool = 0;
+	ULONGLONG cbPagedPool = 0;
+	ULONGLONG cbCommit = 0;
+	DWORD nHandles = 0;
+	DWORD nProcesses = 0;
+	DWORD nThreads = 0;
+};
+
+/// <summary>
+/// Captures the current system-wide kernel memory counters.
+/// </summary>
+/// <returns>Snapshot; bValid is false (and GetLastError() is set) if the counters can't be retrieved</returns>
+KernelMemorySnapshot_t TakeKernelMemorySnapshot();
+
+/// <summary>
+/// Writes the change in kernel memory counters between two snapshots, and the change per zombie.
+/// Nothing is written if either snapshot is invalid.
+/// </summary>
+/// <param name="os">Output: stream to write to</param>
+/// <param name="szTitle">Input: heading for the report, e.g., "Kernel memory after spawning"</param>
+/// <param name="before">Input: earlier snapshot</param>
+/// <param name="after">Input: later snapshot</param>
+/// <param name="nZombies">Input: number of zombies the change is attributed to (no per-zombie figures if 0)</param>
+void WriteKernelMemoryDelta(std::wostream& os, const wchar_t* szTitle, const KernelMemorySnapshot_t& before, const KernelMemorySnapshot_t& after, size_t nZombies);
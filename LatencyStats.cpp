@@ -0,0 +1,177 @@
+// Per-operation latency samples and percentile summaries
+
+#include <Windows.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "LatencyStats.h"
+#include "StringUtils.h"
+#include "Utilities.h"
+
+/// <summary>
+/// Converts a performance counter interval to microseconds.
+/// </summary>
+static double TicksToMicroseconds(LONGLONG llTicks)
+{
+	return PerfCounterToSeconds(llTicks) * 1000000.0;
+}
+
+/// <summary>
+/// Returns the index of the nearest-rank percentile in a sorted set of nSamples values.
+/// </summary>
+size_t NearestRankIndex(size_t nSamples, double dPercentile)
+{
+	size_t ixRank = size_t(dPercentile / 100.0 * double(nSamples) + 0.999999);
+	if (ixRank > 0)
+		--ixRank;
+	if (ixRank >= nSamples)
+		ixRank = nSamples - 1;
+	return ixRank;
+}
+
+/// <summary>
+/// Returns the nearest-rank percentile from a sorted, non-empty vector.
+/// </summary>
+static LONGLONG Percentile(const std::vector<LONGLONG>& sorted, double dPercentile)
+{
+	return sorted[NearestRankIndex(sorted.size(), dPercentile)];
+}
+
+/// <summary>
+/// Computes the percentile summary of a set of latency samples.
+/// </summary>
+LatencySummary_t SummarizeLatencies(std::vector<LONGLONG> ticks)
+{
+	LatencySummary_t summary;
+	summary.nSamples = ticks.size();
+	if (ticks.empty())
+		return summary;
+	std::sort(ticks.begin(), ticks.end());
+	summary.p50Us = TicksToMicroseconds(Percentile(ticks, 50));
+	summary.p90Us = TicksToMicroseconds(Percentile(ticks, 90));
+	summary.p99Us = TicksToMicroseconds(Percentile(ticks, 99));
+	summary.maxUs = TicksToMicroseconds(ticks.back());
+	return summary;
+}
+
+/// <summary>
+/// Writes a latency summary to a stream as "p50 ... p90 ... p99 ... max ..." in microseconds.
+/// </summary>
+void WriteLatencySummary(std::wostream& os, const LatencySummary_t& summary)
+{
+	FixedFormatGuard format(os, 1);
+	os << L"p50 " << summary.p50Us << L" us, p90 " << summary.p90Us << L" us, p99 " << summary.p99Us << L" us, max " << summary.maxUs << L" us";
+}
+
+// ------------------------------------------------------------------------------------------
+
+/// <summary>
+/// Preallocates (and touches) space for nCapacity samples so that recording never allocates.
+/// </summary>
+SpawnLatencyRecorder::SpawnLatencyRecorder(int nCapacity)
+	: m_samples(size_t(nCapacity > 0 ? nCapacity : 0), -1)
+{
+}
+
+/// <summary>
+/// Returns the percentile summary of each bucket of BucketSize spawns, in population order.
+/// Positions for which no spawn succeeded are excluded; trailing empty buckets are omitted.
+/// </summary>
+std::vector<LatencySummary_t> SpawnLatencyRecorder::BucketSummaries() const
+{
+	std::vector<LatencySummary_t> buckets;
+	std::vector<LONGLONG> bucketSamples;
+	bucketSamples.reserve(BucketSize);
+	for (size_t ixStart = 0; ixStart < m_samples.size(); ixStart += BucketSize)
+	{
+		bucketSamples.clear();
+		const size_t ixEnd = (std::min)(ixStart + BucketSize, m_samples.size());
+		for (size_t ix = ixStart; ix < ixEnd; ++ix)
+		{
+			if (m_samples[ix] >= 0)
+				bucketSamples.push_back(m_samples[ix]);
+		}
+		buckets.push_back(SummarizeLatencies(bucketSamples));
+	}
+	while (!buckets.empty() && 0 == buckets.back().nSamples)
+		buckets.pop_back();
+	return buckets;
+}
+
+/// <summary>
+/// Returns the percentile summary of all recorded spawns.
+/// </summary>
+LatencySummary_t SpawnLatencyRecorder::OverallSummary() const
+{
+	std::vector<LONGLONG> samples;
+	samples.reserve(m_samples.size());
+	for (LONGLONG llSample : m_samples)
+	{
+		if (llSample >= 0)
+			samples.push_back(llSample);
+	}
+	return SummarizeLatencies(std::move(samples));
+}
+
+/// <summary>
+/// Writes a table of per-bucket latency percentiles.
+/// </summary>
+void SpawnLatencyRecorder::WriteBucketTable(std::wostream& os) const
+{
+	std::vector<LatencySummary_t> buckets = BucketSummaries();
+	if (buckets.empty())
+		return;
+	FixedFormatGuard format(os, 1);
+	os << L"Spawn latency by population (microseconds):" << std::endl
+		<< L"  Population       p50       p90       p99       max" << std::endl;
+	for (size_t ixBucket = 0; ixBucket < buckets.size(); ++ixBucket)
+	{
+		const LatencySummary_t& b = buckets[ixBucket];
+		const size_t nPopulation = (std::min)((ixBucket + 1) * BucketSize, m_samples.size());
+		os << L"  " << std::setw(10) << nPopulation
+			<< std::setw(10) << b.p50Us << std::setw(10) << b.p90Us << std::setw(10) << b.p99Us << std::setw(10) << b.maxUs
+			<< std::endl;
+	}
+}
+
+/// <summary>
+/// Writes the latency-versus-population curve as JSON: the per-bucket percentiles and every individual sample.
+/// </summary>
+bool SpawnLatencyRecorder::WriteJson(const std::wstring& sFilePath, const char* szMode, unsigned int nSpawnerThreads, int nStarted, double dElapsedSeconds) const
+{
+	std::vector<LatencySummary_t> buckets = BucketSummaries();
+	std::stringstream json;
+	json << std::fixed << std::setprecision(3)
+		<< "{" << std::endl
+		<< "  \"timestampUTC\": \"" << WStringToUtf8(TimestampUTC(true)) << "\"," << std::endl
+		<< "  \"mode\": \"" << szMode << "\"," << std::endl
+		<< "  \"spawnerThreads\": " << nSpawnerThreads << "," << std::endl
+		<< "  \"requested\": " << m_samples.size() << "," << std::endl
+		<< "  \"started\": " << nStarted << "," << std::endl
+		<< "  \"elapsedSeconds\": " << dElapsedSeconds << "," << std::endl
+		<< "  \"spawnsPerSecond\": " << (dElapsedSeconds > 0 ? nStarted / dElapsedSeconds : 0) << "," << std::endl
+		<< "  \"bucketSize\": " << BucketSize << "," << std::endl
+		<< "  \"buckets\": [";
+	for (size_t ixBucket = 0; ixBucket < buckets.size(); ++ixBucket)
+	{
+		const LatencySummary_t& b = buckets[ixBucket];
+		json << (0 == ixBucket ? "" : ",") << std::endl
+			<< "    { \"population\": " << (std::min)((ixBucket + 1) * BucketSize, m_samples.size())
+			<< ", \"samples\": " << b.nSamples
+			<< ", \"p50Us\": " << b.p50Us << ", \"p90Us\": " << b.p90Us << ", \"p99Us\": " << b.p99Us << ", \"maxUs\": " << b.maxUs << " }";
+	}
+	json << std::endl << "  ]," << std::endl
+		<< "  \"samplesUs\": [";
+	// One entry per population position; null where no spawn succeeded.
+	for (size_t ix = 0; ix < m_samples.size(); ++ix)
+	{
+		json << (0 == ix ? "" : ",") << (0 == ix % 20 ? "\n    " : " ");
+		if (m_samples[ix] >= 0)
+			json << TicksToMicroseconds(m_samples[ix]);
+		else
+			json << "null";
+	}
+	json << std::endl << "  ]" << std::endl
+		<< "}" << std::endl;
+	return WriteTextFile(sFilePath, json.str());
+}
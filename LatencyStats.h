@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// ------------------------------------------------------------------------------------------
+// Per-operation latency samples and percentile summaries
+
+/// <summary>
+/// Percentile summary of a set of latency samples, in microseconds.
+/// </summary>
+struct LatencySummary_t
+{
+	size_t nSamples = 0;
+	double p50Us = 0, p90Us = 0, p99Us = 0, maxUs = 0;
+};
+
+/// <summary>
+/// Returns the index of the nearest-rank percentile in a sorted set of nSamples (1 or more) values, so that every report
+/// ranks samples the same way.
+/// </summary>
+size_t NearestRankIndex(size_t nSamples, double dPercentile);
+
+/// <summary>
+/// Computes the percentile summary of a set of latency samples.
+/// </summary>
+/// <param name="ticks">Input: latency samples in performance counter units (taken by value because it gets sorted)</param>
+/// <returns>Percentile summary in microseconds</returns>
+LatencySummary_t SummarizeLatencies(std::vector<LONGLONG> ticks);
+
+/// <summary>
+/// Writes a latency summary to a stream as "p50 ... p90 ... p99 ... max ..." in microseconds.
+/// </summary>
+void WriteLatencySummary(std::wostream& os, const LatencySummary_t& summary);
+
+/// <summary>
+/// Records the latency of each spawn into a buffer preallocated for the whole run, indexed by the spawn's position in
+/// the zombie population. Multiple threads can record concurrently as long as each index is recorded by only one thread.
+/// </summary>
+class SpawnLatencyRecorder
+{
+public:
+	/// <summary>
+	/// Preallocates (and touches) space for nCapacity samples so that recording never allocates.
+	/// </summary>
+	explicit SpawnLatencyRecorder(int nCapacity);
+
+	/// <summary>
+	/// Records the latency of the spawn at index ixSpawn in the population. Out-of-range indexes are ignored.
+	/// </summary>
+	void Record(int ixSpawn, LONGLONG llTicks)
+	{
+		if (ixSpawn >= 0 && size_t(ixSpawn) < m_samples.size())
+			m_samples[size_t(ixSpawn)] = llTicks;
+	}
+
+	/// <summary>
+	/// Number of population positions per bucket in reports.
+	/// </summary>
+	static const int BucketSize = 1000;
+
+	/// <summary>
+	/// Returns the percentile summary of each bucket of BucketSize spawns, in population order.
+	/// Positions for which no spawn succeeded are excluded; trailing empty buckets are omitted.
+	/// </summary>
+	std::vector<LatencySummary_t> BucketSummaries() const;
+
+	/// <summary>
+	/// Returns the percentile summary of all recorded spawns.
+	/// </summary>
+	LatencySummary_t OverallSummary() const;
+
+	/// <summary>
+	/// Writes a table of per-bucket latency percentiles.
+	/// </summary>
+	void WriteBucketTable(std::wostream& os) const;
+
+	/// <summary>
+	/// Writes the latency-versus-population curve as JSON: the per-bucket percentiles and every individual sample.
+	/// </summary>
+	/// <param name="sFilePath">Input: path of the file to create or replace</param>
+	/// <param name="szMode">Input: what was spawned, e.g., "processes"</param>
+	/// <param name="nSpawnerThreads">Input: number of threads that spawned</param>
+	/// <param name="nStarted">Input: number of successful spawns</param>
+	/// <param name="dElapsedSeconds">Input: wall time of the run</param>
+	/// <returns>true if written; false otherwise, with GetLastError() set</returns>
+	bool WriteJson(const std::wstring& sFilePath, const char* szMode, unsigned int nSpawnerThreads, int nStarted, double dElapsedSeconds) const;
+
+private:
+	// One sample per population position; -1 for positions without a successful spawn.
+	std::vector<LONGLONG> m_samples;
+};
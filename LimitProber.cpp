@@ -0,0 +1,201 @@
+// Kernel object limit prober: finds the largest zombie population the system sustains
+
+#include <Windows.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+#include "LimitProber.h"
+#include "ThreadLeaker.h"
+#include "EventTracer.h"
+#include "KernelMemory.h"
+#include "LiveStats.h"
+#include "SysErrorMessage.h"
+
+/// <summary>
+/// Returns a short category name for a creation error code: quota, commit, kernel pool, thread limit, or other.
+/// </summary>
+const wchar_t* ClassifyCreationError(DWORD dwErrCode)
+{
+	switch (dwErrCode)
+	{
+	case ERROR_NOT_ENOUGH_QUOTA:
+	case ERROR_PAGEFILE_QUOTA:
+	case ERROR_WORKING_SET_QUOTA:
+		return L"quota";
+	case ERROR_COMMITMENT_LIMIT:
+	case ERROR_NOT_ENOUGH_MEMORY:
+	case ERROR_OUTOFMEMORY:
+		return L"commit";
+	case ERROR_NO_SYSTEM_RESOURCES:
+	case ERROR_NONPAGED_SYSTEM_RESOURCES:
+	case ERROR_PAGED_SYSTEM_RESOURCES:
+		return L"kernel pool";
+	case ERROR_MAX_THRDS_REACHED:
+	case ERROR_TOO_MANY_THREADS:
+		return L"thread limit";
+	default:
+		return L"other";
+	}
+}
+
+/// <summary>
+/// Population of zombies being probed, with the handles needed to release them again.
+/// </summary>
+class ProbePopulation
+{
+public:
+	explicit ProbePopulation(const ProbeTarget_t& target) : m_target(target) {}
+	~ProbePopulation() { ShrinkTo(0); }
+
+	size_t Size() const { return m_zombies.size(); }
+
+	/// <summary>
+	/// Creates zombies until the population reaches nTarget.
+	/// </summary>
+	/// <returns>0 if the target was reached; otherwise the error code of the failed creation</returns>
+	DWORD GrowTo(size_t nTarget)
+	{
+		while (m_zombies.size() < nTarget)
+		{
+			Zombie_t zombie;
+			if (nullptr != m_target.pfnThread)
+			{
+				zombie.hPrimary = CreateLeakableThread(m_target.pfnThread, m_target.cbStackReserve);
+				if (nullptr == zombie.hPrimary)
+				{
+					const DWORD dwLastErr = GetLastError();
+					if (nullptr != m_target.pLiveStats)
+						m_target.pLiveStats->OnFailed(dwLastErr);
+					return dwLastErr;
+				}
+				if (nullptr != m_target.pLiveStats)
+					m_target.pLiveStats->OnSpawned();
+			}
+			else
+			{
+				PROCESS_INFORMATION pi;
+				if (!StartZombieProc(*m_target.pSettings, pi))
+					return GetLastError();
+				zombie.hPrimary = pi.hProcess;
+				zombie.hSecondary = pi.hThread;
+			}
+			m_zombies.push_back(zombie);
+			if (nullptr != m_target.pLiveStats)
+				m_target.pLiveStats->OnHandlesKept(nullptr != zombie.hSecondary ? 2 : 1);
+			if (0 == m_zombies.size() % 1000)
+			{
+				// Write progress to the console with CR but no LF to overwrite previous lines
+				std::wcout << L"Progress: " << m_zombies.size() << L" ...          \r" << std::flush;
+			}
+		}
+		return 0;
+	}
+
+	/// <summary>
+	/// Releases the most recently created zombies until the population is down to nTarget.
+	/// </summary>
+	void ShrinkTo(size_t nTarget)
+	{
+		while (m_zombies.size() > nTarget)
+		{
+			const Zombie_t& zombie = m_zombies.back();
+			if (nullptr != m_target.pLiveStats)
+				m_target.pLiveStats->OnHandlesReleased(nullptr != zombie.hSecondary ? 2 : 1);
+			TraceEvent(TraceEventKind_t::HandleRelease, 0, 0, zombie.hPrimary);
+			CloseHandle(zombie.hPrimary);
+			if (nullptr != zombie.hSecondary)
+			{
+				TraceEvent(TraceEventKind_t::HandleRelease, 0, 0, zombie.hSecondary);
+				CloseHandle(zombie.hSecondary);
+			}
+			m_zombies.pop_back();
+		}
+	}
+
+private:
+	// Process handle and its thread handle, or a thread handle by itself
+	struct Zombie_t
+	{
+		HANDLE hPrimary = nullptr;
+		HANDLE hSecondary = nullptr;
+	};
+	const ProbeTarget_t& m_target;
+	std::vector<Zombie_t> m_zombies;
+};
+
+/// <summary>
+/// Creates zombies until creation fails, then narrows in on the sustainable maximum with a binary search.
+/// </summary>
+ProbeResults_t ProbeZombieLimit(const ProbeTarget_t& target)
+{
+	// Stop when the bracket is within 0.5% of the upper bound, or after this many attempts.
+	const int nMaxAttempts = 20;
+
+	ProbeResults_t results;
+	ProbePopulation population(target);
+	std::map<DWORD, int> failuresByError;
+	const size_t nUnbounded = size_t(0x7FFFFFFF);
+	size_t nGood = 0;
+	size_t nBad = (target.nMaxPopulation > 0) ? size_t(target.nMaxPopulation) + 1 : nUnbounded;
+	size_t nGoal = nBad - 1;
+
+	for (int iAttempt = 1; iAttempt <= nMaxAttempts; ++iAttempt)
+	{
+		std::wcout << L"Attempt " << iAttempt << L": ";
+		if (nUnbounded == nGoal + 1)
+			std::wcout << L"growing until creation fails" << std::endl;
+		else
+			std::wcout << L"population " << population.Size() << L" -> " << nGoal << std::endl;
+
+		const KernelMemorySnapshot_t memBefore = TakeKernelMemorySnapshot();
+		population.ShrinkTo(nGoal);
+		DWORD dwErr = population.GrowTo(nGoal);
+		const size_t nReached = population.Size();
+		if (0 == dwErr)
+		{
+			std::wcout << L"  Reached " << nReached << L"                    " << std::endl;
+			nGood = nReached;
+		}
+		else
+		{
+			++failuresByError[dwErr];
+			std::wcout << L"  Failed at " << nReached << L" [" << ClassifyCreationError(dwErr) << L"]: " << SysErrorMessageWithCode(dwErr) << std::endl;
+			if (0 == results.nFirstFailure)
+			{
+				results.nFirstFailure = int(nReached);
+				results.dwFirstError = dwErr;
+			}
+			// nReached was reached; the creation that failed was the next one.
+			nBad = nReached + 1;
+			// A population that was reached before now fails: the limit has moved down, so widen the bracket again.
+			if (nGood >= nBad)
+				nGood = nBad / 2;
+			else
+				nGood = (std::max)(nGood, nReached);
+			WriteKernelMemoryDelta(std::wcout, L"  Kernel memory at the failure", memBefore, TakeKernelMemorySnapshot(), 0);
+		}
+
+		if (nBad - nGood <= 1 || nBad - nGood <= nBad / 200)
+			break;
+
+		// Back off to a quarter of the way up the bracket, below the next goal, let the system reclaim what was released,
+		// then try to reach the bracket's midpoint.
+		const size_t nMid = nGood + (nBad - nGood) / 2;
+		population.ShrinkTo(nGood + (nMid - nGood) / 2);
+		Sleep(target.dwBackoffMs);
+		nGoal = nMid;
+	}
+
+	results.nSustainable = int(nGood);
+	std::wcout << std::endl << L"Failures by error:" << std::endl;
+	for (const auto& failure : failuresByError)
+	{
+		std::wcout << L"  " << failure.second << L" x [" << ClassifyCreationError(failure.first) << L"] " << SysErrorMessageWithCode(failure.first) << std::endl;
+	}
+	std::wcout
+		<< L"First failure at:    " << results.nFirstFailure << std::endl
+		<< L"Sustainable maximum: " << results.nSustainable << std::endl
+		<< std::endl;
+	return results;
+}
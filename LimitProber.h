@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Windows.h>
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Kernel object limit prober: finds the largest zombie population the system sustains
+
+/// <summary>
+/// What to create while probing: zombie processes per pSettings, or zombie threads in this process running pfnThread.
+/// </summary>
+struct ProbeTarget_t
+{
+	// Process creation settings; used when pfnThread is nullptr
+	const SpawnSettings_t* pSettings = nullptr;
+	// Thread procedure for zombie threads, or nullptr to probe processes
+	LPTHREAD_START_ROUTINE pfnThread = nullptr;
+	// Stack reservation for zombie threads in bytes, or 0 for the default
+	SIZE_T cbStackReserve = 0;
+	// Upper bound on the population; 0 for no bound
+	int nMaxPopulation = 0;
+	// Milliseconds to wait after releasing zombies, so the system can reclaim their resources before the next attempt
+	DWORD dwBackoffMs = 2000;
+	// Receives creation, failure, and leaked-handle counts for the live statistics page, or nullptr. Process creations
+	// are counted through pSettings->pLiveStats, which should be the same.
+	LiveStats* pLiveStats = nullptr;
+};
+
+/// <summary>
+/// Result of a limit probe.
+/// </summary>
+struct ProbeResults_t
+{
+	// Largest population that was reached without a creation failure after backing off
+	int nSustainable = 0;
+	// Population at which creation first failed, or 0 if it never failed
+	int nFirstFailure = 0;
+	DWORD dwFirstError = 0;
+};
+
+/// <summary>
+/// Returns a short category name for a creation error code: quota, commit, kernel pool, thread limit, or other.
+/// </summary>
+const wchar_t* ClassifyCreationError(DWORD dwErrCode);
+
+/// <summary>
+/// Creates zombies until creation fails, then narrows in on the sustainable maximum with a binary search: releases zombies
+/// down to the midpoint between the largest population known to be good and the smallest known to fail, backs off,
+/// and grows toward the upper bound again. Every failure is classified and tallied. All zombies are released before returning.
+/// </summary>
+ProbeResults_t ProbeZombieLimit(const ProbeTarget_t& target);
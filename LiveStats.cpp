@@ -0,0 +1,242 @@
+// Live statistics page: counters published in a named shared-memory page for external monitors
+
+#include <Windows.h>
+#include <conio.h>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include "LiveStats.h"
+#include "StringUtils.h"
+#include "SysErrorMessage.h"
+#include "Utilities.h"
+
+static const char LiveStatsMagic[8] = { 'Z', 'M', 'S', 'T', 'A', 'T', 'S', '1' };
+
+/// <summary>
+/// Returns the default name of the statistics page of the ZombieMaker instance with process ID dwPid.
+/// </summary>
+std::wstring LiveStatsPageName(DWORD dwPid)
+{
+	std::wstringstream strName;
+	strName << L"Local\\ZombieMaker-" << dwPid << L"-Stats";
+	return strName.str();
+}
+
+LiveStats::~LiveStats()
+{
+	Stop();
+	if (nullptr != m_pPage)
+		UnmapViewOfFile(m_pPage);
+	if (nullptr != m_hMapping)
+		CloseHandle(m_hMapping);
+	if (nullptr != m_hStopEvent)
+		CloseHandle(m_hStopEvent);
+}
+
+/// <summary>
+/// Creates the named page and starts the publisher thread.
+/// </summary>
+bool LiveStats::Start(const std::wstring& sPageName, int nTarget)
+{
+	m_hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(LiveStatsPage_t), sPageName.c_str());
+	if (nullptr == m_hMapping)
+		return false;
+	m_pPage = static_cast<LiveStatsPage_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(LiveStatsPage_t)));
+	if (nullptr == m_pPage)
+		return false;
+	m_hStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	if (nullptr == m_hStopEvent)
+		return false;
+	m_nTarget = LONG(nTarget);
+	// The page is new and zeroed, so no monitor can see a partial header: the magic is written last.
+	m_pPage->dwVersion = 1;
+	m_pPage->cbPage = sizeof(LiveStatsPage_t);
+	m_pPage->dwPid = GetCurrentProcessId();
+	Publish(0);
+	MemoryBarrier();
+	memcpy(m_pPage->szMagic, LiveStatsMagic, sizeof(m_pPage->szMagic));
+	m_thread = std::thread(&LiveStats::PublisherThread, this);
+	return true;
+}
+
+/// <summary>
+/// Sets the phase to Done, publishes the final counters, and stops the publisher thread.
+/// </summary>
+void LiveStats::Stop()
+{
+	if (!m_thread.joinable())
+		return;
+	m_phase = LiveStatsPhase_t::Done;
+	SetEvent(m_hStopEvent);
+	m_thread.join();
+}
+
+/// <summary>
+/// Counts one failed process or thread creation.
+/// </summary>
+void LiveStats::OnFailed(DWORD dwError)
+{
+	++m_nFailures;
+	std::lock_guard<std::mutex> lock(m_mtxErrors);
+	++m_failuresByError[dwError];
+}
+
+/// <summary>
+/// Publishes the counters ten times per second until stopped, computing the spawn rate over each interval.
+/// </summary>
+void LiveStats::PublisherThread()
+{
+	const DWORD dwIntervalMs = 100;
+	LONGLONG llLast = PerfCounterNow();
+	LONGLONG nLastSpawned = m_nSpawned;
+	bool bStop = false;
+	while (!bStop)
+	{
+		bStop = (WAIT_OBJECT_0 == WaitForSingleObject(m_hStopEvent, dwIntervalMs));
+		const LONGLONG llNow = PerfCounterNow();
+		const LONGLONG nSpawned = m_nSpawned;
+		const double dSeconds = PerfCounterToSeconds(llNow - llLast);
+		Publish(dSeconds > 0 ? double(nSpawned - nLastSpawned) / dSeconds : 0);
+		llLast = llNow;
+		nLastSpawned = nSpawned;
+	}
+}
+
+/// <summary>
+/// Writes the current counters into the page under the seqlock. Called only from one thread at a time.
+/// </summary>
+void LiveStats::Publish(double dSpawnsPerSec)
+{
+	// Gather the error tally outside the seqlock, most frequent first.
+	std::vector<std::pair<DWORD, LONG>> errors;
+	{
+		std::lock_guard<std::mutex> lock(m_mtxErrors);
+		errors.assign(m_failuresByError.begin(), m_failuresByError.end());
+	}
+	std::sort(errors.begin(), errors.end(),
+		[](const std::pair<DWORD, LONG>& a, const std::pair<DWORD, LONG>& b) { return a.second > b.second; });
+	const size_t nMaxErrors = sizeof(m_pPage->errors) / sizeof(m_pPage->errors[0]);
+	const size_t nErrors = (std::min)(errors.size(), nMaxErrors);
+	FILETIME ftNow;
+	GetSystemTimeAsFileTime(&ftNow);
+	ULARGE_INTEGER uliNow;
+	uliNow.LowPart = ftNow.dwLowDateTime;
+	uliNow.HighPart = ftNow.dwHighDateTime;
+
+	// Odd sequence: update in progress. The interlocked increments are full barriers, so readers that see the same even
+	// sequence before and after their copy know that no field changed in between.
+	InterlockedIncrement(&m_pPage->lSequence);
+	m_pPage->phase = m_phase;
+	m_pPage->nTarget = m_nTarget;
+	m_pPage->nSpawned = m_nSpawned;
+	m_pPage->nFailures = m_nFailures;
+	m_pPage->nLeakedHandles = m_nLeakedHandles;
+	m_pPage->dSpawnsPerSec = dSpawnsPerSec;
+	m_pPage->llUpdated = LONGLONG(uliNow.QuadPart);
+	m_pPage->nErrorCodes = DWORD(nErrors);
+	for (size_t ix = 0; ix < nErrors; ++ix)
+	{
+		m_pPage->errors[ix].dwError = errors[ix].first;
+		m_pPage->errors[ix].nCount = errors[ix].second;
+	}
+	InterlockedIncrement(&m_pPage->lSequence);
+}
+
+/// <summary>
+/// Takes a consistent copy of a statistics page using the seqlock protocol.
+/// </summary>
+bool ReadLiveStatsPage(const LiveStatsPage_t* pPage, LiveStatsPage_t& copy)
+{
+	const int nMaxTries = 1000;
+	for (int iTry = 0; iTry < nMaxTries; ++iTry)
+	{
+		const LONG lBefore = pPage->lSequence;
+		if (0 != (lBefore & 1))
+		{
+			YieldProcessor();
+			continue;
+		}
+		MemoryBarrier();
+		memcpy(&copy, pPage, sizeof(copy));
+		MemoryBarrier();
+		if (pPage->lSequence == lBefore)
+			return true;
+	}
+	return false;
+}
+
+/// <summary>
+/// Returns the name of a phase for display.
+/// </summary>
+static const wchar_t* LiveStatsPhaseName(LiveStatsPhase_t phase)
+{
+	switch (phase)
+	{
+	case LiveStatsPhase_t::Starting: return L"starting";
+	case LiveStatsPhase_t::Spawning: return L"spawning";
+	case LiveStatsPhase_t::Holding: return L"holding";
+	case LiveStatsPhase_t::Releasing: return L"releasing";
+	case LiveStatsPhase_t::Soaking: return L"soaking";
+	case LiveStatsPhase_t::Probing: return L"probing";
+	case LiveStatsPhase_t::Done: return L"done";
+	default: return L"unknown";
+	}
+}
+
+/// <summary>
+/// Maps the named statistics page of another ZombieMaker instance and writes its contents once per second.
+/// </summary>
+int WatchLiveStats(const std::wstring& sPageName)
+{
+	HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ, FALSE, sPageName.c_str());
+	if (nullptr == hMapping)
+	{
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot open " << sPageName << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		return -2;
+	}
+	const LiveStatsPage_t* pPage = static_cast<const LiveStatsPage_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, sizeof(LiveStatsPage_t)));
+	if (nullptr == pPage || 0 != memcmp(pPage->szMagic, LiveStatsMagic, sizeof(LiveStatsMagic)) || sizeof(LiveStatsPage_t) != pPage->cbPage)
+	{
+		std::wcerr << sPageName << L" is not a ZombieMaker statistics page." << std::endl;
+		if (nullptr != pPage)
+			UnmapViewOfFile(pPage);
+		CloseHandle(hMapping);
+		return -2;
+	}
+
+	std::wcout << L"Watching " << sPageName << L"; press any key to stop." << std::endl;
+	LONGLONG llLastUpdated = 0;
+	for (;;)
+	{
+		LiveStatsPage_t copy;
+		if (ReadLiveStatsPage(pPage, copy))
+		{
+			LARGE_INTEGER liUpdated;
+			liUpdated.QuadPart = copy.llUpdated;
+			std::wcout
+				<< LargeIntegerToDateTimeString(liUpdated, true) << L"  PID " << copy.dwPid << L"  " << LiveStatsPhaseName(copy.phase)
+				<< L"  target " << copy.nTarget << L"  spawned " << copy.nSpawned << L"  failures " << copy.nFailures
+				<< L"  leaked handles " << copy.nLeakedHandles << L"  " << copy.dSpawnsPerSec << L"/sec" << std::endl;
+			for (DWORD ix = 0; ix < copy.nErrorCodes && ix < sizeof(copy.errors) / sizeof(copy.errors[0]); ++ix)
+			{
+				std::wcout << L"    " << copy.errors[ix].nCount << L" x " << SysErrorMessageWithCode(copy.errors[ix].dwError) << std::endl;
+			}
+			// The owner publishes every 100 ms until it's done.
+			if (LiveStatsPhase_t::Done == copy.phase || (0 != llLastUpdated && copy.llUpdated == llLastUpdated))
+				break;
+			llLastUpdated = copy.llUpdated;
+		}
+		if (_kbhit())
+		{
+// Suppress warning about ignored return value from _getch()
+#pragma warning(suppress: 6031)
+			_getch();
+			break;
+		}
+		Sleep(1000);
+	}
+	UnmapViewOfFile(pPage);
+	CloseHandle(hMapping);
+	return 0;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// ------------------------------------------------------------------------------------------
+// Live statistics page: counters published in a named shared-memory page for external monitors
+
+/// <summary>
+/// What ZombieMaker is doing, as published in the statistics page.
+/// </summary>
+enum class LiveStatsPhase_t : LONG
+{
+	Starting = 0,
+	Spawning,
+	// Zombies created; waiting for a key press to release them
+	Holding,
+	Releasing,
+	Soaking,
+	Probing,
+	Done
+};
+
+/// <summary>
+/// Layout of the statistics page. A monitor maps the page read-only and reads it with the seqlock protocol (see
+/// ReadLiveStatsPage): lSequence is odd while ZombieMaker is writing, and changes with every update.
+/// </summary>
+struct LiveStatsPage_t
+{
+	char szMagic[8];
+	DWORD dwVersion;
+	DWORD cbPage;
+	volatile LONG lSequence;
+	DWORD dwPid;
+	LiveStatsPhase_t phase;
+	LONG nTarget;
+	LONGLONG nSpawned;
+	LONGLONG nFailures;
+	LONGLONG nLeakedHandles;
+	// Spawns per second over the last publishing interval
+	double dSpawnsPerSec;
+	// UTC time of the last update, as a FILETIME value
+	LONGLONG llUpdated;
+	// Failure counts by Win32 error code: the most frequent errors first
+	DWORD nErrorCodes;
+	struct { DWORD dwError; LONG nCount; } errors[16];
+};
+
+/// <summary>
+/// Returns the default name of the statistics page of the ZombieMaker instance with process ID dwPid.
+/// </summary>
+std::wstring LiveStatsPageName(DWORD dwPid);
+
+/// <summary>
+/// Takes a consistent copy of a statistics page using the seqlock protocol: read the sequence, copy the page, and read the
+/// sequence again; retry if it was odd (an update was in progress) or has changed. Makes no system calls.
+/// </summary>
+/// <returns>true if a consistent copy was taken; false if the page kept changing</returns>
+bool ReadLiveStatsPage(const LiveStatsPage_t* pPage, LiveStatsPage_t& copy);
+
+/// <summary>
+/// Maps the named statistics page of another ZombieMaker instance and writes its contents once per second until a key is
+/// pressed or the page stops changing because its owner exited.
+/// </summary>
+/// <returns>Process exit code</returns>
+int WatchLiveStats(const std::wstring& sPageName);
+
+/// <summary>
+/// Counters that spawners update and a publisher thread copies into the named statistics page ten times per second.
+/// Spawners only touch atomics (or a lock for failures, which are rare); the publisher is the page's only writer.
+/// </summary>
+class LiveStats
+{
+public:
+	LiveStats() = default;
+	~LiveStats();
+
+	/// <summary>
+	/// Creates the named page and starts the publisher thread.
+	/// </summary>
+	/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+	bool Start(const std::wstring& sPageName, int nTarget);
+
+	/// <summary>
+	/// Sets the phase to Done, publishes the final counters, and stops the publisher thread. The page stays mapped until this
+	/// object is destroyed.
+	/// </summary>
+	void Stop();
+
+	void SetPhase(LiveStatsPhase_t phase) { m_phase = phase; }
+
+	/// <summary>
+	/// Counts one successful process or thread creation.
+	/// </summary>
+	void OnSpawned() { ++m_nSpawned; }
+
+	/// <summary>
+	/// Counts one failed process or thread creation.
+	/// </summary>
+	void OnFailed(DWORD dwError);
+
+	/// <summary>
+	/// Counts handles that are being kept (leaked) rather than closed.
+	/// </summary>
+	void OnHandlesKept(size_t nHandles) { m_nLeakedHandles += LONGLONG(nHandles); }
+
+	/// <summary>
+	/// Counts leaked handles that have been closed.
+	/// </summary>
+	void OnHandlesReleased(size_t nHandles) { m_nLeakedHandles -= LONGLONG(nHandles); }
+
+private:
+	void PublisherThread();
+	void Publish(double dSpawnsPerSec);
+
+	HANDLE m_hMapping = nullptr;
+	LiveStatsPage_t* m_pPage = nullptr;
+	LONG m_nTarget = 0;
+	std::atomic<LiveStatsPhase_t> m_phase{ LiveStatsPhase_t::Starting };
+	std::atomic<LONGLONG> m_nSpawned{ 0 };
+	std::atomic<LONGLONG> m_nFailures{ 0 };
+	std::atomic<LONGLONG> m_nLeakedHandles{ 0 };
+	std::mutex m_mtxErrors;
+	std::map<DWORD, LONG> m_failuresByError;
+	std::thread m_thread;
+	HANDLE m_hStopEvent = nullptr;
+
+	LiveStats(const LiveStats&) = delete;
+	LiveStats& operator=(const LiveStats&) = delete;
+};
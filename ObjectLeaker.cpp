@@ -0,0 +1,268 @@
+// Leaked kernel objects other than processes and threads, one type at a time, for a per-type cost table
+
+#include <Windows.h>
+#include <atomic>
+#include <iomanip>
+#include <string>
+#include "ObjectLeaker.h"
+#include "LiveStats.h"
+#include "StringUtils.h"
+#include "SysErrorMessage.h"
+#include "Utilities.h"
+#include "WorkerThreads.h"
+
+/// <summary>
+/// Creates one object of a type. sFilePath is the temporary file for File objects.
+/// </summary>
+/// <returns>Handle, or nullptr with GetLastError() set</returns>
+typedef HANDLE (*LeakObjectCreator_t)(const std::wstring& sFilePath);
+
+static HANDLE CreateLeakEvent(const std::wstring&)
+{
+	return CreateEventW(nullptr, TRUE, FALSE, nullptr);
+}
+
+static HANDLE CreateLeakMutex(const std::wstring&)
+{
+	return CreateMutexW(nullptr, FALSE, nullptr);
+}
+
+static HANDLE CreateLeakSemaphore(const std::wstring&)
+{
+	return CreateSemaphoreW(nullptr, 0, 1, nullptr);
+}
+
+static HANDLE CreateLeakSection(const std::wstring&)
+{
+	// One page, so that the cost is mostly the section object and its control structures.
+	return CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, 4096, nullptr);
+}
+
+static HANDLE CreateLeakTimer(const std::wstring&)
+{
+	return CreateWaitableTimerW(nullptr, TRUE, nullptr);
+}
+
+static HANDLE CreateLeakFile(const std::wstring& sFilePath)
+{
+	// Every open creates a new file object; the file itself was created with FILE_FLAG_DELETE_ON_CLOSE.
+	HANDLE hFile = CreateFileW(sFilePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	return (INVALID_HANDLE_VALUE == hFile) ? nullptr : hFile;
+}
+
+/// <summary>
+/// Name and creator of each object type, in LeakObjectType_t order.
+/// </summary>
+static const struct
+{
+	LeakObjectType_t type;
+	const wchar_t* szName;
+	LeakObjectCreator_t pfnCreate;
+} LeakObjectKinds[] =
+{
+	{ LeakObjectType_t::Event, L"event", CreateLeakEvent },
+	{ LeakObjectType_t::Mutex, L"mutex", CreateLeakMutex },
+	{ LeakObjectType_t::Semaphore, L"semaphore", CreateLeakSemaphore },
+	{ LeakObjectType_t::Section, L"section", CreateLeakSection },
+	{ LeakObjectType_t::Timer, L"timer", CreateLeakTimer },
+	{ LeakObjectType_t::File, L"file", CreateLeakFile },
+};
+
+/// <summary>
+/// Returns the command-line name of an object type.
+/// </summary>
+const wchar_t* LeakObjectTypeName(LeakObjectType_t type)
+{
+	for (const auto& kind : LeakObjectKinds)
+	{
+		if (type == kind.type)
+			return kind.szName;
+	}
+	return L"unknown";
+}
+
+/// <summary>
+/// Converts a comma-separated list of object type names, or "all", to the types.
+/// </summary>
+bool ParseLeakObjectTypes(const wchar_t* szList, std::vector<LeakObjectType_t>& types)
+{
+	types.clear();
+	if (0 == wcscmp(szList, L"all"))
+	{
+		types.assign(std::begin(AllLeakObjectTypes), std::end(AllLeakObjectTypes));
+		return true;
+	}
+	std::vector<std::wstring> names;
+	SplitStringToVector(szList, L',', names);
+	for (const std::wstring& sName : names)
+	{
+		bool bFound = false;
+		for (const auto& kind : LeakObjectKinds)
+		{
+			if (sName == kind.szName)
+			{
+				for (LeakObjectType_t type : types)
+				{
+					if (type == kind.type)
+						return false;
+				}
+				types.push_back(kind.type);
+				bFound = true;
+				break;
+			}
+		}
+		if (!bFound)
+			return false;
+	}
+	return !types.empty();
+}
+
+/// <summary>
+/// State shared by the creator threads for one object type.
+/// </summary>
+struct ObjectLeakRun_t
+{
+	LeakObjectCreator_t pfnCreate = nullptr;
+	std::wstring sFilePath;
+	size_t nObjects = 0;
+	LiveStats* pLiveStats = nullptr;
+	// Set by the first creation to fail
+	std::atomic<DWORD> dwFirstError{ 0 };
+};
+
+/// <summary>
+/// Body of each creator thread: claims batches of object indexes and creates one object for each, until all are
+/// claimed or a creation fails in any thread.
+/// </summary>
+static void CreatorThread(ObjectLeakRun_t& run, SharedWorkBudget& budget, std::vector<HANDLE>& handles)
+{
+	ProcessClaimedItems(budget, [&](size_t)
+	{
+		HANDLE hObject = run.pfnCreate(run.sFilePath);
+		if (nullptr == hObject)
+		{
+			const DWORD dwLastErr = GetLastError();
+			DWORD dwNoError = 0;
+			run.dwFirstError.compare_exchange_strong(dwNoError, dwLastErr);
+			if (nullptr != run.pLiveStats)
+				run.pLiveStats->OnFailed(dwLastErr);
+			return false;
+		}
+		handles.push_back(hObject);
+		if (nullptr != run.pLiveStats)
+		{
+			run.pLiveStats->OnSpawned();
+			run.pLiveStats->OnHandlesKept(1);
+		}
+		return true;
+	});
+}
+
+/// <summary>
+/// For each type in turn, creates settings.nPerType objects from nThreads creator threads.
+/// </summary>
+std::vector<ObjectLeakResults_t> LeakObjects(const ObjectLeakSettings_t& settings, unsigned int nThreads, std::vector<HANDLE>& leakedHandles)
+{
+	std::vector<ObjectLeakResults_t> results;
+	for (LeakObjectType_t type : settings.types)
+	{
+		ObjectLeakResults_t typeResults;
+		typeResults.type = type;
+		ObjectLeakRun_t run;
+		run.nObjects = size_t(settings.nPerType);
+		run.pLiveStats = settings.pLiveStats;
+		for (const auto& kind : LeakObjectKinds)
+		{
+			if (type == kind.type)
+				run.pfnCreate = kind.pfnCreate;
+		}
+
+		// The file objects all refer to one temporary file, which this handle creates and marks for deletion once the
+		// last of them is closed.
+		HANDLE hFileTemplate = INVALID_HANDLE_VALUE;
+		if (LeakObjectType_t::File == type)
+		{
+			wchar_t szTempDir[MAX_PATH + 1] = { 0 };
+			GetTempPathW(MAX_PATH + 1, szTempDir);
+			run.sFilePath = std::wstring(szTempDir) + L"ZombieMaker-" + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+			hFileTemplate = CreateFileW(run.sFilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+			if (INVALID_HANDLE_VALUE == hFileTemplate)
+			{
+				typeResults.dwLastError = GetLastError();
+				results.push_back(typeResults);
+				continue;
+			}
+		}
+
+		std::vector<std::vector<HANDLE>> perThreadHandles(nThreads);
+		for (std::vector<HANDLE>& handles : perThreadHandles)
+		{
+			handles.reserve(run.nObjects / nThreads + 1);
+		}
+		typeResults.memBefore = TakeKernelMemorySnapshot();
+		// Objects claimed at a time, so that the threads rarely touch the shared index
+		SharedWorkBudget budget(run.nObjects, 256);
+		const LONGLONG llStart = PerfCounterNow();
+		RunWorkerThreads(nThreads, [&](unsigned int ixThread)
+		{
+			CreatorThread(run, budget, perThreadHandles[ixThread]);
+		});
+		typeResults.llElapsed = PerfCounterNow() - llStart;
+		typeResults.memAfter = TakeKernelMemorySnapshot();
+		typeResults.dwLastError = run.dwFirstError;
+		if (INVALID_HANDLE_VALUE != hFileTemplate)
+			CloseHandle(hFileTemplate);
+
+		for (const std::vector<HANDLE>& handles : perThreadHandles)
+		{
+			typeResults.nCreated += handles.size();
+			leakedHandles.insert(leakedHandles.end(), handles.begin(), handles.end());
+		}
+		std::wcout << L"Leaked " << typeResults.nCreated << L" " << LeakObjectTypeName(type) << L" objects" << std::endl;
+		results.push_back(typeResults);
+	}
+	return results;
+}
+
+/// <summary>
+/// Returns the per-object change in a counter, or 0 if nothing was created.
+/// </summary>
+static double PerObject(ULONGLONG before, ULONGLONG after, size_t nCreated)
+{
+	if (0 == nCreated)
+		return 0;
+	return (double(after) - double(before)) / double(nCreated);
+}
+
+/// <summary>
+/// Writes a table of creation rate and kernel memory cost per object, for each type.
+/// </summary>
+void WriteObjectLeakReport(std::wostream& os, const std::vector<ObjectLeakResults_t>& results)
+{
+	os
+		<< std::endl
+		<< L"Object leak cost (kernel memory in bytes/object, system-wide):" << std::endl
+		<< L"  Type          Created  Objects/sec  Handles/object    Nonpaged       Paged      Commit" << std::endl;
+	for (const ObjectLeakResults_t& typeResults : results)
+	{
+		const double dSeconds = PerfCounterToSeconds(typeResults.llElapsed);
+		FixedFormatGuard format(os, 1);
+		os << L"  " << std::left << std::setw(10) << LeakObjectTypeName(typeResults.type) << std::right
+			<< std::setw(11) << typeResults.nCreated
+			<< std::setw(13) << (dSeconds > 0 ? double(typeResults.nCreated) / dSeconds : 0);
+		if (typeResults.memBefore.bValid && typeResults.memAfter.bValid)
+		{
+			os
+				<< std::setw(16) << PerObject(typeResults.memBefore.nHandles, typeResults.memAfter.nHandles, typeResults.nCreated)
+				<< std::setw(12) << PerObject(typeResults.memBefore.cbNonpagedPool, typeResults.memAfter.cbNonpagedPool, typeResults.nCreated)
+				<< std::setw(12) << PerObject(typeResults.memBefore.cbPagedPool, typeResults.memAfter.cbPagedPool, typeResults.nCreated)
+				<< std::setw(12) << PerObject(typeResults.memBefore.cbCommit, typeResults.memAfter.cbCommit, typeResults.nCreated);
+		}
+		os << std::endl;
+		if (0 != typeResults.dwLastError)
+			os << L"    Stopped by: " << SysErrorMessageWithCode(typeResults.dwLastError) << std::endl;
+	}
+	os << std::endl;
+}
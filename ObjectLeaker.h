@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <vector>
+#include "KernelMemory.h"
+
+class LiveStats;
+
+// ------------------------------------------------------------------------------------------
+// Leaked kernel objects other than processes and threads, one type at a time, for a per-type cost table
+
+/// <summary>
+/// Types of kernel object to leak. To add a type, add it here and to AllLeakObjectTypes, and add its creator to the
+/// table in ObjectLeaker.cpp.
+/// </summary>
+enum class LeakObjectType_t
+{
+	// Unnamed manual-reset event
+	Event,
+	// Unnamed mutex, not owned
+	Mutex,
+	// Unnamed semaphore
+	Semaphore,
+	// Unnamed one-page section backed by the paging file
+	Section,
+	// Unnamed manual-reset waitable timer, not set
+	Timer,
+	// Another file object for one temporary file, which is deleted when the last of them is closed
+	File
+};
+
+/// <summary>
+/// All object types, in the order they're created for -objects:all.
+/// </summary>
+const LeakObjectType_t AllLeakObjectTypes[] = { LeakObjectType_t::Event, LeakObjectType_t::Mutex, LeakObjectType_t::Semaphore,
+	LeakObjectType_t::Section, LeakObjectType_t::Timer, LeakObjectType_t::File };
+
+/// <summary>
+/// Returns the command-line name of an object type: event, mutex, semaphore, section, timer, or file.
+/// </summary>
+const wchar_t* LeakObjectTypeName(LeakObjectType_t type);
+
+/// <summary>
+/// Converts a comma-separated list of object type names, or "all", to the types in the listed order.
+/// </summary>
+/// <returns>true if every name is a type name and none is repeated; false otherwise</returns>
+bool ParseLeakObjectTypes(const wchar_t* szList, std::vector<LeakObjectType_t>& types);
+
+/// <summary>
+/// Settings for an object leak run.
+/// </summary>
+struct ObjectLeakSettings_t
+{
+	// Types to leak, one after the other
+	std::vector<LeakObjectType_t> types;
+	// Number of objects of each type
+	int nPerType = 10;
+	// Receives creation, failure, and leaked-handle counts for the live statistics page, or nullptr
+	LiveStats* pLiveStats = nullptr;
+};
+
+/// <summary>
+/// Creation rate and kernel memory cost of one object type.
+/// </summary>
+struct ObjectLeakResults_t
+{
+	LeakObjectType_t type = LeakObjectType_t::Event;
+	size_t nCreated = 0;
+	// Error code from the first failed creation, or 0 if none failed
+	DWORD dwLastError = 0;
+	// Wall time for creating this type's objects, in performance counter units
+	LONGLONG llElapsed = 0;
+	// System-wide counters before and after creating this type's objects
+	KernelMemorySnapshot_t memBefore, memAfter;
+};
+
+/// <summary>
+/// For each type in turn, creates settings.nPerType objects from nThreads creator threads that claim them in batches,
+/// and appends their handles to leakedHandles. Each type's creators stop after the first failure in any of them.
+/// </summary>
+/// <param name="settings">Input: types and count</param>
+/// <param name="nThreads">Input: number of creator threads (1 or more)</param>
+/// <param name="leakedHandles">Output: the handles of all the objects created are appended to this vector</param>
+/// <returns>Results for each type, in order</returns>
+std::vector<ObjectLeakResults_t> LeakObjects(const ObjectLeakSettings_t& settings, unsigned int nThreads, std::vector<HANDLE>& leakedHandles);
+
+/// <summary>
+/// Writes a table of creation rate and kernel memory cost per object, for each type.
+/// </summary>
+void WriteObjectLeakReport(std::wostream& os, const std::vector<ObjectLeakResults_t>& results);
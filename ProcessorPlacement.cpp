@@ -0,0 +1,228 @@
+// Placement of spawner threads and their children on logical processors and NUMA nodes
+
+#include <Windows.h>
+#include <climits>
+#include <iomanip>
+#include <map>
+#include "ProcessorPlacement.h"
+#include "StringUtils.h"
+#include "Utilities.h"
+
+/// <summary>
+/// Converts a placement's command-line form to the spec.
+/// </summary>
+bool ParsePlacementSpec(const wchar_t* szSpec, PlacementSpec_t& spec)
+{
+	spec = PlacementSpec_t();
+	const wchar_t* szList = nullptr;
+	if (0 == wcscmp(szSpec, L"cpu") || 0 == wcscmp(szSpec, L"node"))
+	{
+		spec.kind = (L'c' == szSpec[0]) ? PlacementKind_t::Processor : PlacementKind_t::Node;
+		return true;
+	}
+	if (StartsWith(szSpec, L"cpu:", true))
+	{
+		spec.kind = PlacementKind_t::Processor;
+		szList = &szSpec[4];
+	}
+	else if (StartsWith(szSpec, L"node:", true))
+	{
+		spec.kind = PlacementKind_t::Node;
+		szList = &szSpec[5];
+	}
+	else
+	{
+		return false;
+	}
+	std::vector<std::wstring> numbers;
+	SplitStringToVector(szList, L',', numbers);
+	for (const std::wstring& sNumber : numbers)
+	{
+		unsigned int nNumber = 0;
+		wchar_t chExtra = 0;
+		if (1 != swscanf_s(sNumber.c_str(), L"%u%c", &nNumber, &chExtra, 1))
+			return false;
+		spec.numbers.push_back(nNumber);
+	}
+	return !spec.numbers.empty();
+}
+
+/// <summary>
+/// Finds the group, bit, and NUMA node of a logical processor numbered across all active processor groups.
+/// </summary>
+/// <returns>true if the processor exists; false otherwise, with GetLastError() set</returns>
+static bool FindProcessorPlacement(unsigned int nProcessor, ProcessorPlacement_t& placement)
+{
+	const WORD nGroups = GetActiveProcessorGroupCount();
+	unsigned int nRemaining = nProcessor;
+	for (WORD group = 0; group < nGroups; ++group)
+	{
+		// Active processors are numbered from 0 within each group.
+		const DWORD nInGroup = GetActiveProcessorCount(group);
+		if (nRemaining >= nInGroup)
+		{
+			nRemaining -= nInGroup;
+			continue;
+		}
+		PROCESSOR_NUMBER processorNumber = { 0 };
+		processorNumber.Group = group;
+		processorNumber.Number = BYTE(nRemaining);
+		USHORT nNode = 0;
+		if (!GetNumaProcessorNodeEx(&processorNumber, &nNode))
+			return false;
+		placement = ProcessorPlacement_t();
+		placement.nNode = nNode;
+		placement.affinity.Group = group;
+		placement.affinity.Mask = KAFFINITY(1) << nRemaining;
+		placement.nProcessor = int(nProcessor);
+		return true;
+	}
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return false;
+}
+
+/// <summary>
+/// Gets the processors of a NUMA node (in its first processor group, for a node that spans groups).
+/// </summary>
+/// <returns>true if the node has processors; false otherwise, with GetLastError() set</returns>
+static bool FindNodePlacement(USHORT nNode, ProcessorPlacement_t& placement)
+{
+	placement = ProcessorPlacement_t();
+	placement.nNode = nNode;
+	if (!GetNumaNodeProcessorMaskEx(nNode, &placement.affinity))
+		return false;
+	if (0 == placement.affinity.Mask)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Resolves a spec against this system's processor groups and NUMA nodes.
+/// </summary>
+bool BuildProcessorPlacements(const PlacementSpec_t& spec, std::vector<ProcessorPlacement_t>& placements)
+{
+	placements.clear();
+	ProcessorPlacement_t placement;
+	if (PlacementKind_t::Processor == spec.kind)
+	{
+		if (spec.numbers.empty())
+		{
+			const DWORD nProcessors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+			for (unsigned int nProcessor = 0; nProcessor < nProcessors; ++nProcessor)
+			{
+				if (!FindProcessorPlacement(nProcessor, placement))
+					return false;
+				placements.push_back(placement);
+			}
+			return true;
+		}
+		for (unsigned int nProcessor : spec.numbers)
+		{
+			if (!FindProcessorPlacement(nProcessor, placement))
+				return false;
+			placements.push_back(placement);
+		}
+		return true;
+	}
+
+	if (spec.numbers.empty())
+	{
+		ULONG nHighestNode = 0;
+		if (!GetNumaHighestNodeNumber(&nHighestNode))
+			return false;
+		for (ULONG nNode = 0; nNode <= nHighestNode; ++nNode)
+		{
+			// Memory-only nodes have no processors to run on.
+			if (FindNodePlacement(USHORT(nNode), placement))
+				placements.push_back(placement);
+		}
+		if (placements.empty())
+		{
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return false;
+		}
+		return true;
+	}
+	for (unsigned int nNode : spec.numbers)
+	{
+		if (nNode > USHRT_MAX)
+		{
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return false;
+		}
+		if (!FindNodePlacement(USHORT(nNode), placement))
+			return false;
+		placements.push_back(placement);
+	}
+	return true;
+}
+
+/// <summary>
+/// Returns a placement's description.
+/// </summary>
+std::wstring PlacementName(const ProcessorPlacement_t& placement)
+{
+	if (placement.nProcessor < 0)
+		return L"node " + std::to_wstring(placement.nNode);
+	return L"cpu " + std::to_wstring(placement.nProcessor) + L" (node " + std::to_wstring(placement.nNode) + L")";
+}
+
+/// <summary>
+/// Spawn counts summed over the spawner threads on one NUMA node.
+/// </summary>
+struct NodeSpawnTotals_t
+{
+	unsigned int nThreads = 0;
+	int nStarted = 0;
+	LONGLONG llSpawnTime = 0;
+};
+
+/// <summary>
+/// Writes one row of the placement report: processes, spawns/sec over the whole run, and mean creation time.
+/// </summary>
+static void WriteSpawnRateColumns(std::wostream& os, int nStarted, LONGLONG llSpawnTime, double dSeconds)
+{
+	FixedFormatGuard format(os, 1);
+	os
+		<< std::setw(11) << nStarted
+		<< std::setw(12) << (dSeconds > 0 ? nStarted / dSeconds : 0)
+		<< std::setprecision(3)
+		<< std::setw(15) << (nStarted > 0 ? PerfCounterToSeconds(llSpawnTime) * 1000 / nStarted : 0)
+		<< std::endl;
+}
+
+/// <summary>
+/// Writes the spawn count, spawns/sec, and mean creation time of each spawner thread and NUMA node.
+/// </summary>
+void WritePlacementReport(std::wostream& os, const SpawnSettings_t& settings, const SpawnerResults_t& results, LONGLONG llElapsed)
+{
+	const bool bBySpawner = nullptr != settings.pSpawnerPlacements && !settings.pSpawnerPlacements->empty();
+	const std::vector<ProcessorPlacement_t>* pPlacements = bBySpawner ? settings.pSpawnerPlacements : settings.pChildPlacements;
+	if (nullptr == pPlacements || pPlacements->empty())
+		return;
+	const double dSeconds = PerfCounterToSeconds(llElapsed);
+	std::map<USHORT, NodeSpawnTotals_t> nodeTotals;
+	os
+		<< (bBySpawner ? L"Spawns by spawner thread placement:" : L"Spawns by child placement:") << std::endl
+		<< L"  Thread  Placement           Processes  Spawns/sec  Mean spawn ms" << std::endl;
+	for (const SpawnerThreadCounts_t& counts : results.threadCounts)
+	{
+		const ProcessorPlacement_t& placement = (*pPlacements)[counts.ixThread % pPlacements->size()];
+		NodeSpawnTotals_t& totals = nodeTotals[placement.nNode];
+		++totals.nThreads;
+		totals.nStarted += counts.nStarted;
+		totals.llSpawnTime += counts.llSpawnTime;
+		os << std::setw(8) << counts.ixThread << L"  " << std::left << std::setw(18) << PlacementName(placement) << std::right;
+		WriteSpawnRateColumns(os, counts.nStarted, counts.llSpawnTime, dSeconds);
+	}
+	os << L"  Node    Threads             Processes  Spawns/sec  Mean spawn ms" << std::endl;
+	for (const auto& node : nodeTotals)
+	{
+		os << std::setw(6) << node.first << std::setw(11) << node.second.nThreads << std::setw(11) << L"";
+		WriteSpawnRateColumns(os, node.second.nStarted, node.second.llSpawnTime, dSeconds);
+	}
+	os << std::endl;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Placement of spawner threads and their children on logical processors and NUMA nodes
+
+/// <summary>
+/// Whether a placement names logical processors or NUMA nodes.
+/// </summary>
+enum class PlacementKind_t
+{
+	Processor,
+	Node
+};
+
+/// <summary>
+/// A placement as given on the command line: cpu or node, and the processor or node numbers to use in turn.
+/// </summary>
+struct PlacementSpec_t
+{
+	PlacementKind_t kind = PlacementKind_t::Node;
+	// Processor numbers (across all processor groups) or node numbers; empty for every one on the system
+	std::vector<unsigned int> numbers;
+};
+
+/// <summary>
+/// Converts a placement's command-line form to the spec: cpu, node, cpu:list, or node:list, where list is
+/// comma-separated numbers.
+/// </summary>
+/// <returns>true if szSpec is valid; false otherwise</returns>
+bool ParsePlacementSpec(const wchar_t* szSpec, PlacementSpec_t& spec);
+
+/// <summary>
+/// Processors that one spawner thread, or the children of one spawner thread, run on.
+/// </summary>
+struct ProcessorPlacement_t
+{
+	// NUMA node of the processors
+	USHORT nNode = 0;
+	// Processor group, and the processors in it
+	GROUP_AFFINITY affinity = { 0 };
+	// Logical processor number across all groups, or -1 for all of the node's processors
+	int nProcessor = -1;
+};
+
+/// <summary>
+/// Resolves a spec against this system's processor groups and NUMA nodes. Nodes without processors are skipped when
+/// the spec lists none.
+/// </summary>
+/// <param name="spec">Input: the parsed spec</param>
+/// <param name="placements">Output: one placement per processor or node, in the spec's order</param>
+/// <returns>true if successful; false otherwise, with GetLastError() set (ERROR_INVALID_PARAMETER for a number that
+/// names no processor, or a node without processors)</returns>
+bool BuildProcessorPlacements(const PlacementSpec_t& spec, std::vector<ProcessorPlacement_t>& placements);
+
+/// <summary>
+/// Returns a placement's description: "cpu 5 (node 0)" or "node 1".
+/// </summary>
+std::wstring PlacementName(const ProcessorPlacement_t& placement);
+
+/// <summary>
+/// Writes the spawn count, spawns/sec, and mean creation time of each spawner thread and NUMA node, by the node of the
+/// spawner threads' placement if settings.pSpawnerPlacements is set, or otherwise of their children's.
+/// </summary>
+/// <param name="settings">Input: settings the run used</param>
+/// <param name="results">Input: results of SpawnZombieProcesses, with per-thread counts</param>
+/// <param name="llElapsed">Input: wall time for the run, in performance counter units</param>
+void WritePlacementReport(std::wostream& os, const SpawnSettings_t& settings, const SpawnerResults_t& results, LONGLONG llElapsed);
@@ -0,0 +1,431 @@
+// Token-bucket pacing of spawns at a target rate, with optional ramp-up or a random or recorded arrival model
+
+#include <Windows.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include "RateScheduler.h"
+#include "LatencyStats.h"
+#include "StringUtils.h"
+#include "Utilities.h"
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+/// <summary>
+/// Per-thread waitable timer, closed when the thread exits.
+/// </summary>
+class ThreadWaitableTimer
+{
+public:
+	ThreadWaitableTimer()
+	{
+		// High-resolution timers need Windows 10 1803 or newer; fall back to a standard timer.
+		m_hTimer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (nullptr == m_hTimer)
+			m_hTimer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+	}
+	~ThreadWaitableTimer()
+	{
+		if (nullptr != m_hTimer)
+			CloseHandle(m_hTimer);
+	}
+	HANDLE Handle() const { return m_hTimer; }
+private:
+	HANDLE m_hTimer;
+	ThreadWaitableTimer(const ThreadWaitableTimer&) = delete;
+	ThreadWaitableTimer& operator=(const ThreadWaitableTimer&) = delete;
+};
+
+/// <summary>
+/// Waits until the performance counter reaches llDue: sleeps on a waitable timer for most of the interval, then spins
+/// for the remainder, because timer expirations are only accurate to around half a millisecond.
+/// </summary>
+static void WaitUntil(LONGLONG llDue)
+{
+	static thread_local ThreadWaitableTimer timer;
+	const LONGLONG llFrequency = PerfCounterFrequency();
+	const LONGLONG llSpinTicks = llFrequency / 1000; // last millisecond
+
+	LONGLONG llRemaining = llDue - PerfCounterNow();
+	if (llRemaining > llSpinTicks && nullptr != timer.Handle())
+	{
+		// Relative due time in 100-nanosecond units is expressed as a negative value.
+		LARGE_INTEGER liDueTime;
+		liDueTime.QuadPart = -LONGLONG(double(llRemaining - llSpinTicks) * 10000000.0 / double(llFrequency));
+		if (SetWaitableTimer(timer.Handle(), &liDueTime, 0, nullptr, nullptr, FALSE))
+			WaitForSingleObject(timer.Handle(), INFINITE);
+	}
+	while (PerfCounterNow() < llDue)
+	{
+		YieldProcessor();
+	}
+}
+
+/// <summary>
+/// Returns the command-line name of an arrival model.
+/// </summary>
+const wchar_t* ArrivalModelName(ArrivalModel_t model)
+{
+	switch (model)
+	{
+	case ArrivalModel_t::Fixed: return L"fixed";
+	case ArrivalModel_t::Poisson: return L"poisson";
+	case ArrivalModel_t::OnOff: return L"onoff";
+	case ArrivalModel_t::Replay: return L"replay";
+	default: return L"unknown";
+	}
+}
+
+/// <summary>
+/// Converts an arrival model's command-line form to the schedule's model.
+/// </summary>
+bool ParseArrivalModel(const wchar_t* szSpec, RateSchedule_t& schedule, std::wstring& sTraceFile)
+{
+	if (StartsWith(szSpec, L"replay:", true))
+	{
+		sTraceFile = &szSpec[7];
+		schedule.arrival = ArrivalModel_t::Replay;
+		return !sTraceFile.empty();
+	}
+	unsigned long long ullSeed = 1;
+	double dOnSeconds = 0, dOffSeconds = 0;
+	wchar_t chExtra = 0;
+	if (0 == wcscmp(szSpec, L"poisson") || 1 == swscanf_s(szSpec, L"poisson:%llu%c", &ullSeed, &chExtra, 1))
+	{
+		schedule.arrival = ArrivalModel_t::Poisson;
+		schedule.ullSeed = ullSeed;
+		return true;
+	}
+	if (StartsWith(szSpec, L"onoff:", true))
+	{
+		const int nFields = swscanf_s(szSpec, L"onoff:%lf:%lf:%llu%c", &dOnSeconds, &dOffSeconds, &ullSeed, &chExtra, 1);
+		if ((2 != nFields && 3 != nFields) || dOnSeconds <= 0 || dOffSeconds <= 0)
+			return false;
+		schedule.arrival = ArrivalModel_t::OnOff;
+		schedule.dOnSeconds = dOnSeconds;
+		schedule.dOffSeconds = dOffSeconds;
+		schedule.ullSeed = ullSeed;
+		return true;
+	}
+	return false;
+}
+
+/// <summary>
+/// Reads a whole file into a narrow string.
+/// </summary>
+/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+static bool ReadWholeFile(const std::wstring& sFilePath, std::string& sContent)
+{
+	// Traces of a few million arrivals are fine; refuse anything that wouldn't fit in one read.
+	const LONGLONG cbMaxFile = 256 * 1024 * 1024;
+	HANDLE hFile = CreateFileW(sFilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (INVALID_HANDLE_VALUE == hFile)
+		return false;
+	LARGE_INTEGER cbFile = { 0 };
+	bool bSuccess = FALSE != GetFileSizeEx(hFile, &cbFile);
+	if (bSuccess && cbFile.QuadPart > cbMaxFile)
+	{
+		SetLastError(ERROR_FILE_TOO_LARGE);
+		bSuccess = false;
+	}
+	if (bSuccess)
+	{
+		sContent.resize(size_t(cbFile.QuadPart));
+		DWORD cbRead = 0;
+		bSuccess = sContent.empty() || (ReadFile(hFile, &sContent[0], DWORD(sContent.size()), &cbRead, nullptr) && cbRead == sContent.size());
+	}
+	DWORD dwLastErr = GetLastError();
+	CloseHandle(hFile);
+	SetLastError(dwLastErr);
+	return bSuccess;
+}
+
+/// <summary>
+/// Reads an arrival trace, and sets the schedule to replay it at the trace's mean rate.
+/// </summary>
+bool LoadArrivalTrace(const std::wstring& sFilePath, RateSchedule_t& schedule, size_t& nErrorLine)
+{
+	nErrorLine = 0;
+	std::string sContent;
+	if (!ReadWholeFile(sFilePath, sContent))
+		return false;
+
+	std::vector<double> offsets;
+	double dFirst = 0, dPrevious = 0;
+	size_t ixLine = 0, nLine = 0;
+	while (ixLine < sContent.size())
+	{
+		size_t ixLineEnd = sContent.find('\n', ixLine);
+		if (std::string::npos == ixLineEnd)
+			ixLineEnd = sContent.size();
+		std::string sLine = sContent.substr(ixLine, ixLineEnd - ixLine);
+		ixLine = ixLineEnd + 1;
+		++nLine;
+		const size_t ixComment = sLine.find('#');
+		if (std::string::npos != ixComment)
+			sLine.erase(ixComment);
+		const size_t ixStart = sLine.find_first_not_of(" \t\r");
+		if (std::string::npos == ixStart)
+			continue;
+		// Exactly one number, then nothing but white space
+		char* pEnd = nullptr;
+		const double dTimestamp = strtod(sLine.c_str() + ixStart, &pEnd);
+		const bool bNumber = pEnd != sLine.c_str() + ixStart && std::isfinite(dTimestamp);
+		if (!bNumber || std::string::npos != sLine.find_first_not_of(" \t\r", size_t(pEnd - sLine.c_str())) ||
+			(!offsets.empty() && dTimestamp < dPrevious))
+		{
+			nErrorLine = nLine;
+			SetLastError(ERROR_INVALID_DATA);
+			return false;
+		}
+		if (offsets.empty())
+			dFirst = dTimestamp;
+		offsets.push_back(dTimestamp - dFirst);
+		dPrevious = dTimestamp;
+	}
+	if (offsets.size() < 2 || offsets.back() <= 0)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return false;
+	}
+	// Repeat the trace one mean gap after its last arrival, so that long runs keep the trace's mean rate.
+	const double dMeanGap = offsets.back() / double(offsets.size() - 1);
+	schedule.arrival = ArrivalModel_t::Replay;
+	schedule.dReplayPeriodSeconds = offsets.back() + dMeanGap;
+	schedule.dSpawnsPerSec = 1.0 / dMeanGap;
+	schedule.replayOffsets = std::move(offsets);
+	return true;
+}
+
+RateScheduler::RateScheduler(const RateSchedule_t& schedule)
+	: m_schedule(schedule), m_random(schedule.ullSeed)
+{
+	if (0 == m_schedule.nSteps)
+		m_schedule.nSteps = 1;
+	if (m_schedule.dRampSeconds <= 0 || ArrivalModel_t::Fixed != m_schedule.arrival)
+		m_schedule.ramp = RampProfile_t::Constant;
+	if (IsPaced())
+	{
+		// Sized once here, so that recording a token is a store to its own slot rather than a reallocation under the lock.
+		const size_t nRecorded = (0 != m_schedule.nExpectedTokens) ? (std::min)(m_schedule.nExpectedTokens, MaxRecordedArrivals) : MaxRecordedArrivals;
+		m_requestedTicks.resize(nRecorded, 0);
+		m_achievedTicks.resize(nRecorded, -1);
+	}
+}
+
+/// <summary>
+/// Sets time zero of the schedule to now. Called automatically by the first WaitForToken if not called explicitly.
+/// </summary>
+void RateScheduler::Start()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_llStart = PerfCounterNow();
+	m_bStarted = true;
+}
+
+/// <summary>
+/// Offset from time zero, in seconds, at which token number k (0-based) is due.
+/// </summary>
+double RateScheduler::ScheduledSeconds(LONGLONG k) const
+{
+	const double dRate = m_schedule.dSpawnsPerSec;
+	const double dRamp = m_schedule.dRampSeconds;
+	const double dTokens = double(k);
+	switch (m_schedule.ramp)
+	{
+	case RampProfile_t::Linear:
+	{
+		// Tokens issued by time t during the ramp: rate * t^2 / (2 * ramp)
+		const double dRampTokens = dRate * dRamp / 2;
+		if (dTokens < dRampTokens)
+			return sqrt(2 * dRamp * dTokens / dRate);
+		return dRamp + (dTokens - dRampTokens) / dRate;
+	}
+	case RampProfile_t::Step:
+	{
+		// Step i (1-based) runs at rate * i / nSteps for ramp / nSteps seconds
+		const double dStepSeconds = dRamp / m_schedule.nSteps;
+		double dElapsed = 0, dIssued = 0;
+		for (unsigned int iStep = 1; iStep <= m_schedule.nSteps; ++iStep)
+		{
+			const double dStepRate = dRate * iStep / m_schedule.nSteps;
+			const double dStepTokens = dStepRate * dStepSeconds;
+			if (dTokens < dIssued + dStepTokens)
+				return dElapsed + (dTokens - dIssued) / dStepRate;
+			dIssued += dStepTokens;
+			dElapsed += dStepSeconds;
+		}
+		return dElapsed + (dTokens - dIssued) / dRate;
+	}
+	case RampProfile_t::Constant:
+	default:
+		return dTokens / dRate;
+	}
+}
+
+/// <summary>
+/// Offset from time zero, in seconds, at which the next token is due.
+/// </summary>
+double RateScheduler::NextArrivalSeconds()
+{
+	switch (m_schedule.arrival)
+	{
+	case ArrivalModel_t::Poisson:
+	case ArrivalModel_t::OnOff:
+	{
+		// Exponential gap by inversion, from the top 53 bits of the generator's output so that it's the same everywhere
+		const double dUniform = double(m_random() >> 11) * (1.0 / 9007199254740992.0);
+		m_dArrivalClock += -log1p(-dUniform) / m_schedule.dSpawnsPerSec;
+		if (ArrivalModel_t::Poisson == m_schedule.arrival)
+			return m_dArrivalClock;
+		// The clock counts on time only: insert an off period after each full on period.
+		const double dOnPeriods = floor(m_dArrivalClock / m_schedule.dOnSeconds);
+		return dOnPeriods * (m_schedule.dOnSeconds + m_schedule.dOffSeconds) + (m_dArrivalClock - dOnPeriods * m_schedule.dOnSeconds);
+	}
+	case ArrivalModel_t::Replay:
+	{
+		const LONGLONG nOffsets = LONGLONG(m_schedule.replayOffsets.size());
+		return m_schedule.replayOffsets[size_t(m_nNextToken % nOffsets)] + double(m_nNextToken / nOffsets) * m_schedule.dReplayPeriodSeconds;
+	}
+	case ArrivalModel_t::Fixed:
+	default:
+		return ScheduledSeconds(m_nNextToken);
+	}
+}
+
+/// <summary>
+/// Waits until the next spawn slot is due. Returns immediately if the schedule isn't paced.
+/// </summary>
+void RateScheduler::WaitForToken()
+{
+	if (!IsPaced())
+		return;
+
+	const LONGLONG llFrequency = PerfCounterFrequency();
+	// Bucket depth: one second of tokens at the target rate
+	const LONGLONG llDepth = llFrequency;
+	LONGLONG llDue, llStart;
+	size_t ixRecord = MaxRecordedArrivals;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		const LONGLONG llNow = PerfCounterNow();
+		if (!m_bStarted)
+		{
+			m_llStart = llNow;
+			m_bStarted = true;
+		}
+		llDue = m_llStart + m_llShift + LONGLONG(NextArrivalSeconds() * double(llFrequency));
+		// If the spawners are more than the bucket depth behind, drop the excess tokens by moving the schedule back.
+		if (llNow - llDue > llDepth)
+		{
+			const LONGLONG llExcess = llNow - llDue - llDepth;
+			m_llShift += llExcess;
+			llDue += llExcess;
+			m_nDropped += LONGLONG(double(llExcess) / double(llFrequency) * m_schedule.dSpawnsPerSec);
+		}
+		// Tokens are recorded by number, so each has its own slot.
+		if (size_t(m_nNextToken) < m_requestedTicks.size())
+		{
+			ixRecord = size_t(m_nNextToken);
+			m_requestedTicks[ixRecord] = llDue - m_llStart;
+		}
+		++m_nNextToken;
+		if (llNow - llDue > m_llMaxLag)
+			m_llMaxLag = llNow - llDue;
+		llStart = m_llStart;
+	}
+	WaitUntil(llDue);
+	// Only this thread writes this slot, and the report reads it after the spawners have finished.
+	if (ixRecord < MaxRecordedArrivals)
+		m_achievedTicks[ixRecord] = PerfCounterNow() - llStart;
+}
+
+/// <summary>
+/// Returns the largest amount by which a spawn slot was handed out after it was due, in seconds.
+/// </summary>
+double RateScheduler::MaxLagSeconds() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return PerfCounterToSeconds(m_llMaxLag);
+}
+
+/// <summary>
+/// Returns the number of tokens dropped because a spawner fell more than the bucket depth behind.
+/// </summary>
+LONGLONG RateScheduler::TokensDropped() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_nDropped;
+}
+
+/// <summary>
+/// Writes one row of the arrival report: mean, coefficient of variation, and percentiles of a set of gaps.
+/// </summary>
+static void WriteGapRow(std::wostream& os, const wchar_t* szLabel, const std::vector<LONGLONG>& gaps)
+{
+	double dSum = 0, dSumSquares = 0;
+	for (LONGLONG llGap : gaps)
+	{
+		dSum += double(llGap);
+		dSumSquares += double(llGap) * double(llGap);
+	}
+	const double dMean = dSum / double(gaps.size());
+	const double dVariance = (std::max)(0.0, dSumSquares / double(gaps.size()) - dMean * dMean);
+	{
+		FixedFormatGuard format(os, 1);
+		os << szLabel
+			<< L"mean " << PerfCounterToSeconds(LONGLONG(dMean)) * 1000000.0 << L" us, "
+			<< L"CV " << std::setprecision(3) << (dMean > 0 ? sqrt(dVariance) / dMean : 0) << L", ";
+	}
+	WriteLatencySummary(os, SummarizeLatencies(gaps));
+	os << std::endl;
+}
+
+/// <summary>
+/// Writes the requested and achieved inter-arrival times, and how late the tokens were handed out.
+/// </summary>
+void RateScheduler::WriteArrivalReport(std::wostream& os) const
+{
+	std::vector<LONGLONG> requested, achieved, lateness;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		for (size_t ixToken = 0; ixToken < m_requestedTicks.size(); ++ixToken)
+		{
+			if (m_achievedTicks[ixToken] < 0)
+				continue;
+			requested.push_back(m_requestedTicks[ixToken]);
+			achieved.push_back(m_achievedTicks[ixToken]);
+			lateness.push_back(m_achievedTicks[ixToken] - m_requestedTicks[ixToken]);
+		}
+	}
+	if (requested.size() < 2)
+		return;
+	// Spawner threads can hand out neighboring tokens slightly out of order, so gaps are taken between arrivals in time order.
+	std::sort(requested.begin(), requested.end());
+	std::sort(achieved.begin(), achieved.end());
+	std::vector<LONGLONG> requestedGaps, achievedGaps;
+	requestedGaps.reserve(requested.size() - 1);
+	achievedGaps.reserve(achieved.size() - 1);
+	for (size_t ixArrival = 1; ixArrival < requested.size(); ++ixArrival)
+	{
+		requestedGaps.push_back(requested[ixArrival] - requested[ixArrival - 1]);
+		achievedGaps.push_back(achieved[ixArrival] - achieved[ixArrival - 1]);
+	}
+
+	os << L"Arrival model:     " << ArrivalModelName(m_schedule.arrival);
+	if (ArrivalModel_t::Poisson == m_schedule.arrival || ArrivalModel_t::OnOff == m_schedule.arrival)
+		os << L", seed " << m_schedule.ullSeed;
+	if (ArrivalModel_t::OnOff == m_schedule.arrival)
+		os << L", " << m_schedule.dOnSeconds << L" s on, " << m_schedule.dOffSeconds << L" s off";
+	if (ArrivalModel_t::Replay == m_schedule.arrival)
+		os << L", " << m_schedule.replayOffsets.size() << L" arrivals every " << m_schedule.dReplayPeriodSeconds << L" s";
+	os << L" (" << requested.size() << L" arrivals measured)" << std::endl;
+	WriteGapRow(os, L"  Requested gaps:  ", requestedGaps);
+	WriteGapRow(os, L"  Achieved gaps:   ", achievedGaps);
+	os << L"  Lateness:        ";
+	WriteLatencySummary(os, SummarizeLatencies(std::move(lateness)));
+	os << std::endl;
+}
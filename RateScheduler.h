@@ -0,0 +1,174 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------
+// Token-bucket pacing of spawns at a target rate, with optional ramp-up or a random or recorded arrival model
+
+/// <summary>
+/// How the spawn rate ramps up to its target.
+/// </summary>
+enum class RampProfile_t
+{
+	// Target rate from the start
+	Constant,
+	// Rate increases linearly from zero to the target over the ramp period
+	Linear,
+	// Rate increases in equal steps to the target over the ramp period
+	Step
+};
+
+/// <summary>
+/// When each spawn is due.
+/// </summary>
+enum class ArrivalModel_t
+{
+	// Evenly spaced at the rate, following the ramp
+	Fixed,
+	// Poisson process at the rate: exponentially distributed gaps
+	Poisson,
+	// Poisson at the rate during on periods, and no spawns during off periods
+	OnOff,
+	// Recorded arrival times, repeated for as long as spawns are needed
+	Replay
+};
+
+/// <summary>
+/// Returns the command-line name of an arrival model: fixed, poisson, onoff, or replay.
+/// </summary>
+const wchar_t* ArrivalModelName(ArrivalModel_t model);
+
+/// <summary>
+/// Parameters for a rate schedule.
+/// </summary>
+struct RateSchedule_t
+{
+	// Target rate (the rate within on periods, for OnOff, and the trace's mean rate, for Replay); 0 means unpaced
+	double dSpawnsPerSec = 0;
+	RampProfile_t ramp = RampProfile_t::Constant;
+	// Length of the ramp, for Linear and Step
+	double dRampSeconds = 0;
+	// Number of steps, for Step
+	unsigned int nSteps = 1;
+	// Arrival model; only Fixed ramps
+	ArrivalModel_t arrival = ArrivalModel_t::Fixed;
+	// Seed for the Poisson and OnOff gaps: the same seed gives the same arrival times
+	unsigned long long ullSeed = 1;
+	// Length of the on and off periods, for OnOff
+	double dOnSeconds = 0;
+	double dOffSeconds = 0;
+	// Arrival times in seconds from the first arrival, in ascending order, for Replay, and the time from the first
+	// arrival until the trace repeats (the trace's span plus its mean gap)
+	std::vector<double> replayOffsets;
+	double dReplayPeriodSeconds = 0;
+	// Number of tokens the run is expected to take, so that the arrival recording is allocated up front rather than grown
+	// while spawners wait on the lock; 0 if unknown (such as an unbounded soak), to record up to MaxRecordedArrivals
+	size_t nExpectedTokens = 0;
+};
+
+/// <summary>
+/// Converts an arrival model's command-line form to the schedule's model: poisson[:seed], onoff:on_sec:off_sec[:seed], or
+/// replay:file. For replay, the file isn't read here: sTraceFile gets its path, for LoadArrivalTrace.
+/// </summary>
+/// <returns>true if szSpec is valid; false otherwise</returns>
+bool ParseArrivalModel(const wchar_t* szSpec, RateSchedule_t& schedule, std::wstring& sTraceFile);
+
+/// <summary>
+/// Reads an arrival trace: one timestamp in seconds per line (any origin, such as Unix time; fractions allowed), in
+/// ascending order, with # starting a comment. Sets the schedule to replay it, at the trace's mean rate.
+/// </summary>
+/// <param name="sFilePath">Input: path to the trace file (ASCII)</param>
+/// <param name="schedule">Output: arrival, replayOffsets, dReplayPeriodSeconds and dSpawnsPerSec are set</param>
+/// <param name="nErrorLine">Output: line number of the first invalid or out-of-order line, or 0 if the file couldn't be read
+/// or has fewer than two distinct timestamps</param>
+/// <returns>true if successful; false otherwise, with GetLastError() set (ERROR_INVALID_DATA for invalid content)</returns>
+bool LoadArrivalTrace(const std::wstring& sFilePath, RateSchedule_t& schedule, size_t& nErrorLine);
+
+/// <summary>
+/// Paces spawns to a rate schedule. Each call to WaitForToken claims the next spawn slot and waits until it is due,
+/// using a high-resolution waitable timer plus a short spin for sub-millisecond accuracy. Slots are scheduled from the
+/// start time rather than from the previous spawn, so slow spawns don't push later spawns back: a spawner that falls
+/// behind gets tokens immediately until it catches up. The bucket holds at most one second of tokens; if a spawner
+/// falls further behind than that, the excess is dropped.
+/// The random arrival models draw each gap from a generator seeded by the schedule, in token order, so the arrival times
+/// don't depend on how many spawner threads share the scheduler. The due and actual times of the first MaxRecordedArrivals
+/// tokens are kept for WriteArrivalReport, in storage allocated once for the schedule's expected token count.
+/// Multiple spawner threads can share one scheduler.
+/// </summary>
+class RateScheduler
+{
+public:
+	explicit RateScheduler(const RateSchedule_t& schedule);
+
+	/// <summary>
+	/// Returns true if the schedule paces spawns at all.
+	/// </summary>
+	bool IsPaced() const { return m_schedule.dSpawnsPerSec > 0; }
+
+	/// <summary>
+	/// Sets time zero of the schedule to now. Called automatically by the first WaitForToken if not called explicitly.
+	/// </summary>
+	void Start();
+
+	/// <summary>
+	/// Waits until the next spawn slot is due. Returns immediately if the schedule isn't paced.
+	/// </summary>
+	void WaitForToken();
+
+	/// <summary>
+	/// Returns the largest amount by which a spawn slot was handed out after it was due, in seconds.
+	/// </summary>
+	double MaxLagSeconds() const;
+
+	/// <summary>
+	/// Returns the number of tokens dropped because a spawner fell more than the bucket depth behind.
+	/// </summary>
+	LONGLONG TokensDropped() const;
+
+	/// <summary>
+	/// Number of tokens whose due and actual times are kept (16 bytes each).
+	/// </summary>
+	static const size_t MaxRecordedArrivals = 4 * 1024 * 1024;
+
+	/// <summary>
+	/// Writes the requested and achieved inter-arrival times (mean, coefficient of variation, and percentiles), and how
+	/// late the tokens were handed out.
+	/// </summary>
+	void WriteArrivalReport(std::wostream& os) const;
+
+private:
+	/// <summary>
+	/// Offset from time zero, in seconds, at which token number k (0-based) is due, for the Fixed model.
+	/// </summary>
+	double ScheduledSeconds(LONGLONG k) const;
+
+	/// <summary>
+	/// Offset from time zero, in seconds, at which the next token is due. Advances the random models' state, so it must be
+	/// called once per token, in order, with m_mtx held.
+	/// </summary>
+	double NextArrivalSeconds();
+
+	RateSchedule_t m_schedule;
+	// Protects the following members
+	mutable std::mutex m_mtx;
+	bool m_bStarted = false;
+	LONGLONG m_llStart = 0;
+	LONGLONG m_nNextToken = 0;
+	// Performance counter units by which the schedule has been moved back after dropping tokens
+	LONGLONG m_llShift = 0;
+	LONGLONG m_llMaxLag = 0;
+	LONGLONG m_nDropped = 0;
+	// Random gap generator, and the Poisson process's clock in seconds (counting on time only, for OnOff)
+	std::mt19937_64 m_random;
+	double m_dArrivalClock = 0;
+	// Due and actual times of each recorded token by token number, relative to time zero, in performance counter units;
+	// actual is -1 until the token is handed out. Sized by the constructor; a token's actual time is written without the
+	// lock by the thread it was handed to.
+	std::vector<LONGLONG> m_requestedTicks;
+	std::vector<LONGLONG> m_achievedTicks;
+};
@@ -0,0 +1,431 @@
+// Multi-phase scenarios: a file of spawn, hold, and release phases run back to back on one set of leaked handles
+
+#include <Windows.h>
+#include <algorithm>
+#include <climits>
+#include <conio.h>
+#include <iomanip>
+#include <sstream>
+#include "ScenarioRunner.h"
+#include "LiveStats.h"
+#include "RateScheduler.h"
+#include "StringUtils.h"
+#include "ThreadLeaker.h"
+#include "Utilities.h"
+
+/// <summary>
+/// Returns the scenario-file keyword of a phase kind.
+/// </summary>
+const wchar_t* ScenarioPhaseKindName(ScenarioPhaseKind_t kind)
+{
+	switch (kind)
+	{
+	case ScenarioPhaseKind_t::Processes: return L"processes";
+	case ScenarioPhaseKind_t::Threads: return L"threads";
+	case ScenarioPhaseKind_t::Hold: return L"hold";
+	case ScenarioPhaseKind_t::Release: return L"release";
+	default: return L"unknown";
+	}
+}
+
+/// <summary>
+/// Reads a whole file and converts it from UTF-8, skipping a byte order mark if there is one.
+/// </summary>
+/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+static bool ReadUtf8TextFile(const std::wstring& sFilePath, std::wstring& sContent)
+{
+	HANDLE hFile = CreateFileW(sFilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == hFile)
+		return false;
+	LARGE_INTEGER cbFile = { 0 };
+	std::string sUtf8;
+	bool bSuccess = FALSE != GetFileSizeEx(hFile, &cbFile);
+	// A scenario file is a few lines; refuse anything that wouldn't fit in one read.
+	if (bSuccess && cbFile.QuadPart > 0x1000000)
+	{
+		SetLastError(ERROR_FILE_TOO_LARGE);
+		bSuccess = false;
+	}
+	if (bSuccess)
+	{
+		sUtf8.resize(size_t(cbFile.QuadPart));
+		DWORD cbRead = 0;
+		bSuccess = sUtf8.empty() || (ReadFile(hFile, &sUtf8[0], DWORD(sUtf8.size()), &cbRead, nullptr) && cbRead == sUtf8.size());
+	}
+	DWORD dwLastErr = GetLastError();
+	CloseHandle(hFile);
+	SetLastError(dwLastErr);
+	if (!bSuccess)
+		return false;
+
+	size_t ixStart = 0;
+	if (sUtf8.size() >= 3 && 0 == sUtf8.compare(0, 3, "\xEF\xBB\xBF"))
+		ixStart = 3;
+	sContent.clear();
+	if (sUtf8.size() > ixStart)
+	{
+		const int cbUtf8 = int(sUtf8.size() - ixStart);
+		const int cchWide = MultiByteToWideChar(CP_UTF8, 0, sUtf8.data() + ixStart, cbUtf8, nullptr, 0);
+		if (cchWide <= 0)
+			return false;
+		sContent.resize(size_t(cchWide));
+		MultiByteToWideChar(CP_UTF8, 0, sUtf8.data() + ixStart, cbUtf8, &sContent[0], cchWide);
+	}
+	return true;
+}
+
+/// <summary>
+/// Converts a whole token to a non-negative number.
+/// </summary>
+static bool ParseNonNegative(const std::wstring& sToken, double& dValue)
+{
+	wchar_t* pEnd = nullptr;
+	dValue = wcstod(sToken.c_str(), &pEnd);
+	return !sToken.empty() && L'\0' == *pEnd && dValue >= 0;
+}
+
+/// <summary>
+/// Converts a whole token to a count of at least 1.
+/// </summary>
+static bool ParseCount(const std::wstring& sToken, unsigned long& nValue)
+{
+	wchar_t* pEnd = nullptr;
+	nValue = wcstoul(sToken.c_str(), &pEnd, 10);
+	return !sToken.empty() && L'\0' == *pEnd && 0 != nValue && nValue <= LONG_MAX;
+}
+
+/// <summary>
+/// Parses the rest of a processes or threads line: the count, then any of rate:, ramp:, and P: options.
+/// </summary>
+static bool ParseSpawnPhase(const std::vector<std::wstring>& tokens, ScenarioPhase_t& phase)
+{
+	unsigned long nValue = 0;
+	if (tokens.size() < 2 || !ParseCount(tokens[1], nValue))
+		return false;
+	phase.nCount = int(nValue);
+	for (size_t ixToken = 2; ixToken < tokens.size(); ++ixToken)
+	{
+		const std::wstring& sToken = tokens[ixToken];
+		if (StartsWith(sToken, L"rate:", true))
+		{
+			if (!ParseNonNegative(sToken.substr(5), phase.rateSchedule.dSpawnsPerSec) || 0 == phase.rateSchedule.dSpawnsPerSec)
+				return false;
+		}
+		else if (StartsWith(sToken, L"ramp:", true))
+		{
+			if (!ParseNonNegative(sToken.substr(5), phase.rateSchedule.dRampSeconds) || 0 == phase.rateSchedule.dRampSeconds)
+				return false;
+			phase.rateSchedule.ramp = RampProfile_t::Linear;
+		}
+		else if (StartsWith(sToken, L"P:", true))
+		{
+			if (!ParseCount(sToken.substr(2), nValue))
+				return false;
+			phase.nSpawnerThreads = unsigned(nValue);
+		}
+		else
+		{
+			return false;
+		}
+	}
+	// A ramp needs a rate to ramp up to.
+	return RampProfile_t::Constant == phase.rateSchedule.ramp || phase.rateSchedule.dSpawnsPerSec > 0;
+}
+
+/// <summary>
+/// Parses the rest of a release line: percent% or all, then an optional release strategy other than job, which would
+/// close the job that later phases assign children to.
+/// </summary>
+static bool ParseReleasePhase(const std::vector<std::wstring>& tokens, ScenarioPhase_t& phase)
+{
+	if (tokens.size() < 2 || tokens.size() > 3)
+		return false;
+	if (L"all" == tokens[1])
+		phase.dReleasePercent = 100;
+	else if (!EndsWith(tokens[1], L'%') ||
+		!ParseNonNegative(tokens[1].substr(0, tokens[1].length() - 1), phase.dReleasePercent) || phase.dReleasePercent > 100)
+		return false;
+	if (3 == tokens.size())
+	{
+		if (!ParseReleaseStrategy(tokens[2].c_str(), phase.release) || ReleaseStrategy_t::JobClose == phase.release.strategy)
+			return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Reads a scenario file into the list of phases to run, expanding repeat blocks.
+/// </summary>
+bool LoadScenarioFile(const std::wstring& sFilePath, std::vector<ScenarioPhase_t>& phases, size_t& nErrorLine)
+{
+	phases.clear();
+	nErrorLine = 0;
+	std::wstring sContent;
+	if (!ReadUtf8TextFile(sFilePath, sContent))
+		return false;
+
+	std::wistringstream content(sContent);
+	std::wstring sLine;
+	// First phase of the block that the next repeat applies to
+	size_t ixBlockStart = 0;
+	size_t nLine = 0;
+	while (std::getline(content, sLine))
+	{
+		++nLine;
+		const size_t ixComment = sLine.find(L'#');
+		if (std::wstring::npos != ixComment)
+			sLine.erase(ixComment);
+		std::wistringstream line(sLine);
+		std::vector<std::wstring> tokens;
+		std::wstring sToken;
+		while (line >> sToken)
+			tokens.push_back(sToken);
+		if (tokens.empty())
+			continue;
+
+		ScenarioPhase_t phase;
+		phase.nLine = nLine;
+		bool bValid = false;
+		if (L"processes" == tokens[0] || L"threads" == tokens[0])
+		{
+			phase.kind = (L"processes" == tokens[0]) ? ScenarioPhaseKind_t::Processes : ScenarioPhaseKind_t::Threads;
+			bValid = ParseSpawnPhase(tokens, phase);
+		}
+		else if (L"hold" == tokens[0])
+		{
+			phase.kind = ScenarioPhaseKind_t::Hold;
+			bValid = 2 == tokens.size() && ParseNonNegative(tokens[1], phase.dHoldSeconds);
+		}
+		else if (L"release" == tokens[0])
+		{
+			phase.kind = ScenarioPhaseKind_t::Release;
+			bValid = ParseReleasePhase(tokens, phase);
+		}
+		else if (L"repeat" == tokens[0])
+		{
+			unsigned long nTimes = 0;
+			bValid = 2 == tokens.size() && ParseCount(tokens[1], nTimes) && ixBlockStart < phases.size();
+			if (bValid)
+			{
+				const std::vector<ScenarioPhase_t> block(phases.begin() + ptrdiff_t(ixBlockStart), phases.end());
+				for (unsigned int nPass = 2; nPass <= nTimes; ++nPass)
+				{
+					for (ScenarioPhase_t blockPhase : block)
+					{
+						blockPhase.nPass = nPass;
+						phases.push_back(blockPhase);
+					}
+				}
+				ixBlockStart = phases.size();
+				continue;
+			}
+		}
+		if (!bValid)
+		{
+			nErrorLine = nLine;
+			SetLastError(ERROR_INVALID_DATA);
+			return false;
+		}
+		phases.push_back(phase);
+	}
+	if (phases.empty())
+	{
+		nErrorLine = nLine;
+		SetLastError(ERROR_INVALID_DATA);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Waits for the phase's hold time, or until a key is pressed.
+/// </summary>
+static void HoldPhase(const ScenarioPhase_t& phase)
+{
+	const LONGLONG llEnd = PerfCounterNow() + LONGLONG(phase.dHoldSeconds * double(PerfCounterFrequency()));
+	while (PerfCounterNow() < llEnd)
+	{
+		if (_kbhit())
+		{
+// Suppress warning about ignored return value from _getch()
+#pragma warning(suppress: 6031)
+			_getch();
+			break;
+		}
+		Sleep(100);
+	}
+}
+
+/// <summary>
+/// Runs the phases in order on one set of held handles.
+/// </summary>
+std::vector<ScenarioPhaseResults_t> RunScenario(const ScenarioSettings_t& settings, const std::vector<ScenarioPhase_t>& phases,
+	std::vector<HANDLE>& heldHandles, std::wostream& os)
+{
+	std::vector<ScenarioPhaseResults_t> results;
+	results.reserve(phases.size());
+	for (const ScenarioPhase_t& phase : phases)
+	{
+		ScenarioPhaseResults_t phaseResults;
+		phaseResults.phase = phase;
+		const unsigned int nSpawnerThreads = (0 != phase.nSpawnerThreads) ? phase.nSpawnerThreads : settings.nSpawnerThreads;
+		switch (phase.kind)
+		{
+		case ScenarioPhaseKind_t::Processes:
+		case ScenarioPhaseKind_t::Threads:
+		{
+			if (nullptr != settings.pLiveStats)
+				settings.pLiveStats->SetPhase(LiveStatsPhase_t::Spawning);
+			SpawnLatencyRecorder latency(phase.nCount);
+			RateSchedule_t rateSchedule = phase.rateSchedule;
+			rateSchedule.nExpectedTokens = size_t(phase.nCount);
+			RateScheduler scheduler(rateSchedule);
+			SpawnerResults_t spawnResults;
+			if (ScenarioPhaseKind_t::Processes == phase.kind)
+			{
+				SpawnSettings_t spawn = settings.spawn;
+				spawn.numProcesses = phase.nCount;
+				spawn.pLatency = &latency;
+				spawn.pScheduler = &scheduler;
+				spawnResults = SpawnZombieProcesses(spawn, nSpawnerThreads, phaseResults.llElapsed);
+			}
+			else
+			{
+				ThreadLeakSettings_t leak;
+				leak.numThreads = phase.nCount;
+				leak.pfnThread = settings.pfnThread;
+				leak.cbStackReserve = settings.cbStackReserve;
+				leak.pLatency = &latency;
+				leak.pScheduler = &scheduler;
+				leak.pLiveStats = settings.pLiveStats;
+				spawnResults = LeakThreads(leak, nSpawnerThreads, phaseResults.llElapsed);
+			}
+			phaseResults.nDone = size_t(spawnResults.nStarted);
+			phaseResults.nFailures = size_t(spawnResults.nFailures);
+			phaseResults.dwLastError = spawnResults.dwLastError;
+			phaseResults.latency = latency.OverallSummary();
+			heldHandles.insert(heldHandles.end(), spawnResults.leakedHandles.begin(), spawnResults.leakedHandles.end());
+			break;
+		}
+		case ScenarioPhaseKind_t::Hold:
+		{
+			if (nullptr != settings.pLiveStats)
+				settings.pLiveStats->SetPhase(LiveStatsPhase_t::Holding);
+			const LONGLONG llStart = PerfCounterNow();
+			HoldPhase(phase);
+			phaseResults.llElapsed = PerfCounterNow() - llStart;
+			break;
+		}
+		case ScenarioPhaseKind_t::Release:
+		{
+			if (nullptr != settings.pLiveStats)
+				settings.pLiveStats->SetPhase(LiveStatsPhase_t::Releasing);
+			// Oldest first, so that a partial release leaves the most recent zombies held.
+			const size_t nToClose = (std::min)(heldHandles.size(), size_t(double(heldHandles.size()) * phase.dReleasePercent / 100.0 + 0.5));
+			std::vector<HANDLE> toClose(heldHandles.begin(), heldHandles.begin() + ptrdiff_t(nToClose));
+			heldHandles.erase(heldHandles.begin(), heldHandles.begin() + ptrdiff_t(nToClose));
+			ReleaseSettings_t release = phase.release;
+			release.pLiveStats = settings.pLiveStats;
+			const ReleaseResults_t releaseResults = ReleaseHandles(release, toClose);
+			phaseResults.nDone = releaseResults.nClosed;
+			phaseResults.nFailures = releaseResults.nFailed;
+			phaseResults.llElapsed = releaseResults.llElapsed;
+			phaseResults.latency = releaseResults.closeLatency;
+			break;
+		}
+		}
+		phaseResults.nHeldHandles = heldHandles.size();
+		phaseResults.memAfter = TakeKernelMemorySnapshot();
+
+		const double dSeconds = PerfCounterToSeconds(phaseResults.llElapsed);
+		os << L"Phase " << results.size() + 1 << L" (line " << phase.nLine << L", pass " << phase.nPass << L"): "
+			<< ScenarioPhaseKindName(phase.kind);
+		if (ScenarioPhaseKind_t::Hold != phase.kind)
+		{
+			os << L" " << phaseResults.nDone << L" in " << dSeconds << L" s ("
+				<< (dSeconds > 0 ? double(phaseResults.nDone) / dSeconds : 0) << L"/s)";
+			if (0 != phaseResults.nFailures)
+				os << L", " << phaseResults.nFailures << L" failed";
+		}
+		else
+		{
+			os << L" " << dSeconds << L" s";
+		}
+		os << L", " << phaseResults.nHeldHandles << L" handles held" << std::endl;
+		if (0 != phaseResults.dwLastError)
+			os << L"  Last error: " << phaseResults.dwLastError << std::endl;
+		results.push_back(phaseResults);
+	}
+	return results;
+}
+
+/// <summary>
+/// Converts the change in a byte counter between two snapshots to megabytes.
+/// </summary>
+static double DeltaMB(ULONGLONG cbBefore, ULONGLONG cbAfter)
+{
+	return (double(cbAfter) - double(cbBefore)) / (1024.0 * 1024.0);
+}
+
+/// <summary>
+/// Writes the per-phase metrics of a scenario run as a table.
+/// </summary>
+void WriteScenarioReport(std::wostream& os, const std::vector<ScenarioPhaseResults_t>& results, const KernelMemorySnapshot_t& memBefore)
+{
+	os
+		<< std::endl
+		<< L"Scenario phases (latency in microseconds; memory change since the start in MB):" << std::endl
+		<< L"    #  Line  Pass  Phase           Done  Failed   Seconds     Per sec       p50       p99      Held    Commit  Nonpaged     Paged" << std::endl;
+	for (size_t ixResult = 0; ixResult < results.size(); ++ixResult)
+	{
+		const ScenarioPhaseResults_t& phaseResults = results[ixResult];
+		const double dSeconds = PerfCounterToSeconds(phaseResults.llElapsed);
+		FixedFormatGuard format(os, 1);
+		os << std::setw(5) << ixResult + 1
+			<< std::setw(6) << phaseResults.phase.nLine
+			<< std::setw(6) << phaseResults.phase.nPass
+			<< L"  " << std::left << std::setw(10) << ScenarioPhaseKindName(phaseResults.phase.kind) << std::right
+			<< std::setw(10) << phaseResults.nDone
+			<< std::setw(8) << phaseResults.nFailures
+			<< std::setw(10) << dSeconds
+			<< std::setw(12) << (dSeconds > 0 && ScenarioPhaseKind_t::Hold != phaseResults.phase.kind ? double(phaseResults.nDone) / dSeconds : 0)
+			<< std::setw(10) << phaseResults.latency.p50Us
+			<< std::setw(10) << phaseResults.latency.p99Us
+			<< std::setw(10) << phaseResults.nHeldHandles;
+		if (memBefore.bValid && phaseResults.memAfter.bValid)
+		{
+			os
+				<< std::setw(10) << DeltaMB(memBefore.cbCommit, phaseResults.memAfter.cbCommit)
+				<< std::setw(10) << DeltaMB(memBefore.cbNonpagedPool, phaseResults.memAfter.cbNonpagedPool)
+				<< std::setw(10) << DeltaMB(memBefore.cbPagedPool, phaseResults.memAfter.cbPagedPool);
+		}
+		os << std::endl;
+	}
+	os << std::endl;
+}
+
+/// <summary>
+/// Writes the per-phase metrics of a scenario run to a CSV file.
+/// </summary>
+bool WriteScenarioCsv(const std::wstring& sFilePath, const std::vector<ScenarioPhaseResults_t>& results, const KernelMemorySnapshot_t& memBefore)
+{
+	std::ostringstream csv;
+	csv << "Phase,Line,Pass,Kind,Done,Failed,LastError,Seconds,PerSec,P50Us,P90Us,P99Us,MaxUs,HeldHandles,CommitDeltaMB,NonpagedDeltaMB,PagedDeltaMB\n";
+	for (size_t ixResult = 0; ixResult < results.size(); ++ixResult)
+	{
+		const ScenarioPhaseResults_t& phaseResults = results[ixResult];
+		const double dSeconds = PerfCounterToSeconds(phaseResults.llElapsed);
+		const bool bMemValid = memBefore.bValid && phaseResults.memAfter.bValid;
+		csv
+			<< ixResult + 1 << ',' << phaseResults.phase.nLine << ',' << phaseResults.phase.nPass << ','
+			<< WStringToUtf8(ScenarioPhaseKindName(phaseResults.phase.kind)) << ','
+			<< phaseResults.nDone << ',' << phaseResults.nFailures << ',' << phaseResults.dwLastError << ','
+			<< dSeconds << ',' << (dSeconds > 0 && ScenarioPhaseKind_t::Hold != phaseResults.phase.kind ? double(phaseResults.nDone) / dSeconds : 0) << ','
+			<< phaseResults.latency.p50Us << ',' << phaseResults.latency.p90Us << ',' << phaseResults.latency.p99Us << ',' << phaseResults.latency.maxUs << ','
+			<< phaseResults.nHeldHandles << ','
+			<< (bMemValid ? DeltaMB(memBefore.cbCommit, phaseResults.memAfter.cbCommit) : 0) << ','
+			<< (bMemValid ? DeltaMB(memBefore.cbNonpagedPool, phaseResults.memAfter.cbNonpagedPool) : 0) << ','
+			<< (bMemValid ? DeltaMB(memBefore.cbPagedPool, phaseResults.memAfter.cbPagedPool) : 0) << '\n';
+	}
+	return WriteTextFile(sFilePath, csv.str());
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "HandleReleaser.h"
+#include "KernelMemory.h"
+#include "LatencyStats.h"
+#include "RateScheduler.h"
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Multi-phase scenarios: a file of spawn, hold, and release phases run back to back on one set of leaked handles
+
+/// <summary>
+/// Kinds of scenario phase.
+/// </summary>
+enum class ScenarioPhaseKind_t
+{
+	// Start zombie processes and keep their handles
+	Processes,
+	// Create zombie threads in this process and keep their handles
+	Threads,
+	// Wait with the handles held
+	Hold,
+	// Close a percentage of the held handles, oldest first
+	Release
+};
+
+/// <summary>
+/// Returns the scenario-file keyword of a phase kind: processes, threads, hold, or release.
+/// </summary>
+const wchar_t* ScenarioPhaseKindName(ScenarioPhaseKind_t kind);
+
+/// <summary>
+/// One phase of a scenario, as parsed from one line of the scenario file.
+/// </summary>
+struct ScenarioPhase_t
+{
+	ScenarioPhaseKind_t kind = ScenarioPhaseKind_t::Hold;
+	// Line in the scenario file, and which pass of its enclosing repeat block this is (1-based)
+	size_t nLine = 0;
+	unsigned int nPass = 1;
+	// Processes or Threads: number to create, spawn rate (0 for unpaced) and linear ramp, and spawner threads (0 for
+	// the command line's -P)
+	int nCount = 0;
+	RateSchedule_t rateSchedule;
+	unsigned int nSpawnerThreads = 0;
+	// Hold: how long to wait
+	double dHoldSeconds = 0;
+	// Release: percentage of the held handles to close, and how to close them
+	double dReleasePercent = 100;
+	ReleaseSettings_t release;
+};
+
+/// <summary>
+/// Reads a scenario file: one phase per line, with # starting a comment:
+///   processes count [rate:per_sec] [ramp:seconds] [P:threads]
+///   threads count [rate:per_sec] [ramp:seconds] [P:threads]
+///   hold seconds
+///   release percent% [serial | parallel[:threads] | batch[:size:ms]]
+///   repeat times
+/// "repeat" runs the phases since the previous repeat (or the start of the file) the specified number of times in all;
+/// the block is expanded into phases here.
+/// </summary>
+/// <param name="sFilePath">Input: path to the scenario file (ASCII or UTF-8)</param>
+/// <param name="phases">Output: the phases in the order they run</param>
+/// <param name="nErrorLine">Output: line number of the first invalid line, or 0 if the file couldn't be read</param>
+/// <returns>true if successful; false otherwise, with GetLastError() set (ERROR_INVALID_DATA for an invalid line)</returns>
+bool LoadScenarioFile(const std::wstring& sFilePath, std::vector<ScenarioPhase_t>& phases, size_t& nErrorLine);
+
+/// <summary>
+/// Settings shared by all phases of a scenario run.
+/// </summary>
+struct ScenarioSettings_t
+{
+	// Settings for the Processes phases; numProcesses, pLatency and pScheduler are set per phase
+	SpawnSettings_t spawn;
+	// Thread procedure and stack reservation for the Threads phases
+	LPTHREAD_START_ROUTINE pfnThread = nullptr;
+	SIZE_T cbStackReserve = 0;
+	// Spawner threads for phases that don't specify their own
+	unsigned int nSpawnerThreads = 1;
+	// Receives counts and the current phase for the live statistics page, or nullptr
+	LiveStats* pLiveStats = nullptr;
+};
+
+/// <summary>
+/// Metrics for one phase of a scenario run.
+/// </summary>
+struct ScenarioPhaseResults_t
+{
+	ScenarioPhase_t phase;
+	// Processes or threads created, or handles closed
+	size_t nDone = 0;
+	// Creation or CloseHandle failures, and the last creation error
+	size_t nFailures = 0;
+	DWORD dwLastError = 0;
+	// Wall time for the phase, in performance counter units
+	LONGLONG llElapsed = 0;
+	// Latency of each creation or close; empty for Hold
+	LatencySummary_t latency;
+	// Handles held at the end of the phase
+	size_t nHeldHandles = 0;
+	// System-wide counters at the end of the phase
+	KernelMemorySnapshot_t memAfter;
+};
+
+/// <summary>
+/// Runs the phases in order, keeping every leaked handle in heldHandles from one phase to the next, and writes one
+/// line of metrics to os as each phase ends. A Hold phase ends early if a key is pressed; a creation failure ends only
+/// its own phase.
+/// </summary>
+/// <param name="settings">Input: settings shared by all phases</param>
+/// <param name="phases">Input: phases from LoadScenarioFile</param>
+/// <param name="heldHandles">Input/output: handles held across phases; handles still held at the end are left in it</param>
+/// <param name="os">Output: stream for the per-phase lines</param>
+/// <returns>Metrics for each phase</returns>
+std::vector<ScenarioPhaseResults_t> RunScenario(const ScenarioSettings_t& settings, const std::vector<ScenarioPhase_t>& phases,
+	std::vector<HANDLE>& heldHandles, std::wostream& os);
+
+/// <summary>
+/// Writes the per-phase metrics of a scenario run as a table, with kernel memory relative to memBefore.
+/// </summary>
+void WriteScenarioReport(std::wostream& os, const std::vector<ScenarioPhaseResults_t>& results, const KernelMemorySnapshot_t& memBefore);
+
+/// <summary>
+/// Writes the per-phase metrics of a scenario run to a CSV file, with kernel memory relative to memBefore.
+/// </summary>
+/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+bool WriteScenarioCsv(const std::wstring& sFilePath, const std::vector<ScenarioPhaseResults_t>& results, const KernelMemorySnapshot_t& memBefore);
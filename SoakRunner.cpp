@@ -0,0 +1,193 @@
+// Steady-state churn soak: a fixed zombie population in which the oldest zombie is continuously replaced
+
+#include <Windows.h>
+#include <conio.h>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "SoakRunner.h"
+#include "EventTracer.h"
+#include "KernelMemory.h"
+#include "LatencyStats.h"
+#include "LiveStats.h"
+#include "RateScheduler.h"
+#include "SysErrorMessage.h"
+#include "Utilities.h"
+
+/// <summary>
+/// One zombie's handles in the ring buffer; either can be nullptr if that handle type isn't leaked.
+/// </summary>
+struct RingSlot_t
+{
+	HANDLE hProcess = nullptr;
+	HANDLE hThread = nullptr;
+};
+
+/// <summary>
+/// Closes the handles in a ring slot and empties it, counting them as released in pLiveStats if it's not nullptr.
+/// </summary>
+static void ReleaseSlot(RingSlot_t& slot, LiveStats* pLiveStats)
+{
+	if (nullptr != pLiveStats)
+		pLiveStats->OnHandlesReleased(size_t(nullptr != slot.hProcess) + size_t(nullptr != slot.hThread));
+	if (nullptr != slot.hProcess)
+	{
+		TraceEvent(TraceEventKind_t::HandleRelease, 0, 0, slot.hProcess);
+		CloseHandle(slot.hProcess);
+	}
+	if (nullptr != slot.hThread)
+	{
+		TraceEvent(TraceEventKind_t::HandleRelease, 0, 0, slot.hThread);
+		CloseHandle(slot.hThread);
+	}
+	slot = RingSlot_t();
+}
+
+/// <summary>
+/// Starts a zombie and stores the handles to keep in the slot, closing the others.
+/// </summary>
+/// <returns>true if started; false otherwise, with GetLastError() set</returns>
+static bool FillSlot(const SpawnSettings_t& settings, RingSlot_t& slot)
+{
+	PROCESS_INFORMATION pi;
+	if (!StartZombieProc(settings, pi))
+		return false;
+	if (settings.bLeakProcessHandles)
+		slot.hProcess = pi.hProcess;
+	else
+		CloseHandle(pi.hProcess);
+	if (settings.bLeakThreadHandles)
+		slot.hThread = pi.hThread;
+	else
+		CloseHandle(pi.hThread);
+	if (nullptr != settings.pLiveStats)
+		settings.pLiveStats->OnHandlesKept(size_t(nullptr != slot.hProcess) + size_t(nullptr != slot.hThread));
+	return true;
+}
+
+/// <summary>
+/// Writes one row of the per-interval soak report.
+/// </summary>
+static void WriteIntervalRow(double dElapsed, LONGLONG nChurned, double dIntervalSeconds, LONGLONG nIntervalChurned,
+	std::vector<LONGLONG>& intervalLatencies, const KernelMemorySnapshot_t& memBaseline)
+{
+	const LatencySummary_t latency = SummarizeLatencies(intervalLatencies);
+	const KernelMemorySnapshot_t memNow = TakeKernelMemorySnapshot();
+	FixedFormatGuard format(std::wcout, 1);
+	std::wcout
+		<< std::setw(10) << dElapsed
+		<< std::setw(12) << nChurned
+		<< std::setw(10) << (dIntervalSeconds > 0 ? double(nIntervalChurned) / dIntervalSeconds : 0)
+		<< std::setw(10) << latency.p50Us
+		<< std::setw(10) << latency.p99Us;
+	if (memBaseline.bValid && memNow.bValid)
+	{
+		std::wcout << std::showpos
+			<< std::setw(14) << LONGLONG(memNow.cbNonpagedPool) - LONGLONG(memBaseline.cbNonpagedPool)
+			<< std::setw(14) << LONGLONG(memNow.cbPagedPool) - LONGLONG(memBaseline.cbPagedPool)
+			<< std::setw(14) << LONGLONG(memNow.cbCommit) - LONGLONG(memBaseline.cbCommit)
+			<< std::noshowpos;
+	}
+	std::wcout << std::endl;
+}
+
+/// <summary>
+/// Builds a population of settings.numProcesses zombie processes whose handles are kept in a fixed-size ring buffer,
+/// then repeatedly releases the oldest zombie's handles and creates a replacement in its slot.
+/// </summary>
+LONGLONG RunSoak(const SpawnSettings_t& settings, const SoakSettings_t& soak)
+{
+	std::vector<RingSlot_t> ring(size_t(settings.numProcesses));
+
+	// Build the initial population as fast as possible.
+	std::wcout << L"Building population of " << ring.size() << L" zombies..." << std::endl;
+	for (size_t ixSlot = 0; ixSlot < ring.size(); ++ixSlot)
+	{
+		if (!FillSlot(settings, ring[ixSlot]))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcout << LastSpawnFailure() << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			for (RingSlot_t& slot : ring)
+				ReleaseSlot(slot, settings.pLiveStats);
+			return 0;
+		}
+	}
+
+	// Memory drift is measured relative to the full population, once the initial children have had time to exit and
+	// the kernel has finished tearing down their address spaces; otherwise their teardown shows up as negative drift.
+	if (soak.dSettleSeconds > 0)
+		Sleep(DWORD(soak.dSettleSeconds * 1000));
+	const KernelMemorySnapshot_t memBaseline = TakeKernelMemorySnapshot();
+	std::wcout
+		<< L"Churning; press any key to stop." << std::endl
+		<< L"  Elapsed s     Churned   Churn/s   p50 us    p99 us   Nonpaged drift  Paged drift  Commit drift" << std::endl;
+
+	const LONGLONG llFrequency = PerfCounterFrequency();
+	const LONGLONG llStart = PerfCounterNow();
+	const LONGLONG llEnd = llStart + LONGLONG(soak.dDurationSeconds * double(llFrequency));
+	const LONGLONG llIntervalTicks = LONGLONG(soak.dIntervalSeconds * double(llFrequency));
+	LONGLONG llIntervalStart = llStart;
+	LONGLONG nChurned = 0, nIntervalChurned = 0;
+	std::vector<LONGLONG> intervalLatencies;
+	intervalLatencies.reserve(1024);
+	size_t ixOldest = 0;
+	bool bStop = false;
+	if (nullptr != soak.pScheduler)
+		soak.pScheduler->Start();
+
+	while (!bStop)
+	{
+		if (nullptr != soak.pScheduler)
+			soak.pScheduler->WaitForToken();
+
+		// Replace the oldest zombie with a new one in the same slot.
+		RingSlot_t& slot = ring[ixOldest];
+		ReleaseSlot(slot, settings.pLiveStats);
+		const LONGLONG llSpawnStart = PerfCounterNow();
+		if (!FillSlot(settings, slot))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcout << LastSpawnFailure() << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			bStop = true;
+		}
+		else
+		{
+			const LONGLONG llNow = PerfCounterNow();
+			intervalLatencies.push_back(llNow - llSpawnStart);
+			++nChurned;
+			++nIntervalChurned;
+			ixOldest = (ixOldest + 1) % ring.size();
+
+			if (llNow - llIntervalStart >= llIntervalTicks)
+			{
+				WriteIntervalRow(PerfCounterToSeconds(llNow - llStart), nChurned, PerfCounterToSeconds(llNow - llIntervalStart),
+					nIntervalChurned, intervalLatencies, memBaseline);
+				intervalLatencies.clear();
+				nIntervalChurned = 0;
+				llIntervalStart = llNow;
+			}
+			if (soak.dDurationSeconds > 0 && llNow >= llEnd)
+				bStop = true;
+		}
+		// Checked after every replacement so that a long interval doesn't delay the stop.
+		if (_kbhit())
+		{
+// Suppress warning about ignored return value from _getch()
+#pragma warning(suppress: 6031)
+			_getch();
+			bStop = true;
+		}
+	}
+
+	const double dSeconds = PerfCounterToSeconds(PerfCounterNow() - llStart);
+	std::wcout
+		<< std::endl
+		<< L"Zombies churned:   " << nChurned << std::endl
+		<< L"Churn seconds:     " << dSeconds << std::endl
+		<< L"Churn/sec:         " << (dSeconds > 0 ? double(nChurned) / dSeconds : 0) << std::endl
+		<< std::endl;
+
+	for (RingSlot_t& slot : ring)
+		ReleaseSlot(slot, settings.pLiveStats);
+	return nChurned;
+}
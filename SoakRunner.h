@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Windows.h>
+#include "ZombieSpawner.h"
+
+class RateScheduler;
+
+// ------------------------------------------------------------------------------------------
+// Steady-state churn soak: a fixed zombie population in which the oldest zombie is continuously replaced
+
+/// <summary>
+/// Settings for a soak run.
+/// </summary>
+struct SoakSettings_t
+{
+	// How long to churn after the population is built; 0 to churn until a key is pressed
+	double dDurationSeconds = 0;
+	// How often to report churn throughput and drift
+	double dIntervalSeconds = 10;
+	// How long to wait after building the population before taking the memory baseline, so that the initial children
+	// have exited and been torn down
+	double dSettleSeconds = 3;
+	// Paces the churn (one token per replacement), or nullptr for as fast as possible
+	RateScheduler* pScheduler = nullptr;
+};
+
+/// <summary>
+/// Builds a population of settings.numProcesses zombie processes whose handles are kept in a fixed-size ring buffer,
+/// then repeatedly releases the oldest zombie's handles and creates a replacement in its slot. Reports churn throughput,
+/// spawn latency, and kernel memory drift once per interval. Stops after the configured duration, when a key is pressed,
+/// or at the first creation failure. All handles in the ring are released before returning.
+/// </summary>
+/// <param name="settings">Input: process creation settings; numProcesses is the population size</param>
+/// <param name="soak">Input: soak duration, report interval, and pacing</param>
+/// <returns>Total number of replacement zombies created during the churn phase</returns>
+LONGLONG RunSoak(const SpawnSettings_t& settings, const SoakSettings_t& soak);
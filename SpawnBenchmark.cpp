@@ -0,0 +1,114 @@
+// Spawn benchmark: compares spawn throughput, latency, and per-zombie kernel memory across variants of the spawn settings
+
+#include <Windows.h>
+#include <iomanip>
+#include <iostream>
+#include "SpawnBenchmark.h"
+#include "KernelMemory.h"
+#include "LatencyStats.h"
+#include "Utilities.h"
+#include "SysErrorMessage.h"
+
+/// <summary>
+/// Measurements for one variant.
+/// </summary>
+struct SpawnVariantResult_t
+{
+	int nStarted = 0;
+	double dSpawnsPerSec = 0;
+	LatencySummary_t latency;
+	// Latency of the first and last buckets of spawns, to show how it grows as zombies accumulate
+	LatencySummary_t firstBucket, lastBucket;
+	KernelMemorySnapshot_t memBefore, memAfter;
+};
+
+/// <summary>
+/// Returns the per-zombie change in a counter, or 0 if nothing was started.
+/// </summary>
+static double PerZombie(ULONGLONG before, ULONGLONG after, int nStarted)
+{
+	if (nStarted <= 0)
+		return 0;
+	return (double(after) - double(before)) / double(nStarted);
+}
+
+/// <summary>
+/// Benchmarks each variant in turn and writes a comparison table.
+/// </summary>
+void RunSpawnBenchmark(const wchar_t* szTitle, const std::vector<SpawnVariant_t>& variants, unsigned int nThreads)
+{
+	// Time to let the system reclaim one variant's zombies before measuring the next
+	const DWORD dwBackoffMs = 2000;
+
+	std::vector<SpawnVariantResult_t> results(variants.size());
+	for (size_t ixVariant = 0; ixVariant < variants.size(); ++ixVariant)
+	{
+		const SpawnVariant_t& variant = variants[ixVariant];
+		SpawnVariantResult_t& result = results[ixVariant];
+		std::wcout << L"Variant " << variant.sName << L": " << variant.settings.sZombieProcPath << std::endl;
+		if (INVALID_FILE_ATTRIBUTES == GetFileAttributesW(variant.settings.sZombieProcPath.c_str()))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcout << L"  Skipped: " << SysErrorMessageWithCode(dwLastErr) << std::endl << std::endl;
+			continue;
+		}
+
+		SpawnSettings_t settings = variant.settings;
+		SpawnLatencyRecorder latency(settings.numProcesses);
+		settings.pLatency = &latency;
+
+		result.memBefore = TakeKernelMemorySnapshot();
+		LONGLONG llElapsed = 0;
+		SpawnerResults_t spawned = SpawnZombieProcesses(settings, nThreads, llElapsed);
+		// Measure memory once all the children have exited and become zombies.
+		for (HANDLE h : spawned.leakedHandles)
+		{
+			WaitForSingleObject(h, INFINITE);
+		}
+		result.memAfter = TakeKernelMemorySnapshot();
+
+		const double dSeconds = PerfCounterToSeconds(llElapsed);
+		result.nStarted = spawned.nStarted;
+		result.dSpawnsPerSec = (dSeconds > 0 ? spawned.nStarted / dSeconds : 0);
+		result.latency = latency.OverallSummary();
+		const std::vector<LatencySummary_t> buckets = latency.BucketSummaries();
+		if (!buckets.empty())
+		{
+			result.firstBucket = buckets.front();
+			result.lastBucket = buckets.back();
+		}
+		std::wcout << L"  Started " << result.nStarted << L" in " << dSeconds << L" seconds" << std::endl << std::endl;
+
+		for (HANDLE h : spawned.leakedHandles)
+		{
+			CloseHandle(h);
+		}
+		if (ixVariant + 1 < variants.size())
+			Sleep(dwBackoffMs);
+	}
+
+	std::wcout
+		<< szTitle << L" (first and last p50 over " << SpawnLatencyRecorder::BucketSize << L" spawns; kernel memory in bytes/zombie, system-wide):" << std::endl
+		<< L"  Variant          Started  Spawns/sec   p50 us   p99 us  First p50   Last p50    Nonpaged       Paged      Commit" << std::endl;
+	for (size_t ixVariant = 0; ixVariant < variants.size(); ++ixVariant)
+	{
+		const SpawnVariantResult_t& result = results[ixVariant];
+		FixedFormatGuard format(std::wcout, 1);
+		std::wcout << L"  " << std::left << std::setw(14) << variants[ixVariant].sName << std::right
+			<< std::setw(10) << result.nStarted
+			<< std::setw(12) << result.dSpawnsPerSec
+			<< std::setw(9) << result.latency.p50Us
+			<< std::setw(9) << result.latency.p99Us
+			<< std::setw(11) << result.firstBucket.p50Us
+			<< std::setw(11) << result.lastBucket.p50Us;
+		if (result.memBefore.bValid && result.memAfter.bValid)
+		{
+			std::wcout
+				<< std::setw(12) << PerZombie(result.memBefore.cbNonpagedPool, result.memAfter.cbNonpagedPool, result.nStarted)
+				<< std::setw(12) << PerZombie(result.memBefore.cbPagedPool, result.memAfter.cbPagedPool, result.nStarted)
+				<< std::setw(12) << PerZombie(result.memBefore.cbCommit, result.memAfter.cbCommit, result.nStarted);
+		}
+		std::wcout << std::endl;
+	}
+	std::wcout << std::endl;
+}
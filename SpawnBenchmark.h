@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Spawn benchmark: compares spawn throughput, latency, and per-zombie kernel memory across variants of the spawn settings,
+// such as child images or spawn strategies
+
+/// <summary>
+/// One variant of the spawn settings to benchmark.
+/// </summary>
+struct SpawnVariant_t
+{
+	// Short name for the report, e.g., "full"
+	std::wstring sName;
+	SpawnSettings_t settings;
+};
+
+/// <summary>
+/// For each variant in turn, starts settings.numProcesses zombies from nThreads spawner threads, waits for them to
+/// exit, measures spawn throughput, latency, and the system-wide kernel memory change per zombie, then releases them
+/// and backs off before the next variant. Writes a comparison table at the end.
+/// Variants whose child executable doesn't exist are skipped.
+/// </summary>
+/// <param name="szTitle">Input: heading for the comparison table, e.g., "Child image comparison"</param>
+/// <param name="variants">Input: settings to compare; each one's pLatency is replaced</param>
+/// <param name="nThreads">Input: number of spawner threads (1 or more)</param>
+void RunSpawnBenchmark(const wchar_t* szTitle, const std::vector<SpawnVariant_t>& variants, unsigned int nThreads);
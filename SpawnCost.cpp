@@ -0,0 +1,123 @@
+// Spawn-cost dimensions: inherited handle count, environment size, and command-line size
+
+#include <Windows.h>
+#include <algorithm>
+#include "SpawnCost.h"
+#include "SpawnBenchmark.h"
+
+InheritableHandlePool::~InheritableHandlePool()
+{
+	for (HANDLE h : m_handles)
+	{
+		CloseHandle(h);
+	}
+}
+
+/// <summary>
+/// Creates nHandles inheritable events, in addition to any already in the pool.
+/// </summary>
+bool InheritableHandlePool::Create(size_t nHandles)
+{
+	SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+	m_handles.reserve(m_handles.size() + nHandles);
+	for (size_t ixHandle = 0; ixHandle < nHandles; ++ixHandle)
+	{
+		HANDLE hEvent = CreateEventW(&sa, TRUE, FALSE, nullptr);
+		if (nullptr == hEvent)
+			return false;
+		m_handles.push_back(hEvent);
+	}
+	return true;
+}
+
+/// <summary>
+/// Returns this process's environment plus padding variables that add about cchPad characters.
+/// </summary>
+std::wstring BuildPaddedEnvironment(size_t cchPad)
+{
+	std::wstring sEnvironment;
+	wchar_t* pEnvironment = GetEnvironmentStringsW();
+	if (nullptr != pEnvironment)
+	{
+		// Variables are null-terminated, and an empty one ends the block.
+		for (const wchar_t* pVar = pEnvironment; L'\0' != *pVar; pVar += wcslen(pVar) + 1)
+		{
+			sEnvironment.append(pVar);
+			sEnvironment.push_back(L'\0');
+		}
+		FreeEnvironmentStringsW(pEnvironment);
+	}
+	// Values are limited to 32767 characters, so large paddings take several variables.
+	const size_t cchMaxValue = 16384;
+	for (unsigned int nVar = 1; cchPad > 0; ++nVar)
+	{
+		const std::wstring sName = L"ZOMBIEMAKER_PAD_" + std::to_wstring(nVar) + L"=";
+		const size_t cchValue = (std::min)(cchMaxValue, cchPad);
+		sEnvironment += sName;
+		sEnvironment.append(cchValue, L'x');
+		sEnvironment.push_back(L'\0');
+		cchPad -= cchValue;
+	}
+	return sEnvironment;
+}
+
+/// <summary>
+/// Returns a child argument of cchPad characters in all, which ZombieProc ignores.
+/// </summary>
+std::wstring CommandLinePadding(size_t cchPad)
+{
+	const std::wstring sPrefix = L"-pad:";
+	if (0 == cchPad)
+		return std::wstring();
+	return sPrefix + std::wstring((std::max)(cchPad, sPrefix.length() + 1) - sPrefix.length(), L'x');
+}
+
+/// <summary>
+/// Runs the spawn benchmark once per point on each dimension.
+/// </summary>
+bool RunSpawnCostSweep(const SpawnSettings_t& settings, unsigned int nThreads)
+{
+	const size_t handleCounts[] = { 0, 64, 1024, 8192 };
+	const size_t environmentPads[] = { 0, 4096, 32768, 262144 };
+	const size_t commandLinePads[] = { 0, 1024, 8192, MaxCommandLinePad };
+
+	// One list per point, each a prefix of the largest; the spawners refer to them for the whole sweep.
+	InheritableHandlePool pool;
+	if (!pool.Create(handleCounts[_countof(handleCounts) - 1]))
+		return false;
+	std::vector<std::vector<HANDLE>> handleLists;
+	for (size_t nHandles : handleCounts)
+	{
+		handleLists.emplace_back(pool.Handles().begin(), pool.Handles().begin() + ptrdiff_t(nHandles));
+	}
+
+	std::vector<SpawnVariant_t> variants;
+	for (size_t ixPoint = 0; ixPoint < _countof(handleCounts); ++ixPoint)
+	{
+		SpawnSettings_t variant = settings;
+		variant.pInheritHandles = &handleLists[ixPoint];
+		variants.push_back({ L"handles:" + std::to_wstring(handleCounts[ixPoint]), variant });
+	}
+	RunSpawnBenchmark(L"Inherited handle count", variants, nThreads);
+
+	variants.clear();
+	for (size_t cchPad : environmentPads)
+	{
+		SpawnSettings_t variant = settings;
+		variant.sEnvironment = (0 == cchPad) ? std::wstring() : BuildPaddedEnvironment(cchPad);
+		variants.push_back({ L"env:+" + std::to_wstring(cchPad), variant });
+	}
+	RunSpawnBenchmark(L"Environment size", variants, nThreads);
+
+	variants.clear();
+	for (size_t cchPad : commandLinePads)
+	{
+		SpawnSettings_t variant = settings;
+		const std::wstring sPadding = CommandLinePadding(cchPad);
+		if (!sPadding.empty())
+			variant.sChildArgs += (variant.sChildArgs.empty() ? L"" : L" ") + sPadding;
+		variants.push_back({ L"cmdline:+" + std::to_wstring(cchPad), variant });
+	}
+	RunSpawnBenchmark(L"Command-line size", variants, nThreads);
+	return true;
+}
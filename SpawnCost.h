@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Spawn-cost dimensions: inherited handle count, environment size, and command-line size
+
+/// <summary>
+/// Largest command-line padding, in characters: CreateProcessW accepts at most 32767 characters, including the child's
+/// path and its other arguments.
+/// </summary>
+const size_t MaxCommandLinePad = 30000;
+
+/// <summary>
+/// Largest environment padding, in characters.
+/// </summary>
+const size_t MaxEnvironmentPad = 1024 * 1024;
+
+/// <summary>
+/// Unnamed inheritable events for children to inherit through an explicit handle list, like the handle table of a
+/// service that spawns children while holding many handles. Closed when the pool is destroyed.
+/// </summary>
+class InheritableHandlePool
+{
+public:
+	InheritableHandlePool() = default;
+	~InheritableHandlePool();
+
+	/// <summary>
+	/// Creates nHandles inheritable events, in addition to any already in the pool.
+	/// </summary>
+	/// <returns>true if successful; false otherwise, with GetLastError() set and the events created so far kept</returns>
+	bool Create(size_t nHandles);
+
+	/// <summary>
+	/// The pool's handles, for SpawnSettings_t::pInheritHandles.
+	/// </summary>
+	const std::vector<HANDLE>& Handles() const { return m_handles; }
+
+private:
+	std::vector<HANDLE> m_handles;
+
+	InheritableHandlePool(const InheritableHandlePool&) = delete;
+	InheritableHandlePool& operator=(const InheritableHandlePool&) = delete;
+};
+
+/// <summary>
+/// Returns an environment block for SpawnSettings_t::sEnvironment: this process's environment, plus padding variables
+/// (ZOMBIEMAKER_PAD_1, ...) that add about cchPad characters. Each variable ends with a null character; the string's own
+/// terminator ends the block.
+/// </summary>
+std::wstring BuildPaddedEnvironment(size_t cchPad);
+
+/// <summary>
+/// Returns a child argument of cchPad characters in all (-pad:xxx...), which ZombieProc ignores, or an empty string for 0.
+/// </summary>
+std::wstring CommandLinePadding(size_t cchPad);
+
+/// <summary>
+/// Runs the spawn benchmark once per point on each dimension (inherited handles, environment padding, and command-line
+/// padding) with the others at their defaults, so that the tables show how spawn throughput and latency, early and late
+/// in the population, grow with each one.
+/// </summary>
+/// <param name="settings">Input: settings for each run; the swept handle list or environment replaces the settings' own, and
+/// the command-line padding is appended to sChildArgs</param>
+/// <param name="nThreads">Input: number of spawner threads (1 or more)</param>
+/// <returns>true if successful; false if the inheritable handles couldn't be created, with GetLastError() set</returns>
+bool RunSpawnCostSweep(const SpawnSettings_t& settings, unsigned int nThreads);
@@ -53,6 +53,25 @@ std::wstring& WString_To_Upper(std::wstring& str)
 	return str;
 }
 
+// ------------------------------------------------------------------------------------------
+/// <summary>
+/// Convert a wstring to a UTF-8 encoded std::string
+/// </summary>
+/// <param name="str">Input string</param>
+/// <returns>UTF-8 encoded string</returns>
+std::string WStringToUtf8(const std::wstring& str)
+{
+	if (str.empty())
+		return std::string();
+	int cchWide = int(str.length());
+	int cbUtf8 = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), cchWide, nullptr, 0, nullptr, nullptr);
+	if (cbUtf8 <= 0)
+		return std::string();
+	std::string sUtf8(size_t(cbUtf8), '\0');
+	WideCharToMultiByte(CP_UTF8, 0, str.c_str(), cchWide, &sUtf8[0], cbUtf8, nullptr, nullptr);
+	return sUtf8;
+}
+
 // ----------------------------------------------------------------------------------------------------
 // Date/time-related string manipulation
 
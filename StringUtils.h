@@ -53,6 +53,14 @@ void SplitStringToVector(const std::wstring& strInput, wchar_t delim, std::vecto
 /// <returns></returns>
 std::wstring& WString_To_Upper(std::wstring& str);
 
+// ------------------------------------------------------------------------------------------
+/// <summary>
+/// Convert a wstring to a UTF-8 encoded std::string
+/// </summary>
+/// <param name="str">Input string</param>
+/// <returns>UTF-8 encoded string</returns>
+std::string WStringToUtf8(const std::wstring& str);
+
 // ------------------------------------------------------------------------------------------
 // Replace all instances of one substring with another (std::wstring and std::string)
 
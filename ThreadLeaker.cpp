@@ -0,0 +1,147 @@
+// Leaked threads in this process, optionally with small stacks and spread across multiple creator threads
+
+#include <Windows.h>
+#include <Psapi.h>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "ThreadLeaker.h"
+#include "EventTracer.h"
+#include "LatencyStats.h"
+#include "LiveStats.h"
+#include "RateScheduler.h"
+#include "Utilities.h"
+#include "SysErrorMessage.h"
+#include "WorkerThreads.h"
+
+/// <summary>
+/// Creates one thread in this process with the settings' thread procedure and stack reservation.
+/// </summary>
+HANDLE CreateLeakableThread(LPTHREAD_START_ROUTINE pfnThread, SIZE_T cbStackReserve)
+{
+	// With STACK_SIZE_PARAM_IS_A_RESERVATION, the size replaces the reservation from the executable's header instead of the
+	// initial commit, so each thread costs only its reservation's address space plus the pages it actually touches.
+	const DWORD dwCreationFlags = (0 != cbStackReserve) ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0;
+	DWORD dwTid = 0;
+	HANDLE hThread = CreateThread(NULL, cbStackReserve, pfnThread, NULL, dwCreationFlags, &dwTid);
+	if (NULL == hThread)
+	{
+		const DWORD dwLastErr = GetLastError();
+		TraceEvent(TraceEventKind_t::ThreadSpawnFailed, 0, 0, nullptr, dwLastErr);
+		SetLastError(dwLastErr);
+		return NULL;
+	}
+	TraceEvent(TraceEventKind_t::ThreadSpawn, GetCurrentProcessId(), dwTid, hThread);
+	return hThread;
+}
+
+/// <summary>
+/// Body of each creator thread: claims indexes from the shared budget and creates one leaked thread per index.
+/// </summary>
+static void CreatorThread(const ThreadLeakSettings_t& settings, SharedWorkBudget& budget, SpawnerResults_t& threadResults)
+{
+	// Count into a local and copy out at the end, so that creator threads don't share cache lines in the hot loop.
+	SpawnerResults_t results;
+	ProcessClaimedItems(budget, [&](size_t ixThread)
+	{
+		if (nullptr != settings.pScheduler)
+			settings.pScheduler->WaitForToken();
+
+		const LONGLONG llStart = PerfCounterNow();
+		HANDLE hThread = CreateLeakableThread(settings.pfnThread, settings.cbStackReserve);
+		if (NULL == hThread)
+		{
+			DWORD dwLastErr = GetLastError();
+			++results.nFailures;
+			results.dwLastError = dwLastErr;
+			if (nullptr != settings.pLiveStats)
+				settings.pLiveStats->OnFailed(dwLastErr);
+			std::lock_guard<std::mutex> lock(budget.ConsoleMutex());
+			std::wcout << L"CreateThread failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			return false;
+		}
+		if (nullptr != settings.pLatency)
+			settings.pLatency->Record(int(ixThread), PerfCounterNow() - llStart);
+		++results.nStarted;
+		results.leakedHandles.push_back(hThread);
+		if (nullptr != settings.pLiveStats)
+		{
+			settings.pLiveStats->OnSpawned();
+			settings.pLiveStats->OnHandlesKept(1);
+		}
+		// Thread creation is much cheaper than process creation, so report progress less often.
+		budget.OnCompleted(1000);
+		return true;
+	});
+	threadResults = std::move(results);
+}
+
+/// <summary>
+/// Creates settings.numThreads threads in this process, spread across nCreatorThreads creator threads that share the
+/// budget, and returns all their handles as leaked.
+/// </summary>
+SpawnerResults_t LeakThreads(const ThreadLeakSettings_t& settings, unsigned int nCreatorThreads, LONGLONG& llElapsed)
+{
+	// Threads claimed at a time: thread creation is cheap enough that creators claiming one at a time would contend on
+	// the shared index.
+	const size_t BatchSize = 16;
+	SharedWorkBudget budget(size_t((std::max)(settings.numThreads, 0)), BatchSize);
+	std::vector<SpawnerResults_t> perThreadResults(nCreatorThreads);
+
+	const LONGLONG llStart = PerfCounterNow();
+	RunWorkerThreads(nCreatorThreads, [&](unsigned int ixThread)
+	{
+		CreatorThread(settings, budget, perThreadResults[ixThread]);
+	});
+	llElapsed = PerfCounterNow() - llStart;
+
+	SpawnerResults_t results;
+	for (const SpawnerResults_t& threadResults : perThreadResults)
+	{
+		results.Merge(threadResults);
+	}
+	return results;
+}
+
+/// <summary>
+/// Captures this process's current memory footprint.
+/// </summary>
+ProcessFootprint_t TakeProcessFootprint()
+{
+	ProcessFootprint_t footprint;
+	PROCESS_MEMORY_COUNTERS_EX pmc = { 0 };
+	MEMORYSTATUSEX memStatus = { 0 };
+	memStatus.dwLength = sizeof(memStatus);
+	if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&pmc), sizeof(pmc)) &&
+		GlobalMemoryStatusEx(&memStatus))
+	{
+		footprint.bValid = true;
+		footprint.cbPrivate = pmc.PrivateUsage;
+		footprint.cbAddressSpace = memStatus.ullTotalVirtual - memStatus.ullAvailVirtual;
+	}
+	return footprint;
+}
+
+/// <summary>
+/// Writes the change in this process's footprint between two snapshots, and the change per thread.
+/// </summary>
+void WriteProcessFootprintDelta(std::wostream& os, const ProcessFootprint_t& before, const ProcessFootprint_t& after, size_t nThreads)
+{
+	if (!before.bValid || !after.bValid)
+		return;
+	const LONGLONG llPrivate = LONGLONG(after.cbPrivate) - LONGLONG(before.cbPrivate);
+	const LONGLONG llAddressSpace = LONGLONG(after.cbAddressSpace) - LONGLONG(before.cbAddressSpace);
+	os
+		<< L"This process's footprint:" << std::endl
+		<< L"  Private commit:  " << before.cbPrivate << L" -> " << after.cbPrivate << L" bytes" << std::endl
+		<< L"  Address space:   " << before.cbAddressSpace << L" -> " << after.cbAddressSpace << L" bytes" << std::endl;
+	if (nThreads > 0)
+	{
+		FixedFormatGuard format(os, 1);
+		os
+			<< L"  Private commit/thread: " << double(llPrivate) / double(nThreads) << L" bytes" << std::endl
+			<< L"  Address space/thread:  " << double(llAddressSpace) / double(nThreads) << L" bytes" << std::endl;
+	}
+	os << std::endl;
+}
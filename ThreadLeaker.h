@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Windows.h>
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Leaked threads in this process, optionally with small stacks and spread across multiple creator threads
+
+/// <summary>
+/// Settings shared by all creator threads for a leaked-thread run.
+/// </summary>
+struct ThreadLeakSettings_t
+{
+	// Total number of threads to create across all creator threads
+	int numThreads = 10;
+	// Thread procedure for the leaked threads (exits immediately for zombies, or hangs)
+	LPTHREAD_START_ROUTINE pfnThread = nullptr;
+	// Stack reservation for each thread in bytes, or 0 for the executable's default.
+	// Only reserved, not committed; the system rounds it up to the allocation granularity (64 KB).
+	SIZE_T cbStackReserve = 0;
+	// Receives the latency of each creation by population index, or nullptr
+	SpawnLatencyRecorder* pLatency = nullptr;
+	// Paces creations to a target rate, or nullptr
+	RateScheduler* pScheduler = nullptr;
+	// Receives creation, failure, and leaked-handle counts for the live statistics page, or nullptr
+	LiveStats* pLiveStats = nullptr;
+};
+
+/// <summary>
+/// Creates one thread in this process with the settings' thread procedure and stack reservation.
+/// </summary>
+/// <returns>Thread handle, or nullptr with GetLastError() set by CreateThread</returns>
+HANDLE CreateLeakableThread(LPTHREAD_START_ROUTINE pfnThread, SIZE_T cbStackReserve);
+
+/// <summary>
+/// Creates settings.numThreads threads in this process, spread across nCreatorThreads creator threads that share the
+/// budget, and returns all their handles as leaked. All creators stop after the first CreateThread failure in any of them.
+/// With nCreatorThreads == 1, all threads are created on the calling thread.
+/// </summary>
+/// <param name="settings">Input: settings for the run</param>
+/// <param name="nCreatorThreads">Input: number of creator threads (1 or more)</param>
+/// <param name="llElapsed">Output: wall time for the run, in performance counter units</param>
+/// <returns>Counts merged from all creator threads</returns>
+SpawnerResults_t LeakThreads(const ThreadLeakSettings_t& settings, unsigned int nCreatorThreads, LONGLONG& llElapsed);
+
+/// <summary>
+/// This process's memory footprint: private commit and reserved-or-committed address space.
+/// </summary>
+struct ProcessFootprint_t
+{
+	bool bValid = false;
+	ULONGLONG cbPrivate = 0;
+	ULONGLONG cbAddressSpace = 0;
+};
+
+/// <summary>
+/// Captures this process's current memory footprint.
+/// </summary>
+ProcessFootprint_t TakeProcessFootprint();
+
+/// <summary>
+/// Writes the change in this process's footprint between two snapshots, and the change per thread.
+/// Nothing is written if either snapshot is invalid.
+/// </summary>
+void WriteProcessFootprintDelta(std::wostream& os, const ProcessFootprint_t& before, const ProcessFootprint_t& after, size_t nThreads);
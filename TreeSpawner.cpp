@@ -0,0 +1,228 @@
+// Hierarchical fan-out: sub-maker processes that each create and hold part of the zombie population
+
+#include <Windows.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "TreeSpawner.h"
+#include "LatencyStats.h"
+#include "Utilities.h"
+
+/// <summary>
+/// Names of the parent's shared-memory block and release event; unique to the parent ZombieMaker instance.
+/// </summary>
+static std::wstring TreeObjectName(DWORD dwParentPid, const wchar_t* szSuffix)
+{
+	std::wstringstream strName;
+	strName << L"Local\\ZombieMaker-" << dwParentPid << szSuffix;
+	return strName.str();
+}
+
+/// <summary>
+/// Size of the shared-memory block: one report per sub-maker.
+/// </summary>
+static DWORD ReportBlockSize(unsigned int nSubMakers)
+{
+	return DWORD(nSubMakers * sizeof(SubMakerReport_t));
+}
+
+TreeSpawner::~TreeSpawner()
+{
+	Release();
+	if (nullptr != m_pReports)
+		UnmapViewOfFile(m_pReports);
+	if (nullptr != m_hMapping)
+		CloseHandle(m_hMapping);
+	if (nullptr != m_hReleaseEvent)
+		CloseHandle(m_hReleaseEvent);
+}
+
+/// <summary>
+/// Creates the shared-memory block and release event, and starts nSubMakers sub-makers that share nTotal zombies.
+/// </summary>
+bool TreeSpawner::Start(const std::wstring& sSubMakerArgs, int nTotal, unsigned int nSubMakers)
+{
+	wchar_t szExePath[MAX_PATH + 1] = { 0 };
+	if (!GetModuleFileNameW(NULL, szExePath, MAX_PATH))
+		return false;
+	const std::wstring sExePath = szExePath;
+	const DWORD dwPid = GetCurrentProcessId();
+	// Page-file-backed, so it starts zeroed: no sub-maker has reported.
+	m_hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, ReportBlockSize(nSubMakers), TreeObjectName(dwPid, L"-Tree").c_str());
+	if (nullptr == m_hMapping)
+		return false;
+	m_pReports = static_cast<SubMakerReport_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+	if (nullptr == m_pReports)
+		return false;
+	// Manual-reset, so that one SetEvent releases every sub-maker.
+	m_hReleaseEvent = CreateEventW(nullptr, TRUE, FALSE, TreeObjectName(dwPid, L"-TreeRelease").c_str());
+	if (nullptr == m_hReleaseEvent)
+		return false;
+
+	const LONGLONG llStart = PerfCounterNow();
+	for (unsigned int ixSubMaker = 0; ixSubMaker < nSubMakers; ++ixSubMaker)
+	{
+		// Spread the remainder over the first sub-makers.
+		const int nShare = nTotal / int(nSubMakers) + ((int(ixSubMaker) < nTotal % int(nSubMakers)) ? 1 : 0);
+		std::wstringstream strCommandLine;
+		strCommandLine << L"\"" << sExePath << L"\" -submaker:" << ixSubMaker << L":" << dwPid << L" -n:" << nShare << sSubMakerArgs;
+		std::wstring sCommandLine = strCommandLine.str();
+		STARTUPINFOW startupInfo = { 0 };
+		startupInfo.cb = sizeof(startupInfo);
+		PROCESS_INFORMATION pi = { 0 };
+		// No console, so that the sub-makers' progress output doesn't interleave with the parent's.
+		if (!CreateProcessW(sExePath.c_str(), &sCommandLine[0], nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &startupInfo, &pi))
+			return false;
+		CloseHandle(pi.hThread);
+		m_subMakers.push_back(pi.hProcess);
+	}
+	m_dElapsedSeconds = PerfCounterToSeconds(PerfCounterNow() - llStart);
+	return true;
+}
+
+/// <summary>
+/// Waits until every sub-maker has reported or exited, writing progress to the console.
+/// </summary>
+int TreeSpawner::WaitForSubMakers()
+{
+	const LONGLONG llStart = PerfCounterNow();
+	const DWORD dwPollMs = 100;
+	for (;;)
+	{
+		size_t nFinished = 0;
+		int nStarted = 0;
+		for (size_t ixSubMaker = 0; ixSubMaker < m_subMakers.size(); ++ixSubMaker)
+		{
+			const SubMakerReport_t& report = m_pReports[ixSubMaker];
+			if (0 != report.bDone)
+			{
+				++nFinished;
+				nStarted += report.nStarted;
+			}
+			else if (WAIT_OBJECT_0 == WaitForSingleObject(m_subMakers[ixSubMaker], 0))
+			{
+				// Exited without reporting
+				++nFinished;
+			}
+		}
+		// Write progress to the console with CR but no LF to overwrite previous lines
+		std::wcout << L"Sub-makers finished: " << nFinished << L" of " << m_subMakers.size() << L" ...          \r" << std::flush;
+		if (nFinished == m_subMakers.size())
+		{
+			std::wcout << std::endl;
+			m_dElapsedSeconds += PerfCounterToSeconds(PerfCounterNow() - llStart);
+			return nStarted;
+		}
+		Sleep(dwPollMs);
+	}
+}
+
+/// <summary>
+/// Writes each sub-maker's report and the totals.
+/// </summary>
+void TreeSpawner::WriteReport(std::wostream& os) const
+{
+	os << std::endl
+		<< L"Sub-maker      PID   Started  Failures   Seconds  Spawns/sec   p50 us   p99 us" << std::endl;
+	int nStarted = 0, nFailures = 0;
+	size_t nLeakedHandles = 0;
+	// The sub-makers spawn concurrently, so the longest spawn phase is the time the whole population took to create.
+	double dSpawnSeconds = 0;
+	for (size_t ixSubMaker = 0; ixSubMaker < m_subMakers.size(); ++ixSubMaker)
+	{
+		const SubMakerReport_t& report = m_pReports[ixSubMaker];
+		os << std::setw(9) << ixSubMaker;
+		if (0 == report.bDone)
+		{
+			os << L"  (exited without reporting)" << std::endl;
+			continue;
+		}
+		FixedFormatGuard format(os, 2);
+		os << std::setw(9) << report.dwPid << std::setw(10) << report.nStarted << std::setw(10) << report.nFailures
+			<< std::setw(10) << report.dElapsedSeconds
+			<< std::setprecision(1) << std::setw(12) << (report.dElapsedSeconds > 0 ? report.nStarted / report.dElapsedSeconds : 0)
+			<< std::setw(9) << report.p50Us << std::setw(9) << report.p99Us << std::endl;
+		nStarted += report.nStarted;
+		nFailures += report.nFailures;
+		nLeakedHandles += size_t(report.nLeakedHandles);
+		dSpawnSeconds = (std::max)(dSpawnSeconds, report.dElapsedSeconds);
+	}
+	os
+		<< std::endl
+		<< L"Sub-makers:        " << m_subMakers.size() << std::endl
+		<< L"Processes started: " << nStarted << std::endl
+		<< L"Failures:          " << nFailures << std::endl
+		<< L"Leaked handles:    " << nLeakedHandles << L" (held by the sub-makers)" << std::endl
+		<< L"Spawn seconds:     " << dSpawnSeconds << L" (longest sub-maker)" << std::endl
+		<< L"Spawns/sec:        " << (dSpawnSeconds > 0 ? nStarted / dSpawnSeconds : 0) << std::endl
+		<< L"Seconds to done:   " << m_dElapsedSeconds << L" (until every sub-maker's zombies exited)" << std::endl
+		<< std::endl;
+}
+
+/// <summary>
+/// Signals every sub-maker to release its handles and exit, and waits for them to exit.
+/// </summary>
+void TreeSpawner::Release()
+{
+	if (nullptr != m_hReleaseEvent)
+		SetEvent(m_hReleaseEvent);
+	for (HANDLE hSubMaker : m_subMakers)
+	{
+		WaitForSingleObject(hSubMaker, INFINITE);
+		CloseHandle(hSubMaker);
+	}
+	m_subMakers.clear();
+}
+
+/// <summary>
+/// Runs this process as a sub-maker: spawns, reports through the parent's shared-memory block, and holds its handles
+/// until the parent releases it or exits.
+/// </summary>
+int TreeSpawner::RunSubMaker(const SpawnSettings_t& settings, unsigned int nThreads, unsigned int ixSubMaker, DWORD dwParentPid)
+{
+	HANDLE hParent = OpenProcess(SYNCHRONIZE, FALSE, dwParentPid);
+	HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, TreeObjectName(dwParentPid, L"-Tree").c_str());
+	HANDLE hReleaseEvent = OpenEventW(SYNCHRONIZE, FALSE, TreeObjectName(dwParentPid, L"-TreeRelease").c_str());
+	if (nullptr == hParent || nullptr == hMapping || nullptr == hReleaseEvent)
+		return -2;
+	// Map only as far as this sub-maker's report.
+	SubMakerReport_t* pReports = static_cast<SubMakerReport_t*>(MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, ReportBlockSize(ixSubMaker + 1)));
+	if (nullptr == pReports)
+		return -2;
+	SubMakerReport_t& report = pReports[ixSubMaker];
+
+	SpawnSettings_t subMakerSettings = settings;
+	SpawnLatencyRecorder latency(settings.numProcesses);
+	subMakerSettings.pLatency = &latency;
+	LONGLONG llElapsed = 0;
+	SpawnerResults_t results = SpawnZombieProcesses(subMakerSettings, nThreads, llElapsed);
+	const LatencySummary_t summary = latency.OverallSummary();
+	// Report only once the zombies exist, so that the parent's kernel memory measurement includes them.
+	for (HANDLE h : results.leakedHandles)
+	{
+		WaitForSingleObject(h, INFINITE);
+	}
+
+	report.dwPid = GetCurrentProcessId();
+	report.nStarted = results.nStarted;
+	report.nFailures = results.nFailures;
+	report.dwLastError = results.dwLastError;
+	report.nLeakedHandles = LONG(results.leakedHandles.size());
+	report.dElapsedSeconds = PerfCounterToSeconds(llElapsed);
+	report.p50Us = summary.p50Us;
+	report.p99Us = summary.p99Us;
+	// Publish the report: the interlocked write orders the fields above before the flag.
+	InterlockedExchange(&report.bDone, 1);
+
+	HANDLE waitHandles[] = { hReleaseEvent, hParent };
+	WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE);
+	for (HANDLE h : results.leakedHandles)
+	{
+		CloseHandle(h);
+	}
+	UnmapViewOfFile(pReports);
+	CloseHandle(hMapping);
+	CloseHandle(hReleaseEvent);
+	CloseHandle(hParent);
+	return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Hierarchical fan-out: sub-maker processes that each create and hold part of the zombie population
+
+/// <summary>
+/// Report from one sub-maker, in the shared-memory block that the parent creates.
+/// </summary>
+struct SubMakerReport_t
+{
+	// Nonzero once the sub-maker has finished spawning and its zombies have exited; the other fields are valid only then
+	volatile LONG bDone;
+	DWORD dwPid;
+	LONG nStarted;
+	LONG nFailures;
+	DWORD dwLastError;
+	LONG nLeakedHandles;
+	double dElapsedSeconds;
+	double p50Us, p99Us;
+};
+
+/// <summary>
+/// Starts sub-makers (copies of this executable) that each create part of the zombie population and keep its handles,
+/// collects their reports through a named shared-memory block, and releases them together through a named event.
+/// Spreads process creation across processes and their handle tables, as when many parents each have some zombies.
+/// </summary>
+class TreeSpawner
+{
+public:
+	TreeSpawner() = default;
+	~TreeSpawner();
+
+	/// <summary>
+	/// Creates the shared-memory block and release event, and starts nSubMakers sub-makers that share nTotal zombies.
+	/// </summary>
+	/// <param name="sSubMakerArgs">Input: options for every sub-maker's spawn, e.g., " -p -j"</param>
+	/// <returns>true if every sub-maker was started; false otherwise, with GetLastError() set</returns>
+	bool Start(const std::wstring& sSubMakerArgs, int nTotal, unsigned int nSubMakers);
+
+	/// <summary>
+	/// Waits until every sub-maker has reported or exited, writing progress to the console.
+	/// </summary>
+	/// <returns>Total number of zombies started by all sub-makers</returns>
+	int WaitForSubMakers();
+
+	/// <summary>
+	/// Writes each sub-maker's report and the totals.
+	/// </summary>
+	void WriteReport(std::wostream& os) const;
+
+	/// <summary>
+	/// Signals every sub-maker to release its handles and exit, and waits for them to exit.
+	/// </summary>
+	void Release();
+
+	/// <summary>
+	/// Runs this process as sub-maker ixSubMaker of the parent with process ID dwParentPid: spawns per settings, reports
+	/// through the parent's shared-memory block, and holds its handles until the parent releases it or exits.
+	/// </summary>
+	/// <returns>Process exit code</returns>
+	static int RunSubMaker(const SpawnSettings_t& settings, unsigned int nThreads, unsigned int ixSubMaker, DWORD dwParentPid);
+
+private:
+	HANDLE m_hMapping = nullptr;
+	SubMakerReport_t* m_pReports = nullptr;
+	HANDLE m_hReleaseEvent = nullptr;
+	std::vector<HANDLE> m_subMakers;
+	// Wall time from starting the sub-makers until all of them reported, which includes each sub-maker's wait for its
+	// zombies to exit
+	double m_dElapsedSeconds = 0;
+
+	TreeSpawner(const TreeSpawner&) = delete;
+	TreeSpawner& operator=(const TreeSpawner&) = delete;
+};
@@ -1,4 +1,5 @@
 #include <Windows.h>
+#include <algorithm>
 #include "StringUtils.h"
 #include "Utilities.h"
 
@@ -21,3 +22,73 @@ const std::wstring& ThisExeDirectory()
 	}
 	return sThisExeDirectory;
 }
+
+/// <summary>
+/// Writes the content to a file, creating or replacing it.
+/// </summary>
+/// <param name="sFilePath">Input: path of the file to create or replace</param>
+/// <param name="sContent">Input: bytes to write</param>
+/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+bool WriteTextFile(const std::wstring& sFilePath, const std::string& sContent)
+{
+	HANDLE hFile = CreateFileW(sFilePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == hFile)
+		return false;
+	// WriteFile takes a DWORD length; write large content in chunks.
+	const size_t cbMaxChunk = 0x40000000;
+	size_t ixOffset = 0;
+	bool bSuccess = true;
+	while (bSuccess && ixOffset < sContent.size())
+	{
+		DWORD cbChunk = DWORD((std::min)(cbMaxChunk, sContent.size() - ixOffset));
+		DWORD cbWritten = 0;
+		bSuccess = WriteFile(hFile, sContent.data() + ixOffset, cbChunk, &cbWritten, nullptr) && cbWritten == cbChunk;
+		ixOffset += cbWritten;
+	}
+	DWORD dwLastErr = GetLastError();
+	CloseHandle(hFile);
+	SetLastError(dwLastErr);
+	return bSuccess;
+}
+
+/// <summary>
+/// Enables a privilege, such as SE_LOCK_MEMORY_NAME, in this process's token. Child processes inherit it enabled.
+/// </summary>
+bool EnablePrivilege(const wchar_t* szPrivilege)
+{
+	TOKEN_PRIVILEGES privileges = { 0 };
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	if (!LookupPrivilegeValueW(nullptr, szPrivilege, &privileges.Privileges[0].Luid))
+		return false;
+	HANDLE hToken = nullptr;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &hToken))
+		return false;
+	// AdjustTokenPrivileges succeeds with ERROR_NOT_ALL_ASSIGNED if the token doesn't hold the privilege.
+	bool bSuccess = AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, nullptr, nullptr) && ERROR_SUCCESS == GetLastError();
+	DWORD dwLastErr = GetLastError();
+	CloseHandle(hToken);
+	SetLastError(dwLastErr);
+	return bSuccess;
+}
+
+/// <summary>
+/// Queries the frequency of the high-resolution performance counter.
+/// </summary>
+static LONGLONG QueryFrequency()
+{
+	LARGE_INTEGER li;
+	QueryPerformanceFrequency(&li);
+	return li.QuadPart;
+}
+
+/// <summary>
+/// Returns the frequency of the high-resolution performance counter, in counts per second.
+/// </summary>
+LONGLONG PerfCounterFrequency()
+{
+	// The frequency is fixed at system boot; query it only once. Spawner and worker threads call this concurrently, and
+	// the initialization of a function-local static is thread-safe.
+	static const LONGLONG llFrequency = QueryFrequency();
+	return llFrequency;
+}
@@ -1,9 +1,83 @@
 #pragma once
 
+#include <Windows.h>
+#include <ios>
+#include <ostream>
 #include <string>
 
 
 /// <summary>
 /// Returns the path to the directory in which the current executable image is.
 /// </summary>
-const std::wstring& ThisExeDirectory();
\ No newline at end of file
+const std::wstring& ThisExeDirectory();
+
+/// <summary>
+/// Writes the content to a file, creating or replacing it.
+/// </summary>
+/// <param name="sFilePath">Input: path of the file to create or replace</param>
+/// <param name="sContent">Input: bytes to write</param>
+/// <returns>true if successful; false otherwise, with GetLastError() set</returns>
+bool WriteTextFile(const std::wstring& sFilePath, const std::string& sContent);
+
+/// <summary>
+/// Enables a privilege, such as SE_LOCK_MEMORY_NAME, in this process's token. Child processes inherit it enabled.
+/// </summary>
+/// <param name="szPrivilege">Input: privilege name</param>
+/// <returns>true if successful; false otherwise (including if the token doesn't hold the privilege), with GetLastError() set</returns>
+bool EnablePrivilege(const wchar_t* szPrivilege);
+
+// ------------------------------------------------------------------------------------------
+// High-resolution timing
+
+/// <summary>
+/// Returns the current value of the high-resolution performance counter.
+/// </summary>
+inline LONGLONG PerfCounterNow()
+{
+	LARGE_INTEGER li;
+	QueryPerformanceCounter(&li);
+	return li.QuadPart;
+}
+
+/// <summary>
+/// Returns the frequency of the high-resolution performance counter, in counts per second.
+/// </summary>
+LONGLONG PerfCounterFrequency();
+
+/// <summary>
+/// Converts a performance counter interval to seconds.
+/// </summary>
+inline double PerfCounterToSeconds(LONGLONG llCounts)
+{
+	return double(llCounts) / double(PerfCounterFrequency());
+}
+
+// ------------------------------------------------------------------------------------------
+// Report formatting
+
+/// <summary>
+/// Switches a stream to fixed-point notation with the specified precision, and restores the stream's previous format
+/// flags and precision when it goes out of scope. Reports share std::wcout, so none may leave its format changed.
+/// Precision can be changed again while the guard is in scope.
+/// </summary>
+class FixedFormatGuard
+{
+public:
+	FixedFormatGuard(std::wostream& os, std::streamsize nPrecision)
+		: m_os(os), m_flags(os.flags()), m_nPrecision(os.precision())
+	{
+		m_os.setf(std::ios_base::fixed, std::ios_base::floatfield);
+		m_os.precision(nPrecision);
+	}
+	~FixedFormatGuard()
+	{
+		m_os.flags(m_flags);
+		m_os.precision(m_nPrecision);
+	}
+private:
+	std::wostream& m_os;
+	const std::ios_base::fmtflags m_flags;
+	const std::streamsize m_nPrecision;
+	FixedFormatGuard(const FixedFormatGuard&) = delete;
+	FixedFormatGuard& operator=(const FixedFormatGuard&) = delete;
+};
@@ -0,0 +1,40 @@
+// Work spread across worker threads that claim item indexes from a shared budget in batches
+
+#include <algorithm>
+#include <iostream>
+#include "WorkerThreads.h"
+
+/// <summary>
+/// Sets up a budget of nItems indexes, claimed nBatch at a time.
+/// </summary>
+SharedWorkBudget::SharedWorkBudget(size_t nItems, size_t nBatch)
+	: m_nItems(nItems), m_nBatch((std::max)(nBatch, size_t(1)))
+{
+}
+
+/// <summary>
+/// Claims the next batch of indexes, [ixFirst, ixEnd).
+/// </summary>
+bool SharedWorkBudget::ClaimBatch(size_t& ixFirst, size_t& ixEnd)
+{
+	if (m_bStop)
+		return false;
+	ixFirst = m_nNextIndex.fetch_add(m_nBatch);
+	if (ixFirst >= m_nItems)
+		return false;
+	ixEnd = (std::min)(ixFirst + m_nBatch, m_nItems);
+	return true;
+}
+
+/// <summary>
+/// Counts one completed item, and writes progress every nProgressInterval items.
+/// </summary>
+void SharedWorkBudget::OnCompleted(size_t nProgressInterval)
+{
+	const size_t nCompleted = ++m_nCompleted;
+	if (0 != nProgressInterval && 0 == nCompleted % nProgressInterval)
+	{
+		std::lock_guard<std::mutex> lock(m_mtxConsole);
+		std::wcout << L"Progress: " << nCompleted << L" ...          \r" << std::flush;
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ------------------------------------------------------------------------------------------
+// Work spread across worker threads that claim item indexes from a shared budget in batches
+
+/// <summary>
+/// State shared by the worker threads of one run: the item budget and the next index to claim, the number of items
+/// completed across all workers (for progress output), and a flag that stops every worker after the first failure in any
+/// of them.
+/// </summary>
+class SharedWorkBudget
+{
+public:
+	/// <summary>
+	/// Sets up a budget of nItems indexes, claimed nBatch at a time. Larger batches touch the shared index less often;
+	/// smaller ones spread short runs and slow items more evenly across the workers.
+	/// </summary>
+	SharedWorkBudget(size_t nItems, size_t nBatch);
+
+	/// <summary>
+	/// Claims the next batch of indexes, [ixFirst, ixEnd).
+	/// </summary>
+	/// <returns>true if a batch was claimed; false if all indexes are claimed or a worker has stopped the run</returns>
+	bool ClaimBatch(size_t& ixFirst, size_t& ixEnd);
+
+	/// <summary>
+	/// Stops every worker at its next item.
+	/// </summary>
+	void Stop() { m_bStop = true; }
+
+	bool IsStopped() const { return m_bStop; }
+
+	/// <summary>
+	/// Counts one completed item, and every nProgressInterval items writes the count to the console with CR but no LF, so
+	/// that each progress line overwrites the previous one.
+	/// </summary>
+	void OnCompleted(size_t nProgressInterval);
+
+	/// <summary>
+	/// Serializes console output from the workers.
+	/// </summary>
+	std::mutex& ConsoleMutex() { return m_mtxConsole; }
+
+	SharedWorkBudget(const SharedWorkBudget&) = delete;
+	SharedWorkBudget& operator=(const SharedWorkBudget&) = delete;
+
+private:
+	const size_t m_nItems;
+	const size_t m_nBatch;
+	std::atomic<size_t> m_nNextIndex{ 0 };
+	std::atomic<size_t> m_nCompleted{ 0 };
+	std::atomic<bool> m_bStop{ false };
+	std::mutex m_mtxConsole;
+};
+
+/// <summary>
+/// Body of a worker: claims batches from the budget and calls processItem(ix) for each index in them, until all indexes
+/// are claimed or the run is stopped. processItem returns false to stop the run.
+/// </summary>
+template <typename ProcessItem_t>
+void ProcessClaimedItems(SharedWorkBudget& budget, ProcessItem_t processItem)
+{
+	size_t ixFirst = 0, ixEnd = 0;
+	while (budget.ClaimBatch(ixFirst, ixEnd))
+	{
+		for (size_t ix = ixFirst; ix < ixEnd && !budget.IsStopped(); ++ix)
+		{
+			if (!processItem(ix))
+			{
+				budget.Stop();
+				break;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Calls worker(ixThread) on nThreads threads and returns when all of them have returned. The calling thread is worker 0;
+/// the others are started first. With nThreads == 1, no threads are started.
+/// </summary>
+template <typename Worker_t>
+void RunWorkerThreads(unsigned int nThreads, Worker_t worker)
+{
+	std::vector<std::thread> threads;
+	threads.reserve(nThreads);
+	for (unsigned int ixThread = 1; ixThread < nThreads; ++ixThread)
+	{
+		threads.emplace_back(worker, ixThread);
+	}
+	worker(0u);
+	for (std::thread& t : threads)
+	{
+		t.join();
+	}
+}
@@ -8,8 +8,28 @@
 #include "StringUtils.h"
 #include "Utilities.h"
 #include "SysErrorMessage.h"
-
-//TODO: Test getting a single zombie process or thread handle and then duplicating it thousands of times
+#include "ZombieSpawner.h"
+#include "HandleDuplicator.h"
+#include "LatencyStats.h"
+#include "KernelMemory.h"
+#include "RateScheduler.h"
+#include "ChildReleaseBarrier.h"
+#include "ExitTracker.h"
+#include "SoakRunner.h"
+#include "LimitProber.h"
+#include "EventTracer.h"
+#include "ThreadLeaker.h"
+#include "SpawnBenchmark.h"
+#include "TreeSpawner.h"
+#include "LiveStats.h"
+#include "ZombieScanner.h"
+#include "HandleReleaser.h"
+#include "ChildAccounting.h"
+#include "ScenarioRunner.h"
+#include "SpawnCost.h"
+#include "ObjectLeaker.h"
+#include "HandleHolder.h"
+#include "ProcessorPlacement.h"
 
 void Syntax(const wchar_t* argv0)
 {
@@ -18,18 +38,127 @@ void Syntax(const wchar_t* argv0)
 		<< L"Syntax:" << std::endl
 		<< std::endl
 		<< L"  To create zombie processes:" << std::endl
-		<< L"    " << sExe << L" [-n:count] [-p] [-t] [-m:milliseconds] [-j]" << std::endl
+		<< L"    " << sExe << L" [-n:count] [-p] [-t] [-m:milliseconds | -r:rate [-ramp:profile | -arrival:model] | -arrival:replay:file] [-j] [-P:threads] [-spawn:strategy] [-child:min] [-exit:now | -exit:park] [-mem:MB[:large]] [-track] [-json:file] [-close:strategy] [-harvest[:threads]]" << std::endl
 		<< std::endl
 		<< L"  To leak threads in this process:" << std::endl
-		<< L"    " << sExe << L" [-n:count] [-T | -TZ]" << std::endl
+		<< L"    " << sExe << L" [-n:count] [-T | -TZ] [-s:stack_bytes] [-r:rate [-ramp:profile | -arrival:model] | -arrival:replay:file] [-P:threads] [-json:file] [-close:strategy]" << std::endl
+		<< std::endl
+		<< L"  To create zombie processes from sub-maker processes that each hold part of the population:" << std::endl
+		<< L"    " << sExe << L" -tree:submakers [-n:count] [-p] [-t] [-m:milliseconds] [-j] [-P:threads] [-spawn:strategy] [-child:min] [-exit:now] [-mem:MB[:large]]" << std::endl
+		<< std::endl
+		<< L"  To hold a steady zombie population that churns continuously:" << std::endl
+		<< L"    " << sExe << L" -soak:seconds [-interval:seconds] [-settle:seconds] [-n:count] [-p] [-t] [-r:rate [-ramp:profile | -arrival:model] | -arrival:replay:file] [-j] [-child:min] [-exit:now] [-mem:MB[:large]]" << std::endl
+		<< std::endl
+		<< L"  To find the largest zombie population the system sustains:" << std::endl
+		<< L"    " << sExe << L" -probe[:max] [-j] [-child:min] [-exit:now] [-mem:MB[:large]] [-TZ [-s:stack_bytes]]" << std::endl
+		<< std::endl
+		<< L"  To compare spawn rate and kernel memory per zombie for the full and minimal child images:" << std::endl
+		<< L"    " << sExe << L" -childbench [-n:count] [-p] [-t] [-m:milliseconds] [-j] [-P:threads] [-spawn:strategy] [-exit:now] [-mem:MB[:large]]" << std::endl
+		<< std::endl
+		<< L"  To compare spawn rate and kernel memory per zombie for each spawn strategy (implies -j):" << std::endl
+		<< L"    " << sExe << L" -spawnbench [-n:count] [-p] [-t] [-m:milliseconds] [-P:threads] [-child:min] [-exit:now] [-mem:MB[:large]]" << std::endl
+		<< std::endl
+		<< L"  To measure how spawn cost grows with inherited handles, environment size, and command-line size:" << std::endl
+		<< L"    " << sExe << L" -costbench [-n:count] [-p] [-t] [-m:milliseconds] [-j] [-P:threads] [-spawn:strategy] [-child:min] [-exit:now] [-mem:MB[:large]]" << std::endl
+		<< std::endl
+		<< L"  To measure zombie scan time as the zombie population grows:" << std::endl
+		<< L"    " << sExe << L" -scancurve:points [-n:count] [-p] [-t] [-m:milliseconds] [-j] [-P:threads] [-spawn:strategy] [-child:min] [-exit:now] [-mem:MB[:large]] [-close:strategy] [-harvest[:threads]]" << std::endl
+		<< std::endl
+		<< L"  To run a file of spawn, hold, and release phases back to back on one set of leaked handles:" << std::endl
+		<< L"    " << sExe << L" -scenario:file [-p] [-t] [-m:milliseconds] [-j] [-P:threads] [-spawn:strategy] [-child:min] [-exit:now] [-mem:MB[:large]] [-s:stack_bytes] [-close:strategy]" << std::endl
+		<< std::endl
+		<< L"  To find zombie processes system-wide and the processes holding them:" << std::endl
+		<< L"    " << sExe << L" -scan[:threads]" << std::endl
+		<< std::endl
+		<< L"  To duplicate one zombie process or thread handle many times:" << std::endl
+		<< L"    " << sExe << L" -D [-n:count] [-j] [-child:min] [-exit:now] [-mem:MB[:large]] [-T | -TZ [-s:stack_bytes]] [-close:strategy]" << std::endl
+		<< std::endl
+		<< L"  To leak [count] kernel objects of each of other types, and compare their creation rate and kernel memory cost:" << std::endl
+		<< L"    " << sExe << L" -objects:types [-n:count] [-P:threads] [-close:strategy]" << std::endl
+		<< std::endl
+		<< L"  To hold handed-off handles in a long-lived holder process, until it is told to release them or quit:" << std::endl
+		<< L"    " << sExe << L" -holder[:name] [-close:strategy]" << std::endl
+		<< std::endl
+		<< L"  To tell a holder to release its handles, report its counts, or release and exit:" << std::endl
+		<< L"    " << sExe << L" -holderctl:release|stats|quit[:name]" << std::endl
+		<< std::endl
+		<< L"  Any of the above that create processes can add -inherit:handles, -env:chars, and -cmdline:chars." << std::endl
+		<< L"  Zombie processes, -D, and -objects can add -handoff[:name] to hand their handles to a holder and exit." << std::endl
+		<< L"  Any of the above that create processes can add -pin:placement and -childpin[:placement]." << std::endl
+		<< L"  Any of the above can add -trace:file and -stats. To convert a trace file to CSV:" << std::endl
+		<< L"    " << sExe << L" -trace2csv:file" << std::endl
+		<< std::endl
+		<< L"  To watch the statistics page of a ZombieMaker started with -stats:" << std::endl
+		<< L"    " << sExe << L" -watch:pid" << std::endl
 		<< std::endl
 		<< L"  -n  : specify number of processes or threads to start (default 10)" << std::endl
 		<< L"  -p  : don't leak process handles" << std::endl
 		<< L"  -t  : don't leak thread handles returned by CreateProcess" << std::endl
 		<< L"  -m  : wait specified number of milliseconds between each CreateProcess (default 0)" << std::endl
+		<< L"  -r  : start processes or threads at the specified rate per second, on a fixed schedule (fractions allowed)" << std::endl
+		<< L"  -ramp : ramp up to the -r rate: -ramp:linear:seconds or -ramp:step:seconds:steps" << std::endl
+		<< L"  -arrival : when each spawn is due, instead of evenly spaced at the -r rate:" << std::endl
+		<< L"             poisson[:seed]              : exponentially distributed gaps with a mean of 1/rate (default seed 1)" << std::endl
+		<< L"             onoff:on_sec:off_sec[:seed] : Poisson at the -r rate for on_sec, then nothing for off_sec, repeatedly" << std::endl
+		<< L"             replay:file                 : the timestamps in file (seconds, one per line, ascending), repeated as needed;" << std::endl
+		<< L"                                           replaces -r" << std::endl
 		<< L"  -j  : assign processes to an unnamed job object" << std::endl
+		<< L"  -spawn : how to create each process (default createprocess):" << std::endl
+		<< L"           createprocess : CreateProcessW, then assign to the job" << std::endl
+		<< L"           suspended     : CreateProcessW suspended; each spawner thread resumes its processes in batches of 64" << std::endl
+		<< L"           jobattr       : CreateProcessW with a job-list attribute, so the process starts in the job (implies -j)" << std::endl
+		<< L"  -child:min : start the minimal child image ZombieProcMin (no C runtime) instead of ZombieProc" << std::endl
+		<< L"  -exit:now  : child processes exit immediately instead of after two seconds" << std::endl
+		<< L"  -mem   : each child process commits and touches the specified number of MB before exiting or parking;" << std::endl
+		<< L"           -mem:MB:large uses large pages (needs the Lock Pages in Memory privilege)" << std::endl
+		<< L"  -exit:park : child processes wait until all have started, then are released to exit at the same moment" << std::endl
+		<< L"  -track : track every child's exit through the job object (implies -j) and report the exit timeline" << std::endl
+		<< L"  -P  : start processes or threads from the specified number of spawner threads sharing the count (default 1; not with -soak, -probe, or -D)" << std::endl
 		<< L"  -T  : create [count] threads that hang and do not exit within this process and leak those handles" << std::endl
 		<< L"  -TZ : create [count] zombie threads within this process and leak those handles" << std::endl
+		<< L"  -s  : with -T/-TZ, reserve only the specified number of bytes for each thread's stack (rounded up to 64 KB)" << std::endl
+		<< L"  -D  : create one zombie process (or thread, with -T/-TZ) and duplicate its handle [count] times" << std::endl
+		<< L"  -tree : start the specified number of sub-makers (copies of this program) that share [count] and each keep their handles" << std::endl
+		<< L"  -soak : keep [count] zombie processes, replacing the oldest one continuously for the specified seconds (0: until a key is pressed)" << std::endl
+		<< L"  -interval : with -soak, seconds between churn and drift reports (default 10)" << std::endl
+		<< L"  -settle : with -soak, seconds to wait after building the population before taking the memory baseline (default 3)" << std::endl
+		<< L"  -probe : create zombie processes (or threads, with -TZ) until creation fails, then back off and binary-search" << std::endl
+		<< L"           for the sustainable maximum, optionally bounded by max" << std::endl
+		<< L"  -childbench : run the process spawn with each child image in turn, and compare spawns/sec and kernel memory per zombie" << std::endl
+		<< L"  -spawnbench : run the process spawn with each spawn strategy in turn, and compare spawns/sec and kernel memory per zombie" << std::endl
+		<< L"  -costbench : run the process spawn at several inherited handle counts, environment sizes, and command-line sizes," << std::endl
+		<< L"               and compare spawns/sec, latency early and late in the population, and kernel memory per zombie" << std::endl
+		<< L"  -scancurve : start [count] processes in the specified number of steps, and scan for zombies after each step" << std::endl
+		<< L"  -scenario : run the phases in file, write each phase's metrics to the console and to file.csv, then release" << std::endl
+		<< L"              the handles still held with -close's strategy, without waiting for a key" << std::endl
+		<< L"  -scan : scan for zombie processes with the specified number of threads (default: one per logical processor), then exit" << std::endl
+		<< L"  -close : how to release the handles at the end of the run, and report teardown time and memory reclaim:" << std::endl
+		<< L"           serial             : close each handle in turn (the default)" << std::endl
+		<< L"           parallel[:threads] : close from several threads (default: one per logical processor)" << std::endl
+		<< L"           batch[:size:ms]    : close in batches of size handles, pausing ms after each (default 1000 and 100)" << std::endl
+		<< L"           job                : close the job first (requires -j); with -exit:park, the parked children are killed" << std::endl
+		<< L"  -harvest : before releasing the handles, collect each child's lifetime, CPU time and exit code, and the job's" << std::endl
+		<< L"             accounting, with the specified number of threads (default: one per logical processor)" << std::endl
+		<< L"  -inherit : create the specified number of inheritable handles, and pass them to every child in an explicit handle list" << std::endl
+		<< L"  -env : add the specified number of characters to every child's environment" << std::endl
+		<< L"  -cmdline : add an ignored argument of the specified number of characters (up to 30000) to every child's command line" << std::endl
+		<< L"  -objects : comma-separated list of event, mutex, semaphore, section, timer, and file, or all" << std::endl
+		<< L"  -holder : serve handoffs on the pipe \\\\.\\pipe\\ZombieMaker-Holder-name (default name: default), one maker at a time," << std::endl
+		<< L"            and close the handles with -close's strategy on release or quit" << std::endl
+		<< L"  -handoff : instead of waiting for a key, duplicate every leaked handle into the holder in batches of up to 8192," << std::endl
+		<< L"             closing it here, report the transfer rate, and exit" << std::endl
+		<< L"  -holderctl : send release, stats, or quit to the holder, and print its handle counts and release time" << std::endl
+		<< L"  -pin : run each spawner thread on one entry of the placement, in turn, and report spawns/sec per thread and NUMA node:" << std::endl
+		<< L"         cpu | node           : every logical processor, or every NUMA node with processors" << std::endl
+		<< L"         cpu:list | node:list : the comma-separated logical processors (numbered across groups) or nodes" << std::endl
+		<< L"  -childpin : start each spawner thread's children on the same processors as the thread (requires -pin), or on one" << std::endl
+		<< L"              entry of the specified placement, in turn, with a group affinity and preferred node attribute" << std::endl
+		<< L"  -json : write the latency of every process or thread creation, by population, to a JSON file" << std::endl
+		<< L"  -trace : record spawn, exit, duplicate and release events in memory and write them to a binary trace file at the end" << std::endl
+		<< L"  -trace2csv : convert a binary trace file to file.csv, then exit" << std::endl
+		<< L"  -stats : publish live counters (target, spawned, failures by error, leaked handles, spawn rate, phase) in the" << std::endl
+		<< L"           shared-memory page Local\\ZombieMaker-<pid>-Stats, updated ten times per second" << std::endl
+		<< L"  -watch : print the statistics page of the ZombieMaker with the specified process ID once per second" << std::endl
 		<< std::endl;
 	exit(-1);
 }
@@ -53,14 +182,189 @@ DWORD WINAPI HungThread(LPVOID)
 	return 0;
 }
 
+/// <summary>
+/// Returns the full path to a child executable, which should be in the same directory as this executable:
+/// szBaseName.exe for 64-bit, or szBaseName32.exe for 32-bit.
+/// </summary>
+/// <param name="szBaseName">Input: ZombieProc, or ZombieProcMin for the minimal child image</param>
+static std::wstring ChildImagePath(const wchar_t* szBaseName)
+{
+	// 64-bit child process name
+	const wchar_t* szSuffix = L".exe";
+#pragma warning(push)
+#pragma warning(disable:4127) // "conditional expression is constant"
+	if (4 == sizeof(void*))
+#pragma warning(pop)
+	{
+		// 32-bit child process name
+		szSuffix = L"32.exe";
+	}
+	return ThisExeDirectory() + L"\\" + szBaseName + szSuffix;
+}
+
+/// <summary>
+/// Writes the spawn latency curve to the JSON file specified with -json, if any.
+/// </summary>
+static void WriteLatencyJsonIfRequested(const SpawnLatencyRecorder& latency, const std::wstring& sJsonFile, const char* szMode, unsigned int nSpawnerThreads, int nStarted, double dSeconds)
+{
+	if (sJsonFile.empty())
+		return;
+	if (latency.WriteJson(sJsonFile, szMode, nSpawnerThreads, nStarted, dSeconds))
+	{
+		std::wcout << L"Latency report written to " << sJsonFile << std::endl << std::endl;
+	}
+	else
+	{
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot write " << sJsonFile << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+	}
+}
+
+/// <summary>
+/// Writes the in-memory event trace to the -trace file when it goes out of scope, so that every mode's exit path is covered.
+/// </summary>
+class TraceFileWriter
+{
+public:
+	explicit TraceFileWriter(const std::wstring& sTraceFile) : m_sTraceFile(sTraceFile) {}
+	~TraceFileWriter()
+	{
+		if (m_sTraceFile.empty())
+			return;
+		if (WriteTraceFile(m_sTraceFile))
+		{
+			std::wcout << L"Event trace written to " << m_sTraceFile << std::endl;
+		}
+		else
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"Cannot write " << m_sTraceFile << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		}
+	}
+private:
+	std::wstring m_sTraceFile;
+};
+
+/// <summary>
+/// Writes how closely spawns followed the -r rate schedule or -arrival model, if there was one.
+/// </summary>
+static void WriteScheduleReport(const RateScheduler& scheduler, const RateSchedule_t& rateSchedule)
+{
+	if (!scheduler.IsPaced())
+		return;
+	std::wcout
+		<< (ArrivalModel_t::Replay == rateSchedule.arrival ? L"Trace mean rate:   " : L"Target rate:       ") << rateSchedule.dSpawnsPerSec << L"/sec" << std::endl
+		<< L"Max schedule lag:  " << scheduler.MaxLagSeconds() * 1000.0 << L" ms" << std::endl
+		<< L"Tokens dropped:    " << scheduler.TokensDropped() << std::endl;
+	scheduler.WriteArrivalReport(std::wcout);
+	std::wcout << std::endl;
+}
+
+/// <summary>
+/// Waits for every leaked process or thread handle to be signaled, so that the zombies all exist before kernel memory is measured.
+/// </summary>
+static void WaitForZombies(const std::vector<HANDLE>& leakedHandles)
+{
+	if (leakedHandles.empty())
+		return;
+	std::wcout << L"Waiting for " << leakedHandles.size() << L" handles to be signaled..." << std::endl;
+	for (HANDLE h : leakedHandles)
+	{
+		WaitForSingleObject(h, INFINITE);
+	}
+}
+
+/// <summary>
+/// Supports -exit:park: waits until all children are parked, releases them at once, and reports how long it takes until
+/// every child has exited and become a zombie.
+/// </summary>
+static void ReleaseParkedChildren(ChildReleaseBarrier& barrier, int nChildren, const std::vector<HANDLE>& leakedHandles)
+{
+	// Give up on children that haven't parked if none reports for this long.
+	const DWORD dwParkTimeoutMs = 30000;
+	std::wcout << L"Waiting for " << nChildren << L" children to park..." << std::endl;
+	int nParked = barrier.WaitUntilParked(nChildren, dwParkTimeoutMs);
+	if (nParked < nChildren)
+	{
+		std::wcout << L"Only " << nParked << L" of " << nChildren << L" children parked; releasing anyway." << std::endl;
+	}
+
+	const LONGLONG llRelease = PerfCounterNow();
+	if (!barrier.Release())
+	{
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot release children: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		return;
+	}
+	if (leakedHandles.empty())
+	{
+		std::wcout << L"Children released; no leaked handles to measure their exit with." << std::endl << std::endl;
+		return;
+	}
+	// Every process or thread handle is signaled when its child exits; the last one marks the end of the burst.
+	for (HANDLE h : leakedHandles)
+	{
+		WaitForSingleObject(h, INFINITE);
+	}
+	const double dSeconds = PerfCounterToSeconds(PerfCounterNow() - llRelease);
+	FixedFormatGuard format(std::wcout, 1);
+	std::wcout
+		<< L"Children released: " << nParked << std::endl
+		<< L"Release to all zombies: " << dSeconds * 1000.0 << L" ms" << std::endl
+		<< L"Teardowns/sec:     " << (dSeconds > 0 ? nChildren / dSeconds : 0) << std::endl
+		<< std::endl;
+}
+
 // Program that creates zombie process and thread objects for demonstration/testing purposes.
 int wmain(int argc, wchar_t** argv)
 {
 	int numProcessesOrThreads = 10;
 	DWORD dwMilliseconds = 0;
+	unsigned int nSpawnerThreads = 1;
 	bool bLeakProcessHandles = true, bLeakThreadHandles = true;
 	bool bAssignToJob = false;
 	bool bLeakThreadsInThisProcess = false, bZombieThreadsInThisProcess = false;
+	bool bDuplicateOneHandle = false;
+	SIZE_T cbStackReserve = 0;
+	std::wstring sJsonFile;
+	RateSchedule_t rateSchedule;
+	bool bChildExitNow = false, bChildPark = false;
+	bool bTrackExits = false;
+	bool bSoak = false;
+	SoakSettings_t soakSettings;
+	bool bProbe = false;
+	int nProbeMax = 0;
+	std::wstring sTraceFile, sTraceFileToConvert;
+	bool bMinimalChild = false, bChildImageBench = false;
+	SpawnStrategy_t spawnStrategy = SpawnStrategy_t::CreateProcess;
+	bool bSpawnStrategyBench = false;
+	unsigned int nTreeSubMakers = 0;
+	// Set when this process is a sub-maker started by -tree: its index and its parent's process ID
+	bool bSubMaker = false;
+	unsigned int ixSubMaker = 0;
+	DWORD dwTreeParentPid = 0;
+	bool bLiveStats = false;
+	DWORD dwWatchPid = 0;
+	bool bScan = false;
+	unsigned int nScanWorkers = 0, nScanCurvePoints = 0;
+	unsigned int nChildTouchMB = 0;
+	bool bChildLargePages = false;
+	bool bCloseStrategy = false;
+	ReleaseSettings_t releaseSettings;
+	bool bHarvest = false;
+	std::wstring sScenarioFile;
+	bool bCostBench = false;
+	std::vector<LeakObjectType_t> leakObjectTypes;
+	size_t nInheritHandles = 0, cchEnvironmentPad = 0, cchCommandLinePad = 0;
+	unsigned int nHarvestThreads = 0;
+	// -holder, -holderctl and -handoff all name the holder; only one of them is used per run
+	bool bHolder = false, bHolderControl = false, bHandoff = false;
+	HolderCommand_t holderCommand = HolderCommand_t::Stats;
+	std::wstring sHolderName = L"default";
+	// -pin and -childpin; -childpin without a spec places children with their spawner threads
+	bool bPinSpawners = false, bPinChildren = false, bChildPlacementSpec = false;
+	PlacementSpec_t spawnerPlacementSpec, childPlacementSpec;
+	std::wstring sArrivalTraceFile;
 
 	for (int ixCurrArg = 1; ixCurrArg < argc; ++ixCurrArg)
 	{
@@ -78,30 +382,553 @@ int wmain(int argc, wchar_t** argv)
 				Syntax(argv[0]);
 			break;
 		case L'p':
-			bLeakProcessHandles = false;
+			if (StartsWith(szCurrArg, L"-pin:", true))
+			{
+				if (!ParsePlacementSpec(&szCurrArg[5], spawnerPlacementSpec))
+					Syntax(argv[0]);
+				bPinSpawners = true;
+			}
+			else if (StartsWith(szCurrArg, L"-probe", true))
+			{
+				bProbe = true;
+				if (L':' == szCurrArg[6])
+				{
+					if (1 != swscanf_s(&szCurrArg[7], L"%d", &nProbeMax) || nProbeMax <= 0)
+						Syntax(argv[0]);
+				}
+				else if (L'\0' != szCurrArg[6])
+				{
+					Syntax(argv[0]);
+				}
+			}
+			else if (L'\0' == szCurrArg[2])
+			{
+				bLeakProcessHandles = false;
+			}
+			else
+			{
+				Syntax(argv[0]);
+			}
 			break;
 		case L't':
-			bLeakThreadHandles = false;
+			if (0 == wcscmp(szCurrArg, L"-track"))
+			{
+				bTrackExits = true;
+				bAssignToJob = true;
+			}
+			else if (StartsWith(szCurrArg, L"-tree:", true))
+			{
+				if (1 != swscanf_s(&szCurrArg[6], L"%u", &nTreeSubMakers) || 0 == nTreeSubMakers)
+					Syntax(argv[0]);
+			}
+			else if (StartsWith(szCurrArg, L"-trace:", true))
+			{
+				sTraceFile = &szCurrArg[7];
+				if (sTraceFile.empty())
+					Syntax(argv[0]);
+			}
+			else if (StartsWith(szCurrArg, L"-trace2csv:", true))
+			{
+				sTraceFileToConvert = &szCurrArg[11];
+				if (sTraceFileToConvert.empty())
+					Syntax(argv[0]);
+			}
+			else if (L'\0' == szCurrArg[2])
+			{
+				bLeakThreadHandles = false;
+			}
+			else
+			{
+				Syntax(argv[0]);
+			}
 			break;
 		case L'm':
-			if (1 != swscanf_s(&szCurrArg[3], L"%u", &dwMilliseconds))
+			if (StartsWith(szCurrArg, L"-mem:", true))
+			{
+				wchar_t szLarge[8] = { 0 };
+				const int nFields = swscanf_s(&szCurrArg[5], L"%u:%7s", &nChildTouchMB, szLarge, unsigned(sizeof(szLarge) / sizeof(szLarge[0])));
+				if (nFields < 1 || 0 == nChildTouchMB)
+					Syntax(argv[0]);
+				if (2 == nFields)
+				{
+					if (0 != wcscmp(szLarge, L"large"))
+						Syntax(argv[0]);
+					bChildLargePages = true;
+				}
+			}
+			else if (1 != swscanf_s(&szCurrArg[3], L"%u", &dwMilliseconds))
+			{
+				Syntax(argv[0]);
+			}
+			break;
+		case L'c':
+			if (0 == wcscmp(szCurrArg, L"-child:min"))
+				bMinimalChild = true;
+			else if (0 == wcscmp(szCurrArg, L"-child:full"))
+				bMinimalChild = false;
+			else if (0 == wcscmp(szCurrArg, L"-childbench"))
+				bChildImageBench = true;
+			else if (0 == wcscmp(szCurrArg, L"-childpin"))
+				bPinChildren = true;
+			else if (StartsWith(szCurrArg, L"-childpin:", true))
+			{
+				if (!ParsePlacementSpec(&szCurrArg[10], childPlacementSpec))
+					Syntax(argv[0]);
+				bPinChildren = bChildPlacementSpec = true;
+			}
+			else if (0 == wcscmp(szCurrArg, L"-costbench"))
+				bCostBench = true;
+			else if (StartsWith(szCurrArg, L"-cmdline:", true))
+			{
+				if (1 != swscanf_s(&szCurrArg[9], L"%zu", &cchCommandLinePad) || 0 == cchCommandLinePad || cchCommandLinePad > MaxCommandLinePad)
+					Syntax(argv[0]);
+			}
+			else if (StartsWith(szCurrArg, L"-close:", true))
+			{
+				if (!ParseReleaseStrategy(&szCurrArg[7], releaseSettings))
+					Syntax(argv[0]);
+				bCloseStrategy = true;
+			}
+			else
+				Syntax(argv[0]);
+			break;
+		case L'e':
+			if (0 == wcscmp(szCurrArg, L"-exit:now"))
+				bChildExitNow = true;
+			else if (0 == wcscmp(szCurrArg, L"-exit:park"))
+				bChildPark = true;
+			else if (StartsWith(szCurrArg, L"-env:", true))
+			{
+				if (1 != swscanf_s(&szCurrArg[5], L"%zu", &cchEnvironmentPad) || 0 == cchEnvironmentPad || cchEnvironmentPad > MaxEnvironmentPad)
+					Syntax(argv[0]);
+			}
+			else
 				Syntax(argv[0]);
 			break;
 		case L'j':
-			bAssignToJob = true;
+			if (StartsWith(szCurrArg, L"-json:", true))
+			{
+				sJsonFile = &szCurrArg[6];
+				if (sJsonFile.empty())
+					Syntax(argv[0]);
+			}
+			else
+			{
+				bAssignToJob = true;
+			}
+			break;
+		case L'a':
+			if (!StartsWith(szCurrArg, L"-arrival:", true) || !ParseArrivalModel(&szCurrArg[9], rateSchedule, sArrivalTraceFile))
+				Syntax(argv[0]);
+			break;
+		case L'r':
+			if (StartsWith(szCurrArg, L"-ramp:", true))
+			{
+				double dRampSeconds = 0;
+				unsigned int nSteps = 0;
+				if (1 == swscanf_s(&szCurrArg[6], L"linear:%lf", &dRampSeconds))
+				{
+					rateSchedule.ramp = RampProfile_t::Linear;
+				}
+				else if (2 == swscanf_s(&szCurrArg[6], L"step:%lf:%u", &dRampSeconds, &nSteps) && nSteps > 0)
+				{
+					rateSchedule.ramp = RampProfile_t::Step;
+					rateSchedule.nSteps = nSteps;
+				}
+				else
+				{
+					Syntax(argv[0]);
+				}
+				if (dRampSeconds <= 0)
+					Syntax(argv[0]);
+				rateSchedule.dRampSeconds = dRampSeconds;
+			}
+			else
+			{
+				if (L':' != szCurrArg[2])
+					Syntax(argv[0]);
+				if (1 != swscanf_s(&szCurrArg[3], L"%lf", &rateSchedule.dSpawnsPerSec))
+					Syntax(argv[0]);
+				if (rateSchedule.dSpawnsPerSec <= 0)
+					Syntax(argv[0]);
+			}
+			break;
+		case L's':
+			if (StartsWith(szCurrArg, L"-soak:", true))
+			{
+				if (1 != swscanf_s(&szCurrArg[6], L"%lf", &soakSettings.dDurationSeconds))
+					Syntax(argv[0]);
+				if (soakSettings.dDurationSeconds < 0)
+					Syntax(argv[0]);
+				bSoak = true;
+			}
+			else if (StartsWith(szCurrArg, L"-spawn:", true))
+			{
+				if (!ParseSpawnStrategy(&szCurrArg[7], spawnStrategy))
+					Syntax(argv[0]);
+				// The process is placed in a job as it's created.
+				if (SpawnStrategy_t::JobAttribute == spawnStrategy)
+					bAssignToJob = true;
+			}
+			else if (StartsWith(szCurrArg, L"-submaker:", true))
+			{
+				// Internal option that -tree passes to its sub-makers
+				if (2 != swscanf_s(&szCurrArg[10], L"%u:%u", &ixSubMaker, &dwTreeParentPid))
+					Syntax(argv[0]);
+				bSubMaker = true;
+			}
+			else if (StartsWith(szCurrArg, L"-scancurve:", true))
+			{
+				if (1 != swscanf_s(&szCurrArg[11], L"%u", &nScanCurvePoints) || 0 == nScanCurvePoints)
+					Syntax(argv[0]);
+			}
+			else if (StartsWith(szCurrArg, L"-scenario:", true))
+			{
+				sScenarioFile = &szCurrArg[10];
+				if (sScenarioFile.empty())
+					Syntax(argv[0]);
+			}
+			else if (StartsWith(szCurrArg, L"-scan", true))
+			{
+				bScan = true;
+				if (L':' == szCurrArg[5])
+				{
+					if (1 != swscanf_s(&szCurrArg[6], L"%u", &nScanWorkers) || 0 == nScanWorkers)
+						Syntax(argv[0]);
+				}
+				else if (L'\0' != szCurrArg[5])
+				{
+					Syntax(argv[0]);
+				}
+			}
+			else if (StartsWith(szCurrArg, L"-settle:", true))
+			{
+				if (1 != swscanf_s(&szCurrArg[8], L"%lf", &soakSettings.dSettleSeconds))
+					Syntax(argv[0]);
+				if (soakSettings.dSettleSeconds < 0)
+					Syntax(argv[0]);
+			}
+			else if (0 == wcscmp(szCurrArg, L"-spawnbench"))
+			{
+				bSpawnStrategyBench = true;
+				bAssignToJob = true;
+			}
+			else if (0 == wcscmp(szCurrArg, L"-stats"))
+			{
+				bLiveStats = true;
+			}
+			else if (L':' == szCurrArg[2])
+			{
+				unsigned long long ullStackReserve = 0;
+				if (1 != swscanf_s(&szCurrArg[3], L"%llu", &ullStackReserve) || 0 == ullStackReserve)
+					Syntax(argv[0]);
+				cbStackReserve = SIZE_T(ullStackReserve);
+			}
+			else
+			{
+				Syntax(argv[0]);
+			}
+			break;
+		case L'o':
+			if (!StartsWith(szCurrArg, L"-objects:", true) || !ParseLeakObjectTypes(&szCurrArg[9], leakObjectTypes))
+				Syntax(argv[0]);
+			break;
+		case L'h':
+			if (StartsWith(szCurrArg, L"-holderctl:", true))
+			{
+				// -holderctl:command[:name]
+				std::wstring sCommand = &szCurrArg[11];
+				const size_t ixColon = sCommand.find(L':');
+				if (std::wstring::npos != ixColon)
+				{
+					sHolderName = sCommand.substr(ixColon + 1);
+					sCommand.resize(ixColon);
+				}
+				if (!ParseHolderCommand(sCommand.c_str(), holderCommand) || sHolderName.empty())
+					Syntax(argv[0]);
+				bHolderControl = true;
+			}
+			else if (0 == wcscmp(szCurrArg, L"-holder"))
+			{
+				bHolder = true;
+			}
+			else if (StartsWith(szCurrArg, L"-holder:", true))
+			{
+				sHolderName = &szCurrArg[8];
+				if (sHolderName.empty())
+					Syntax(argv[0]);
+				bHolder = true;
+			}
+			else if (0 == wcscmp(szCurrArg, L"-handoff"))
+			{
+				bHandoff = true;
+			}
+			else if (StartsWith(szCurrArg, L"-handoff:", true))
+			{
+				sHolderName = &szCurrArg[9];
+				if (sHolderName.empty())
+					Syntax(argv[0]);
+				bHandoff = true;
+			}
+			else if (0 == wcscmp(szCurrArg, L"-harvest"))
+				bHarvest = true;
+			else if (1 == swscanf_s(szCurrArg, L"-harvest:%u", &nHarvestThreads) && 0 != nHarvestThreads)
+				bHarvest = true;
+			else
+				Syntax(argv[0]);
+			break;
+		case L'i':
+			if (StartsWith(szCurrArg, L"-inherit:", true))
+			{
+				if (1 != swscanf_s(&szCurrArg[9], L"%zu", &nInheritHandles) || 0 == nInheritHandles)
+					Syntax(argv[0]);
+				break;
+			}
+			if (!StartsWith(szCurrArg, L"-interval:", true))
+				Syntax(argv[0]);
+			if (1 != swscanf_s(&szCurrArg[10], L"%lf", &soakSettings.dIntervalSeconds))
+				Syntax(argv[0]);
+			if (soakSettings.dIntervalSeconds <= 0)
+				Syntax(argv[0]);
+			break;
+		case L'P':
+			if (L':' != szCurrArg[2])
+				Syntax(argv[0]);
+			if (1 != swscanf_s(&szCurrArg[3], L"%u", &nSpawnerThreads))
+				Syntax(argv[0]);
+			if (0 == nSpawnerThreads)
+				Syntax(argv[0]);
 			break;
 		case L'T':
 			bLeakThreadsInThisProcess = true;
 			if (L'Z' == szCurrArg[2])
 				bZombieThreadsInThisProcess = true;
 			break;
+		case L'D':
+			bDuplicateOneHandle = true;
+			break;
+		case L'w':
+			if (!StartsWith(szCurrArg, L"-watch:", true))
+				Syntax(argv[0]);
+			if (1 != swscanf_s(&szCurrArg[7], L"%u", &dwWatchPid) || 0 == dwWatchPid)
+				Syntax(argv[0]);
+			break;
 		default:
 			Syntax(argv[0]);
 		}
 	}
 
+	// The random arrival models need a rate; a replayed trace brings its own.
+	if ((ArrivalModel_t::Poisson == rateSchedule.arrival || ArrivalModel_t::OnOff == rateSchedule.arrival) && 0 == rateSchedule.dSpawnsPerSec)
+		Syntax(argv[0]);
+	if ((ArrivalModel_t::Replay == rateSchedule.arrival && rateSchedule.dSpawnsPerSec > 0) ||
+		(ArrivalModel_t::Fixed != rateSchedule.arrival && RampProfile_t::Constant != rateSchedule.ramp))
+		Syntax(argv[0]);
+	// Read the trace now: from here on, it paces spawns like -r at its mean rate.
+	if (!sArrivalTraceFile.empty())
+	{
+		size_t nErrorLine = 0;
+		if (!LoadArrivalTrace(sArrivalTraceFile, rateSchedule, nErrorLine))
+		{
+			DWORD dwLastErr = GetLastError();
+			if (0 != nErrorLine)
+				std::wcerr << sArrivalTraceFile << L"(" << nErrorLine << L"): invalid or out-of-order timestamp" << std::endl;
+			else
+				std::wcerr << L"Cannot read " << sArrivalTraceFile << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			return -2;
+		}
+	}
+	// -m and -r are alternative ways to pace spawns; a ramp needs a rate to ramp up to.
+	if (0 != dwMilliseconds && rateSchedule.dSpawnsPerSec > 0)
+		Syntax(argv[0]);
+	if (RampProfile_t::Constant != rateSchedule.ramp && 0 == rateSchedule.dSpawnsPerSec)
+		Syntax(argv[0]);
+	if (bChildExitNow && bChildPark)
+		Syntax(argv[0]);
+	// -D starts a single child, so there's no burst to release; it would wait for children that never park. Its
+	// duplications run on one thread.
+	if (bDuplicateOneHandle && (bChildPark || nSpawnerThreads > 1))
+		Syntax(argv[0]);
+	if (0 != cbStackReserve && !bLeakThreadsInThisProcess && sScenarioFile.empty())
+		Syntax(argv[0]);
+	// Hung threads can't be released again, so the prober can't back off from them. It creates one zombie at a time.
+	if (bProbe && (bSoak || bDuplicateOneHandle || bChildPark || bTrackExits || nSpawnerThreads > 1 || (bLeakThreadsInThisProcess && !bZombieThreadsInThisProcess)))
+		Syntax(argv[0]);
+	// Soak replaces processes one at a time from the ring buffer; parked children would never become zombies.
+	if (bSoak && (bLeakThreadsInThisProcess || bDuplicateOneHandle || bChildPark || bTrackExits || 0 != dwMilliseconds || nSpawnerThreads > 1))
+		Syntax(argv[0]);
+	// The benchmarks run their own process spawns, one per child image or spawn strategy, as fast as possible.
+	const bool bBenchmark = bChildImageBench || bSpawnStrategyBench || bCostBench;
+	if (bBenchmark && (bSoak || bProbe || bDuplicateOneHandle || bLeakThreadsInThisProcess || bChildPark || bTrackExits || rateSchedule.dSpawnsPerSec > 0))
+		Syntax(argv[0]);
+	if (int(bChildImageBench) + int(bSpawnStrategyBench) + int(bCostBench) > 1)
+		Syntax(argv[0]);
+	// Only spawned processes inherit handles and get an environment or command line.
+	if ((0 != nInheritHandles || 0 != cchEnvironmentPad || 0 != cchCommandLinePad) && (bLeakThreadsInThisProcess || bDuplicateOneHandle))
+		Syntax(argv[0]);
+	// Leaked objects are held and released like zombies, but they aren't processes, and most aren't waitable.
+	if (!leakObjectTypes.empty() && (bBenchmark || 0 != nTreeSubMakers || bSubMaker || bSoak || bProbe || bDuplicateOneHandle || bLeakThreadsInThisProcess ||
+		bChildPark || bTrackExits || rateSchedule.dSpawnsPerSec > 0 || !sJsonFile.empty() || 0 != nScanCurvePoints || !sScenarioFile.empty() || bHarvest ||
+		0 != nInheritHandles || 0 != cchEnvironmentPad || 0 != cchCommandLinePad || ReleaseStrategy_t::JobClose == releaseSettings.strategy))
+		Syntax(argv[0]);
+	// The cost sweep adds its own command-line padding, up to the limit.
+	if (bCostBench && 0 != cchCommandLinePad)
+		Syntax(argv[0]);
+	// Each sub-maker runs a plain process spawn, and holds its zombies until the parent releases it.
+	if ((0 != nTreeSubMakers || bSubMaker) && (bBenchmark || bSoak || bProbe || bDuplicateOneHandle || bLeakThreadsInThisProcess || bChildPark || bTrackExits ||
+		rateSchedule.dSpawnsPerSec > 0 || !sJsonFile.empty() || !sTraceFile.empty()))
+		Syntax(argv[0]);
+	if (0 != nTreeSubMakers && (bSubMaker || nTreeSubMakers > unsigned(numProcessesOrThreads)))
+		Syntax(argv[0]);
+	// The other modes release their own handles; closing the job needs the job, and parked children can't be tracked
+	// until it kills them.
+	if (bCloseStrategy && (bBenchmark || 0 != nTreeSubMakers || bSubMaker || bSoak || bProbe))
+		Syntax(argv[0]);
+	if (ReleaseStrategy_t::JobClose == releaseSettings.strategy && (!bAssignToJob || bLeakThreadsInThisProcess || (bChildPark && bTrackExits)))
+		Syntax(argv[0]);
+	// Harvesting needs leaked process handles that are still open at the end of the run.
+	if (bHarvest && (!bLeakProcessHandles || bBenchmark || 0 != nTreeSubMakers || bSubMaker || bSoak || bProbe || bDuplicateOneHandle || bLeakThreadsInThisProcess))
+		Syntax(argv[0]);
+	// A scenario's phases bring their own counts and rates, and it runs unattended.
+	if (!sScenarioFile.empty() && (bBenchmark || 0 != nTreeSubMakers || bSubMaker || bSoak || bProbe || bDuplicateOneHandle || bLeakThreadsInThisProcess ||
+		bChildPark || bTrackExits || rateSchedule.dSpawnsPerSec > 0 || !sJsonFile.empty() || 0 != nScanCurvePoints || bHarvest))
+		Syntax(argv[0]);
+	// The scan curve builds a process population in steps, with no pacing or per-spawn latency.
+	if (0 != nScanCurvePoints && (bBenchmark || 0 != nTreeSubMakers || bSubMaker || bSoak || bProbe || bDuplicateOneHandle || bLeakThreadsInThisProcess ||
+		bChildPark || bTrackExits || rateSchedule.dSpawnsPerSec > 0 || !sJsonFile.empty() || unsigned(numProcessesOrThreads) < nScanCurvePoints))
+		Syntax(argv[0]);
+	// The holder has no job to close, and serves until told to quit.
+	if (int(bHolder) + int(bHolderControl) + int(bHandoff) > 1 || (bHolder && ReleaseStrategy_t::JobClose == releaseSettings.strategy))
+		Syntax(argv[0]);
+	// A handoff replaces the wait and the release: the holder keeps the handles, and closes them its own way. Hung
+	// threads and sub-makers' zombies can't outlive this process.
+	if (bHandoff && (bBenchmark || 0 != nTreeSubMakers || bSubMaker || bSoak || bProbe || !sScenarioFile.empty() || bCloseStrategy || bHarvest ||
+		(bLeakThreadsInThisProcess && !bZombieThreadsInThisProcess)))
+		Syntax(argv[0]);
+	// Placement applies to the process spawners; following the spawner threads needs them pinned.
+	if ((bPinSpawners || bPinChildren) && (bLeakThreadsInThisProcess || !leakObjectTypes.empty() || bHolder || bHolderControl))
+		Syntax(argv[0]);
+	if (bPinChildren && !bChildPlacementSpec && !bPinSpawners)
+		Syntax(argv[0]);
+	// A soak takes one token per replacement, for as long as it runs (unknown for a soak until a key is pressed), plus up to
+	// the bucket's second of catch-up.
+	if (bSoak)
+		rateSchedule.nExpectedTokens = (soakSettings.dDurationSeconds > 0) ? size_t((soakSettings.dDurationSeconds + 1) * rateSchedule.dSpawnsPerSec) + 1 : 0;
+	else
+		rateSchedule.nExpectedTokens = size_t(numProcessesOrThreads);
+	RateScheduler scheduler(rateSchedule);
+	// Child options other than parking, which needs the barrier's object names
+	std::wstring sChildArgs;
+	if (bChildExitNow)
+		sChildArgs = L"-now";
+	if (0 != cchCommandLinePad)
+		sChildArgs += (sChildArgs.empty() ? L"" : L" ") + CommandLinePadding(cchCommandLinePad);
+	if (0 != nChildTouchMB)
+	{
+		sChildArgs += (sChildArgs.empty() ? L"" : L" ") + std::wstring(L"-touch:") + std::to_wstring(nChildTouchMB);
+		if (bChildLargePages)
+			sChildArgs += L" -largepages";
+	}
+	// Children inherit the privilege enabled; without it, they fall back to regular pages.
+	if (bChildLargePages && !EnablePrivilege(SE_LOCK_MEMORY_NAME))
+	{
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot enable " << SE_LOCK_MEMORY_NAME << L"; children will use regular pages: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+	}
+	const std::wstring sZombieProcPath = ChildImagePath(bMinimalChild ? L"ZombieProcMin" : L"ZombieProc");
+
+	if (!sTraceFileToConvert.empty())
+	{
+		const std::wstring sCsvFile = sTraceFileToConvert + L".csv";
+		if (!ConvertTraceFileToCsv(sTraceFileToConvert, sCsvFile))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"Cannot convert " << sTraceFileToConvert << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			return -2;
+		}
+		std::wcout << L"Trace written to " << sCsvFile << std::endl;
+		return 0;
+	}
+	if (0 != dwWatchPid)
+	{
+		return WatchLiveStats(LiveStatsPageName(dwWatchPid));
+	}
+	if (bScan)
+	{
+		const size_t nTopHolders = 10;
+		WriteZombieScanReport(std::wcout, ScanForZombies(nScanWorkers), nTopHolders);
+		return 0;
+	}
+	if (bHolder)
+	{
+		return RunHandleHolder(sHolderName, releaseSettings);
+	}
+	if (bHolderControl)
+	{
+		HolderReply_t reply = { 0 };
+		if (!SendHolderCommand(sHolderName, holderCommand, reply))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"Cannot reach holder " << HandleHolderPipeName(sHolderName) << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			return -2;
+		}
+		WriteHolderReply(std::wcout, reply);
+		return 0;
+	}
+	// Number of zombies or objects the statistics page reports progress toward
+	int nLiveStatsTarget = numProcessesOrThreads;
+	if (!leakObjectTypes.empty())
+		nLiveStatsTarget = numProcessesOrThreads * int(leakObjectTypes.size());
+	// Read the scenario before anything starts, so that a bad line fails fast.
+	std::vector<ScenarioPhase_t> scenarioPhases;
+	if (!sScenarioFile.empty())
+	{
+		size_t nErrorLine = 0;
+		if (!LoadScenarioFile(sScenarioFile, scenarioPhases, nErrorLine))
+		{
+			DWORD dwLastErr = GetLastError();
+			if (0 != nErrorLine)
+				std::wcerr << sScenarioFile << L"(" << nErrorLine << L"): invalid scenario line" << std::endl;
+			else
+				std::wcerr << L"Cannot read " << sScenarioFile << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			return -2;
+		}
+		// The statistics page's target is everything the scenario creates.
+		nLiveStatsTarget = 0;
+		for (const ScenarioPhase_t& phase : scenarioPhases)
+			nLiveStatsTarget += phase.nCount;
+	}
+	if (!sTraceFile.empty())
+	{
+		// Events per recording thread before the oldest are overwritten (32 MB per thread), and the most memory for all
+		// threads' buffers together: 32 threads recording at once
+		const size_t nTraceEventsPerThread = 1024 * 1024;
+		const size_t cbMaxTraceMemory = size_t(1024) * 1024 * 1024;
+		StartTracing(nTraceEventsPerThread, cbMaxTraceMemory);
+	}
+	// Declared before everything that records events, so that it writes the trace file after they're gone.
+	TraceFileWriter traceFileWriter(sTraceFile);
+
+	// Publishes counters for external monitors (-watch) until it goes out of scope
+	LiveStats liveStats;
+	LiveStats* pLiveStats = nullptr;
+	if (bLiveStats)
+	{
+		const std::wstring sPageName = LiveStatsPageName(GetCurrentProcessId());
+		if (!liveStats.Start(sPageName, nLiveStatsTarget))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"Cannot create statistics page " << sPageName << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			return -2;
+		}
+		pLiveStats = &liveStats;
+		liveStats.SetPhase(LiveStatsPhase_t::Spawning);
+		std::wcout << L"Publishing statistics in " << sPageName << std::endl;
+	}
+
 	HANDLE hJob = nullptr;
-	if (bAssignToJob)
+	// With -tree, each sub-maker creates its own job.
+	if (bAssignToJob && 0 == nTreeSubMakers)
 	{
 		hJob = CreateJobObjectW(nullptr, nullptr); // TODO: add an option to make a randomly-named job object instead of unnamed
 		if (nullptr != hJob)
@@ -123,91 +950,421 @@ int wmain(int argc, wchar_t** argv)
 		}
 	}
 
-	int ix = 0;
-	if (!bLeakThreadsInThisProcess)
+	// Handles for every child to inherit, and the environment every child gets
+	InheritableHandlePool inheritPool;
+	if (0 != nInheritHandles && !inheritPool.Create(nInheritHandles))
 	{
-		// ZombieProc[32].exe should be in the same directory as this executable.
-		// 64-bit child process name
-		const wchar_t* szZombieProc = L"\\ZombieProc.exe";
-#pragma warning(push)
-#pragma warning(disable:4127) // "conditional expression is constant"
-		if (4 == sizeof(void*))
-#pragma warning(pop)
-		{
-			// 32-bit child process name
-			szZombieProc = L"\\ZombieProc32.exe";
-		}
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot create " << nInheritHandles << L" inheritable handles: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		return -2;
+	}
+	const std::vector<HANDLE>* pInheritHandles = inheritPool.Handles().empty() ? nullptr : &inheritPool.Handles();
+	const std::wstring sChildEnvironment = (0 != cchEnvironmentPad) ? BuildPaddedEnvironment(cchEnvironmentPad) : std::wstring();
+
+	// Processors for the spawner threads, and for their children
+	std::vector<ProcessorPlacement_t> spawnerPlacements, childPlacements;
+	if (bPinSpawners && !BuildProcessorPlacements(spawnerPlacementSpec, spawnerPlacements))
+	{
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot place spawner threads as requested: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		return -2;
+	}
+	if (bChildPlacementSpec && !BuildProcessorPlacements(childPlacementSpec, childPlacements))
+	{
+		DWORD dwLastErr = GetLastError();
+		std::wcerr << L"Cannot place child processes as requested: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		return -2;
+	}
+	const std::vector<ProcessorPlacement_t>* pSpawnerPlacements = bPinSpawners ? &spawnerPlacements : nullptr;
+	const std::vector<ProcessorPlacement_t>* pChildPlacements = !bPinChildren ? nullptr : (bChildPlacementSpec ? &childPlacements : &spawnerPlacements);
+
+	// Spawn settings shared by every mode that starts zombie processes; each mode copies them and overrides what it changes.
+	SpawnSettings_t baseSettings;
+	baseSettings.sZombieProcPath = sZombieProcPath;
+	baseSettings.strategy = spawnStrategy;
+	baseSettings.numProcesses = numProcessesOrThreads;
+	baseSettings.dwMilliseconds = dwMilliseconds;
+	baseSettings.bLeakProcessHandles = bLeakProcessHandles;
+	baseSettings.bLeakThreadHandles = bLeakThreadHandles;
+	baseSettings.hJob = hJob;
+	baseSettings.pLiveStats = pLiveStats;
+	baseSettings.sChildArgs = sChildArgs;
+	baseSettings.pInheritHandles = pInheritHandles;
+	baseSettings.sEnvironment = sChildEnvironment;
+	baseSettings.pSpawnerPlacements = pSpawnerPlacements;
+	baseSettings.pChildPlacements = pChildPlacements;
 
-		std::wstring sZombieProcPath = ThisExeDirectory() + szZombieProc;
+	if (bSubMaker)
+	{
+		return TreeSpawner::RunSubMaker(baseSettings, nSpawnerThreads, ixSubMaker, dwTreeParentPid);
+	}
 
-		for (ix = 0; ix < numProcessesOrThreads; ++ix)
+	// Every handle this process deliberately leaks, so that they can be released and the kernel memory measured afterward.
+	std::vector<HANDLE> leakedHandles;
+	// Sub-makers for -tree, which hold their own zombies' handles
+	TreeSpawner tree;
+	// Number of zombies that the kernel memory change is attributed to
+	size_t nZombies = 0;
+	std::wstring sArgs;
+	for (int ixArg = 1; ixArg < argc; ++ixArg)
+	{
+		sArgs += std::wstring(L" ") + argv[ixArg];
+	}
+	const KernelMemorySnapshot_t memBeforeSpawn = TakeKernelMemorySnapshot();
+
+	if (bBenchmark)
+	{
+		SpawnSettings_t settings = baseSettings;
+		std::vector<SpawnVariant_t> variants;
+		if (bCostBench)
 		{
-			if (0 == (ix + 1) % 100)
+			if (!RunSpawnCostSweep(settings, nSpawnerThreads))
 			{
-				// Write progress to the console with CR but no LF to overwrite previous lines
-				std::wcout << L"Progress: " << (ix + 1) << L" ...          \r" << std::flush;
+				DWORD dwLastErr = GetLastError();
+				std::wcerr << L"Cannot create inheritable handles: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+				return -2;
 			}
-			STARTUPINFOW startupInfo = { 0 };
-			startupInfo.cb = sizeof(startupInfo);
-			PROCESS_INFORMATION pi = { 0 };
-			const DWORD dwCreationFlags = CREATE_BREAKAWAY_FROM_JOB | CREATE_NEW_PROCESS_GROUP;
-			BOOL ret = CreateProcessW(sZombieProcPath.c_str(), nullptr, nullptr, nullptr, FALSE, dwCreationFlags, nullptr, nullptr, &startupInfo, &pi);
-			if (ret)
+		}
+		else if (bChildImageBench)
+		{
+			settings.sZombieProcPath = ChildImagePath(L"ZombieProc");
+			variants.push_back({ L"full", settings });
+			settings.sZombieProcPath = ChildImagePath(L"ZombieProcMin");
+			variants.push_back({ L"min", settings });
+			RunSpawnBenchmark(L"Child image comparison", variants, nSpawnerThreads);
+		}
+		else
+		{
+			for (SpawnStrategy_t strategy : AllSpawnStrategies)
 			{
-				if (bAssignToJob)
-				{
-					if (!AssignProcessToJobObject(hJob, pi.hProcess))
-					{
-						DWORD dwLastErr = GetLastError();
-						std::wcerr << L"AssignProcessToJobObject failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
-					}
-				}
-				if (!bLeakProcessHandles)
-					CloseHandle(pi.hProcess);
-				if (!bLeakThreadHandles)
-					CloseHandle(pi.hThread);
-				if (0 != dwMilliseconds)
-					Sleep(dwMilliseconds);
+				settings.strategy = strategy;
+				variants.push_back({ SpawnStrategyName(strategy), settings });
 			}
-			else
+			RunSpawnBenchmark(L"Spawn strategy comparison", variants, nSpawnerThreads);
+		}
+		return 0;
+	}
+	else if (0 != nTreeSubMakers)
+	{
+		// Sub-makers get every option except -tree itself and the total count, which is divided among them.
+		std::wstring sSubMakerArgs;
+		for (int ixArg = 1; ixArg < argc; ++ixArg)
+		{
+			if (!StartsWith(argv[ixArg], L"-tree:", true) && !StartsWith(argv[ixArg], L"-n:", true))
+				sSubMakerArgs += std::wstring(L" ") + argv[ixArg];
+		}
+		if (!tree.Start(sSubMakerArgs, numProcessesOrThreads, nTreeSubMakers))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"Cannot start sub-makers: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+			return -2;
+		}
+		nZombies = size_t(tree.WaitForSubMakers());
+		tree.WriteReport(std::wcout);
+	}
+	else if (bSoak)
+	{
+		soakSettings.pScheduler = &scheduler;
+		if (nullptr != pLiveStats)
+			pLiveStats->SetPhase(LiveStatsPhase_t::Soaking);
+		RunSoak(baseSettings, soakSettings);
+		// The soak releases its own handles.
+		const KernelMemorySnapshot_t memAfterSoak = TakeKernelMemorySnapshot();
+		WriteKernelMemoryDelta(std::wcout, L"Kernel memory after the soak", memBeforeSpawn, memAfterSoak, 0);
+		return 0;
+	}
+	else if (!scenarioPhases.empty())
+	{
+		ScenarioSettings_t settings;
+		settings.spawn = baseSettings;
+		settings.pfnThread = NopThread;
+		settings.cbStackReserve = cbStackReserve;
+		settings.nSpawnerThreads = nSpawnerThreads;
+		settings.pLiveStats = pLiveStats;
+		std::wcout << L"Running " << scenarioPhases.size() << L" phases from " << sScenarioFile << std::endl;
+		const std::vector<ScenarioPhaseResults_t> results = RunScenario(settings, scenarioPhases, leakedHandles, std::wcout);
+		WriteScenarioReport(std::wcout, results, memBeforeSpawn);
+		const std::wstring sCsvFile = sScenarioFile + L".csv";
+		if (WriteScenarioCsv(sCsvFile, results, memBeforeSpawn))
+		{
+			std::wcout << L"Phase metrics written to " << sCsvFile << std::endl;
+		}
+		else
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"Cannot write " << sCsvFile << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		}
+
+		// Scenarios run unattended: release whatever the last phases left held instead of waiting for a key.
+		if (nullptr != pLiveStats)
+			pLiveStats->SetPhase(LiveStatsPhase_t::Releasing);
+		const bool bHandlesToRelease = !leakedHandles.empty();
+		releaseSettings.hJob = hJob;
+		releaseSettings.pLiveStats = pLiveStats;
+		const ReleaseResults_t releaseResults = ReleaseHandles(releaseSettings, leakedHandles);
+		if (bHandlesToRelease)
+			WriteReleaseReport(std::wcout, releaseSettings, releaseResults);
+		const KernelMemorySnapshot_t memAfterScenario = TakeKernelMemorySnapshot();
+		WriteKernelMemoryDelta(std::wcout, L"Kernel memory after the scenario", memBeforeSpawn, memAfterScenario, 0);
+		return 0;
+	}
+	else if (bProbe)
+	{
+		ProbeTarget_t target;
+		target.pSettings = &baseSettings;
+		target.pfnThread = bLeakThreadsInThisProcess ? NopThread : nullptr;
+		target.cbStackReserve = cbStackReserve;
+		target.nMaxPopulation = nProbeMax;
+		target.pLiveStats = pLiveStats;
+		if (nullptr != pLiveStats)
+			pLiveStats->SetPhase(LiveStatsPhase_t::Probing);
+		ProbeZombieLimit(target);
+		return 0;
+	}
+	else if (bDuplicateOneHandle)
+	{
+		// Create the one zombie whose handle gets duplicated, and wait for it to exit (unless it's a hung thread)
+		HANDLE hZombie = nullptr;
+		if (bLeakThreadsInThisProcess)
+		{
+			hZombie = CreateLeakableThread((bZombieThreadsInThisProcess ? NopThread : HungThread), cbStackReserve);
+			if (NULL == hZombie)
 			{
 				DWORD dwLastErr = GetLastError();
-				std::wcout << L"CreateProcessW failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
-				break;
+				std::wcout << L"CreateThread failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+				return -3;
+			}
+			if (bZombieThreadsInThisProcess)
+				WaitForSingleObject(hZombie, INFINITE);
+		}
+		else
+		{
+			PROCESS_INFORMATION pi;
+			if (!StartZombieProc(baseSettings, pi))
+			{
+				DWORD dwLastErr = GetLastError();
+				std::wcout << LastSpawnFailure() << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+				return -3;
 			}
+			CloseHandle(pi.hThread);
+			hZombie = pi.hProcess;
+			std::wcout << L"Waiting for process " << pi.dwProcessId << L" to exit..." << std::endl;
+			WaitForSingleObject(hZombie, INFINITE);
 		}
-		size_t nHandlesLeaked = 0;
-		if (bLeakProcessHandles)
-			nHandlesLeaked += ix;
-		if (bLeakThreadHandles)
-			nHandlesLeaked += ix;
+
+		leakedHandles.push_back(hZombie);
+		DuplicationResults_t results = DuplicateHandleRepeatedly(hZombie, numProcessesOrThreads, leakedHandles);
+		// The kernel memory change comes from one zombie's duplicated handles, so nZombies stays 0 and the kernel memory
+		// reports have no per-zombie column; the paged pool cost per handle is reported below.
+		if (0 != results.dwLastError)
+		{
+			std::wcout << std::endl << L"DuplicateHandle failed: " << SysErrorMessageWithCode(results.dwLastError) << std::endl;
+		}
+		const double dSeconds = PerfCounterToSeconds(results.llElapsed);
 		std::wcout
 			<< std::endl
-			<< L"Processes started: " << ix << std::endl
-			<< L"Leaked handles:    " << nHandlesLeaked << std::endl
-			<< std::endl;
+			<< L"Handles duplicated:      " << results.nDuplicated << std::endl
+			<< L"Elapsed seconds:         " << dSeconds << std::endl
+			<< L"Duplications/sec:        " << (dSeconds > 0 ? results.nDuplicated / dSeconds : 0) << std::endl
+			<< L"Handle count:            " << results.dwHandleCountBefore << L" -> " << results.dwHandleCountAfter << std::endl
+			<< L"Paged pool quota:        " << results.cbPagedPoolBefore << L" -> " << results.cbPagedPoolAfter << L" bytes" << std::endl;
+		if (results.nDuplicated > 0 && results.cbPagedPoolAfter >= results.cbPagedPoolBefore)
+		{
+			std::wcout << L"Paged pool bytes/handle: " << double(results.cbPagedPoolAfter - results.cbPagedPoolBefore) / results.nDuplicated << std::endl;
+		}
+		std::wcout << std::endl;
 	}
-	else
+	else if (0 != nScanCurvePoints)
 	{
-		for (ix = 0; ix < numProcessesOrThreads; ++ix)
+		SpawnerResults_t results;
+		const std::vector<ScanCurvePoint_t> points = RunScanCurve(baseSettings, nSpawnerThreads, nScanCurvePoints, 0, results);
+		WriteScanCurve(std::wcout, points);
+		nZombies = size_t(results.nStarted);
+		leakedHandles = std::move(results.leakedHandles);
+	}
+	else if (!leakObjectTypes.empty())
+	{
+		ObjectLeakSettings_t settings;
+		settings.types = leakObjectTypes;
+		settings.nPerType = numProcessesOrThreads;
+		settings.pLiveStats = pLiveStats;
+		const std::vector<ObjectLeakResults_t> results = LeakObjects(settings, nSpawnerThreads, leakedHandles);
+		WriteObjectLeakReport(std::wcout, results);
+		nZombies = leakedHandles.size();
+	}
+	else if (!bLeakThreadsInThisProcess)
+	{
+		SpawnSettings_t settings = baseSettings;
+		SpawnLatencyRecorder latency(numProcessesOrThreads);
+		settings.pLatency = &latency;
+		settings.pScheduler = &scheduler;
+		ExitTracker exitTracker;
+		if (bTrackExits)
 		{
-			HANDLE hLeakMe = CreateThread(NULL, 0, (bZombieThreadsInThisProcess ? NopThread : HungThread), NULL, 0, NULL);
-			if (NULL == hLeakMe)
+			if (!exitTracker.Start(hJob, size_t(numProcessesOrThreads)))
 			{
 				DWORD dwLastErr = GetLastError();
-				std::wcout << L"CreateThread failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
-				break;
+				std::wcerr << L"Cannot track child exits: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+				return -2;
+			}
+			settings.bResumeAfterJobAssignment = true;
+		}
+		ChildReleaseBarrier barrier;
+		settings.sChildArgs = sChildArgs;
+		settings.pInheritHandles = pInheritHandles;
+		settings.sEnvironment = sChildEnvironment;
+		settings.pSpawnerPlacements = pSpawnerPlacements;
+		settings.pChildPlacements = pChildPlacements;
+		if (bChildPark)
+		{
+			if (!barrier.Create())
+			{
+				DWORD dwLastErr = GetLastError();
+				std::wcerr << L"Cannot create child release barrier: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+				return -2;
 			}
+			settings.sChildArgs += (settings.sChildArgs.empty() ? L"" : L" ") + barrier.ChildArgs();
+		}
+
+		LONGLONG llElapsed = 0;
+		SpawnerResults_t results = SpawnZombieProcesses(settings, nSpawnerThreads, llElapsed);
+		const double dSeconds = PerfCounterToSeconds(llElapsed);
+		std::wcout
+			<< std::endl
+			<< L"Processes started: " << results.nStarted << std::endl
+			<< L"Leaked handles:    " << results.leakedHandles.size() << std::endl;
+		if (nSpawnerThreads > 1)
+		{
+			std::wcout << L"Spawner threads:   " << nSpawnerThreads << std::endl;
+		}
+		std::wcout
+			<< L"Elapsed seconds:   " << dSeconds << std::endl
+			<< L"Spawns/sec:        " << (dSeconds > 0 ? results.nStarted / dSeconds : 0) << std::endl
+			<< std::endl;
+		WritePlacementReport(std::wcout, settings, results, llElapsed);
+		WriteScheduleReport(scheduler, rateSchedule);
+		latency.WriteBucketTable(std::wcout);
+		WriteLatencyJsonIfRequested(latency, sJsonFile, "processes", nSpawnerThreads, results.nStarted, dSeconds);
+		nZombies = size_t(results.nStarted);
+		leakedHandles = std::move(results.leakedHandles);
+		if (bChildPark && ReleaseStrategy_t::JobClose == releaseSettings.strategy)
+		{
+			// Parked children stay running until closing the job kills them all in the release phase.
+			std::wcout << L"Holding " << results.nStarted << L" parked children for the job close." << std::endl;
+		}
+		else
+		{
+			if (bChildPark)
+			{
+				ReleaseParkedChildren(barrier, results.nStarted, leakedHandles);
+			}
+			WaitForZombies(leakedHandles);
+		}
+		if (bTrackExits)
+		{
+			// Job notifications aren't guaranteed to be delivered, so stop waiting if they dry up.
+			const DWORD dwIdleTimeoutMs = 10000;
+			exitTracker.WaitForExits(size_t(results.nStarted), dwIdleTimeoutMs);
+			exitTracker.Stop();
+			exitTracker.WriteReport(std::wcout);
 		}
+	}
+	else
+	{
+		ThreadLeakSettings_t settings;
+		settings.numThreads = numProcessesOrThreads;
+		settings.pfnThread = bZombieThreadsInThisProcess ? NopThread : HungThread;
+		settings.cbStackReserve = cbStackReserve;
+		SpawnLatencyRecorder latency(numProcessesOrThreads);
+		settings.pLatency = &latency;
+		settings.pScheduler = &scheduler;
+		settings.pLiveStats = pLiveStats;
+
+		const ProcessFootprint_t footprintBefore = TakeProcessFootprint();
+		LONGLONG llElapsed = 0;
+		SpawnerResults_t results = LeakThreads(settings, nSpawnerThreads, llElapsed);
+		const ProcessFootprint_t footprintAfter = TakeProcessFootprint();
+		const double dSeconds = PerfCounterToSeconds(llElapsed);
 		std::wcout
 			<< std::endl
-			<< (bZombieThreadsInThisProcess ? L"Zombie threads" : L"Threads") <<  L" leaked: " << ix << std::endl
+			<< (bZombieThreadsInThisProcess ? L"Zombie threads" : L"Threads") <<  L" leaked: " << results.nStarted << std::endl;
+		if (nSpawnerThreads > 1)
+		{
+			std::wcout << L"Creator threads: " << nSpawnerThreads << std::endl;
+		}
+		if (0 != cbStackReserve)
+		{
+			std::wcout << L"Stack reserve:   " << cbStackReserve << L" bytes" << std::endl;
+		}
+		std::wcout
+			<< L"Elapsed seconds: " << dSeconds << std::endl
+			<< L"Threads/sec:     " << (dSeconds > 0 ? results.nStarted / dSeconds : 0) << std::endl
 			<< std::endl;
+		WriteScheduleReport(scheduler, rateSchedule);
+		latency.WriteBucketTable(std::wcout);
+		WriteLatencyJsonIfRequested(latency, sJsonFile, (bZombieThreadsInThisProcess ? "zombie threads" : "threads"), nSpawnerThreads, results.nStarted, dSeconds);
+		WriteProcessFootprintDelta(std::wcout, footprintBefore, footprintAfter, size_t(results.nStarted));
+		nZombies = size_t(results.nStarted);
+		leakedHandles = std::move(results.leakedHandles);
+		// Hung threads never exit, so there's nothing to wait for with -T.
+		if (bZombieThreadsInThisProcess)
+			WaitForZombies(leakedHandles);
 	}
+
+	const KernelMemorySnapshot_t memAfterSpawn = TakeKernelMemorySnapshot();
+	std::wcout << L"Mode:" << (sArgs.empty() ? L" (default options)" : sArgs) << std::endl;
+	WriteKernelMemoryDelta(std::wcout, L"Kernel memory after spawning", memBeforeSpawn, memAfterSpawn, nZombies);
+
+	if (bHandoff)
+	{
+		// The holder keeps the zombies from now on, so this maker can exit without waiting or releasing anything.
+		HandoffResults_t handoffResults;
+		const bool bHandedOff = HandOffHandles(sHolderName, leakedHandles, handoffResults);
+		if (!bHandedOff)
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"Handoff to holder " << HandleHolderPipeName(sHolderName) << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		}
+		WriteHandoffReport(std::wcout, handoffResults);
+		return bHandedOff ? 0 : -2;
+	}
+
+	if (nullptr != pLiveStats)
+		pLiveStats->SetPhase(LiveStatsPhase_t::Holding);
 	std::wcout << L"Press any key to exit and to release handles ";
 // Suppress warning about ignored return value from _getch()
 #pragma warning(suppress: 6031)
 	_getch();
+	std::wcout << std::endl;
+
+	// Collect the children's accounting while their handles are still open.
+	if (bHarvest)
+	{
+		ChildAccountingResults_t accounting = HarvestChildAccounting(leakedHandles, hJob, nHarvestThreads);
+		WriteChildAccountingReport(std::wcout, accounting);
+	}
+
+	// Release the handles explicitly rather than at process exit, so the teardown can be timed and the reclaimed memory
+	// measured.
+	if (nullptr != pLiveStats)
+		pLiveStats->SetPhase(LiveStatsPhase_t::Releasing);
+	const bool bHandlesToRelease = !leakedHandles.empty();
+	const LONGLONG llReleaseStart = PerfCounterNow();
+	releaseSettings.hJob = hJob;
+	releaseSettings.pLiveStats = pLiveStats;
+	const ReleaseResults_t releaseResults = ReleaseHandles(releaseSettings, leakedHandles);
+	if (ReleaseStrategy_t::JobClose == releaseSettings.strategy)
+		hJob = nullptr;
+	tree.Release();
+	if (bHandlesToRelease)
+		WriteReleaseReport(std::wcout, releaseSettings, releaseResults);
+	const KernelMemorySnapshot_t memAfterRelease = TakeKernelMemorySnapshot();
+	WriteKernelMemoryDelta(std::wcout, L"Kernel memory after releasing handles", memAfterSpawn, memAfterRelease, nZombies);
+	if (bCloseStrategy)
+	{
+		const double dMaxReclaimSeconds = 10;
+		TrackMemoryReclaim(std::wcout, memBeforeSpawn, memAfterSpawn, llReleaseStart, dMaxReclaimSeconds);
+	}
 	return 0;
 }
 
@@ -3,23 +3,113 @@
 
 #include "framework.h"
 #include "ZombieProc.h"
+#include <shellapi.h>
 
-// Windows GUI (non-console) process that simply exits two seconds after starting. Shows no UI.
+/// <summary>
+/// Commits cbTouch bytes and writes one byte in every page, so that all of them are in the working set when the process
+/// exits or parks. The memory is never freed: process exit releases it.
+/// </summary>
+/// <returns>Exit code: 0 if successful; 1 if large pages were requested but unavailable, so regular pages were used;
+/// 2 if the memory couldn't be committed</returns>
+static int CommitAndTouch(SIZE_T cbTouch, bool bLargePages)
+{
+    int nExitCode = 0;
+    SIZE_T cbPage = 0;
+    LPVOID pv = nullptr;
+    if (bLargePages)
+    {
+        // Needs SeLockMemoryPrivilege enabled, which ZombieMaker enables in its own token for the children to inherit.
+        cbPage = GetLargePageMinimum();
+        if (0 != cbPage)
+        {
+            cbTouch = (cbTouch + cbPage - 1) / cbPage * cbPage;
+            pv = VirtualAlloc(nullptr, cbTouch, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+        if (nullptr == pv)
+            nExitCode = 1;
+    }
+    if (nullptr == pv)
+    {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        cbPage = systemInfo.dwPageSize;
+        pv = VirtualAlloc(nullptr, cbTouch, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (nullptr == pv)
+            return 2;
+    }
+    // One write per page faults it in; filling every byte would make large sizes dominate spawn time.
+    volatile BYTE* pb = static_cast<volatile BYTE*>(pv);
+    for (SIZE_T ib = 0; ib < cbTouch; ib += cbPage)
+    {
+        pb[ib] = 1;
+    }
+    return nExitCode;
+}
+
+// Windows GUI (non-console) process that exits without showing any UI. By default it exits two seconds after starting.
+// Command-line options (passed by ZombieMaker):
+//   -now                  : exit immediately
+//   -release:<event name> : wait until the named event is signaled, then exit
+//   -parked:<sem name>    : with -release, release the named semaphore once when ready to wait on the event
+//   -touch:<MB>           : first commit and touch the specified number of megabytes (exit code 2 if that fails)
+//   -largepages           : with -touch, use large pages (exit code 1 if unavailable and regular pages were used)
+//   -pad:<anything>       : ignored; ZombieMaker's -cmdline uses it to lengthen the command line
 int APIENTRY wWinMain(_In_ HINSTANCE, // hInstance,
                      _In_opt_ HINSTANCE, // hPrevInstance,
                      _In_ LPWSTR, //    lpCmdLine,
                      _In_ int) //       nCmdShow)
 {
-    //const size_t nAllocSize = 1024 * 1024 * 1024;
-    //LPVOID pv = VirtualAlloc(nullptr, nAllocSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-    //if (nullptr != pv)
-    //{
-    //    for (size_t ix = 0; ix < nAllocSize; ++ix)
-    //    {
-    //        ((unsigned char*)pv)[ix] = (unsigned char)(ix % 0xFF);
-    //    }
-    //}
+    bool bExitNow = false;
+    SIZE_T cbTouch = 0;
+    bool bLargePages = false;
+    const wchar_t* szReleaseEvent = nullptr;
+    const wchar_t* szParkedSemaphore = nullptr;
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (nullptr != argv)
+    {
+        // argv[0] is this program's path
+        for (int ixArg = 1; ixArg < argc; ++ixArg)
+        {
+            if (0 == wcscmp(argv[ixArg], L"-now"))
+                bExitNow = true;
+            else if (0 == wcsncmp(argv[ixArg], L"-release:", 9))
+                szReleaseEvent = argv[ixArg] + 9;
+            else if (0 == wcsncmp(argv[ixArg], L"-parked:", 8))
+                szParkedSemaphore = argv[ixArg] + 8;
+            else if (0 == wcsncmp(argv[ixArg], L"-touch:", 7))
+                cbTouch = SIZE_T(wcstoull(argv[ixArg] + 7, nullptr, 10)) * 1024 * 1024;
+            else if (0 == wcscmp(argv[ixArg], L"-largepages"))
+                bLargePages = true;
+        }
+    }
+
+    const int nExitCode = (0 != cbTouch) ? CommitAndTouch(cbTouch, bLargePages) : 0;
+
+    if (bExitNow)
+        return nExitCode;
+
+    if (nullptr != szReleaseEvent)
+    {
+        HANDLE hRelease = OpenEventW(SYNCHRONIZE, FALSE, szReleaseEvent);
+        if (nullptr != hRelease)
+        {
+            // Tell ZombieMaker that this process is parked, then wait to be released.
+            if (nullptr != szParkedSemaphore)
+            {
+                HANDLE hParked = OpenSemaphoreW(SEMAPHORE_MODIFY_STATE, FALSE, szParkedSemaphore);
+                if (nullptr != hParked)
+                {
+                    ReleaseSemaphore(hParked, 1, nullptr);
+                    CloseHandle(hParked);
+                }
+            }
+            WaitForSingleObject(hRelease, INFINITE);
+            return nExitCode;
+        }
+        // Can't open the event: fall through to the default behavior.
+    }
+
     Sleep(2000);
-    return 0;
+    return nExitCode;
 }
-
@@ -0,0 +1,196 @@
+// ZombieProcMin.cpp : Minimal-footprint child process for ZombieMaker.
+//
+// Built without the C runtime: no CRT startup or DLL, no static initializers, and no imports other than kernel32.dll,
+// so that creating one costs as little loader work as possible and the kernel's process-object cost dominates.
+// The entry point is ZombieProcMinMain (see the project's linker settings); it must end with ExitProcess.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// Accepts the same command-line options as ZombieProc (passed by ZombieMaker):
+//   -now                  : exit immediately
+//   -release:<event name> : wait until the named event is signaled, then exit
+//   -parked:<sem name>    : with -release, release the named semaphore once when ready to wait on the event
+//   -touch:<MB>           : first commit and touch the specified number of megabytes (exit code 2 if that fails)
+//   -largepages           : with -touch, use large pages (exit code 1 if unavailable and regular pages were used)
+//   -pad:<anything>       : ignored; ZombieMaker's -cmdline uses it to lengthen the command line
+// By default it exits two seconds after starting.
+
+// Maximum length of an event or semaphore name, including the terminating null
+static const int MaxNameLength = 260;
+
+/// <summary>
+/// If sz starts with szPrefix, returns a pointer to the rest of sz; otherwise nullptr.
+/// </summary>
+static const wchar_t* SkipPrefix(const wchar_t* sz, const wchar_t* szPrefix)
+{
+    while (L'\0' != *szPrefix)
+    {
+        if (*sz++ != *szPrefix++)
+            return nullptr;
+    }
+    return sz;
+}
+
+/// <summary>
+/// Copies the command-line token at sz (ending at a space or the end of the string) into szToken.
+/// Tokens are never quoted: ZombieMaker's object names contain no spaces.
+/// </summary>
+/// <returns>Pointer to the character following the token</returns>
+static const wchar_t* CopyToken(const wchar_t* sz, wchar_t* szToken)
+{
+    int cch = 0;
+    while (L'\0' != *sz && L' ' != *sz && cch < MaxNameLength - 1)
+    {
+        szToken[cch++] = *sz++;
+    }
+    szToken[cch] = L'\0';
+    return sz;
+}
+
+/// <summary>
+/// Parses the decimal digits at sz (no CRT for wcstoul).
+/// </summary>
+static SIZE_T ParseDecimal(const wchar_t* sz)
+{
+    SIZE_T n = 0;
+    while (L'0' <= *sz && *sz <= L'9')
+    {
+        n = n * 10 + SIZE_T(*sz++ - L'0');
+    }
+    return n;
+}
+
+/// <summary>
+/// Commits cbTouch bytes and writes one byte in every page, so that all of them are in the working set when the process
+/// exits or parks. The memory is never freed: process exit releases it.
+/// </summary>
+/// <returns>Exit code: 0 if successful; 1 if large pages were requested but unavailable, so regular pages were used;
+/// 2 if the memory couldn't be committed</returns>
+static UINT CommitAndTouch(SIZE_T cbTouch, bool bLargePages)
+{
+    UINT uExitCode = 0;
+    SIZE_T cbPage = 0;
+    LPVOID pv = nullptr;
+    if (bLargePages)
+    {
+        // Needs SeLockMemoryPrivilege enabled, which ZombieMaker enables in its own token for the children to inherit.
+        cbPage = GetLargePageMinimum();
+        if (0 != cbPage)
+        {
+            cbTouch = (cbTouch + cbPage - 1) / cbPage * cbPage;
+            pv = VirtualAlloc(nullptr, cbTouch, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+        if (nullptr == pv)
+            uExitCode = 1;
+    }
+    if (nullptr == pv)
+    {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        cbPage = systemInfo.dwPageSize;
+        pv = VirtualAlloc(nullptr, cbTouch, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (nullptr == pv)
+            return 2;
+    }
+    // One write per page faults it in. The stride keeps the compiler from turning the loop into a memset call, which
+    // this image has no C runtime for.
+    volatile BYTE* pb = static_cast<volatile BYTE*>(pv);
+    for (SIZE_T ib = 0; ib < cbTouch; ib += cbPage)
+    {
+        pb[ib] = 1;
+    }
+    return uExitCode;
+}
+
+extern "C" void WINAPI ZombieProcMinMain()
+{
+    bool bExitNow = false;
+    SIZE_T cbTouch = 0;
+    bool bLargePages = false;
+    wchar_t szReleaseEvent[MaxNameLength];
+    wchar_t szParkedSemaphore[MaxNameLength];
+    szReleaseEvent[0] = szParkedSemaphore[0] = L'\0';
+
+    // Skip the program path, which ZombieMaker always quotes when it passes arguments.
+    const wchar_t* szCmdLine = GetCommandLineW();
+    if (L'"' == *szCmdLine)
+    {
+        ++szCmdLine;
+        while (L'\0' != *szCmdLine && L'"' != *szCmdLine)
+            ++szCmdLine;
+        if (L'"' == *szCmdLine)
+            ++szCmdLine;
+    }
+    else
+    {
+        while (L'\0' != *szCmdLine && L' ' != *szCmdLine)
+            ++szCmdLine;
+    }
+
+    while (L'\0' != *szCmdLine)
+    {
+        if (L' ' == *szCmdLine)
+        {
+            ++szCmdLine;
+            continue;
+        }
+        const wchar_t* szValue = nullptr;
+        if (nullptr != (szValue = SkipPrefix(szCmdLine, L"-release:")))
+        {
+            szCmdLine = CopyToken(szValue, szReleaseEvent);
+        }
+        else if (nullptr != (szValue = SkipPrefix(szCmdLine, L"-parked:")))
+        {
+            szCmdLine = CopyToken(szValue, szParkedSemaphore);
+        }
+        else if (nullptr != (szValue = SkipPrefix(szCmdLine, L"-touch:")))
+        {
+            cbTouch = ParseDecimal(szValue) * 1024 * 1024;
+            szCmdLine = szValue;
+        }
+        else
+        {
+            wchar_t szToken[MaxNameLength];
+            szCmdLine = CopyToken(szCmdLine, szToken);
+            const wchar_t* szRest = SkipPrefix(szToken, L"-now");
+            if (nullptr != szRest && L'\0' == *szRest)
+                bExitNow = true;
+            szRest = SkipPrefix(szToken, L"-largepages");
+            if (nullptr != szRest && L'\0' == *szRest)
+                bLargePages = true;
+        }
+        // Skip whatever is left of a token that was too long to copy.
+        while (L'\0' != *szCmdLine && L' ' != *szCmdLine)
+            ++szCmdLine;
+    }
+
+    const UINT uExitCode = (0 != cbTouch) ? CommitAndTouch(cbTouch, bLargePages) : 0;
+
+    if (bExitNow)
+        ExitProcess(uExitCode);
+
+    if (L'\0' != szReleaseEvent[0])
+    {
+        HANDLE hRelease = OpenEventW(SYNCHRONIZE, FALSE, szReleaseEvent);
+        if (nullptr != hRelease)
+        {
+            // Tell ZombieMaker that this process is parked, then wait to be released.
+            if (L'\0' != szParkedSemaphore[0])
+            {
+                HANDLE hParked = OpenSemaphoreW(SEMAPHORE_MODIFY_STATE, FALSE, szParkedSemaphore);
+                if (nullptr != hParked)
+                {
+                    ReleaseSemaphore(hParked, 1, nullptr);
+                    CloseHandle(hParked);
+                }
+            }
+            WaitForSingleObject(hRelease, INFINITE);
+            ExitProcess(uExitCode);
+        }
+        // Can't open the event: fall through to the default behavior.
+    }
+
+    Sleep(2000);
+    ExitProcess(uExitCode);
+}
@@ -0,0 +1,350 @@
+// Reference zombie detector: finds exited processes that are kept alive by open handles, and the processes holding them
+
+#include <Windows.h>
+#include <winternl.h>
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+#include "ZombieScanner.h"
+#include "SysErrorMessage.h"
+#include "Utilities.h"
+#include "WorkerThreads.h"
+
+// Not in winternl.h: the handle snapshot with full-width process IDs and handle values
+static const ULONG SystemExtendedHandleInformation = 64;
+static const NTSTATUS StatusInfoLengthMismatch = NTSTATUS(0xC0000004L);
+static const NTSTATUS StatusProcedureNotFound = NTSTATUS(0xC000007AL);
+static const NTSTATUS StatusNotFound = NTSTATUS(0xC0000225L);
+
+struct SystemHandleTableEntryInfoEx_t
+{
+	PVOID Object;
+	ULONG_PTR UniqueProcessId;
+	ULONG_PTR HandleValue;
+	ULONG GrantedAccess;
+	USHORT CreatorBackTraceIndex;
+	USHORT ObjectTypeIndex;
+	ULONG HandleAttributes;
+	ULONG Reserved;
+};
+
+struct SystemHandleInformationEx_t
+{
+	ULONG_PTR NumberOfHandles;
+	ULONG_PTR Reserved;
+	SystemHandleTableEntryInfoEx_t Handles[1];
+};
+
+typedef NTSTATUS(NTAPI* pfnNtQuerySystemInformation_t)(ULONG, PVOID, ULONG, PULONG);
+
+/// <summary>
+/// Calls NtQuerySystemInformation for a variable-size information class, growing the buffer until it fits.
+/// </summary>
+static NTSTATUS QuerySystemInformation(ULONG infoClass, std::vector<BYTE>& buffer)
+{
+	static const pfnNtQuerySystemInformation_t pfnNtQuerySystemInformation = reinterpret_cast<pfnNtQuerySystemInformation_t>(
+		GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQuerySystemInformation"));
+	if (nullptr == pfnNtQuerySystemInformation)
+		return StatusProcedureNotFound;
+	if (buffer.size() < 1024 * 1024)
+		buffer.resize(1024 * 1024);
+	for (;;)
+	{
+		ULONG cbNeeded = 0;
+		NTSTATUS ntStatus = pfnNtQuerySystemInformation(infoClass, buffer.data(), ULONG(buffer.size()), &cbNeeded);
+		if (StatusInfoLengthMismatch != ntStatus)
+			return ntStatus;
+		// The snapshot can grow between calls, so leave some room.
+		buffer.resize((std::max)(buffer.size() * 2, size_t(cbNeeded) + size_t(cbNeeded) / 4));
+	}
+}
+
+/// <summary>
+/// Handles that refer to one process object: all of them if the kernel reports object addresses, otherwise just one.
+/// </summary>
+struct ProcessObject_t
+{
+	// Holder process ID and handle value of each handle
+	std::vector<std::pair<DWORD, HANDLE>> handles;
+};
+
+enum class ObjectState_t { Inaccessible, Running, Zombie };
+
+struct ObjectCheck_t
+{
+	ObjectState_t state = ObjectState_t::Inaccessible;
+	DWORD dwPid = 0;
+};
+
+/// <summary>
+/// Body of each scan thread: claims runs of objects and checks whether each has exited, through a handle duplicated
+/// from one of its holders. Objects are sorted by holder, so a cached holder handle usually serves a whole run.
+/// </summary>
+static void CheckerThread(const std::vector<ProcessObject_t>& objects, SharedWorkBudget& budget, std::vector<ObjectCheck_t>& checks)
+{
+	std::map<DWORD, HANDLE> holderHandles;
+	ProcessClaimedItems(budget, [&](size_t ixObject)
+		{
+			for (const std::pair<DWORD, HANDLE>& handle : objects[ixObject].handles)
+			{
+				auto iter = holderHandles.find(handle.first);
+				if (holderHandles.end() == iter)
+					iter = holderHandles.emplace(handle.first, OpenProcess(PROCESS_DUP_HANDLE, FALSE, handle.first)).first;
+				if (nullptr == iter->second)
+					continue;
+				HANDLE hProcess = nullptr;
+				if (!DuplicateHandle(iter->second, handle.second, GetCurrentProcess(), &hProcess, SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, 0))
+					continue;
+				ObjectCheck_t& check = checks[ixObject];
+				check.state = (WAIT_OBJECT_0 == WaitForSingleObject(hProcess, 0)) ? ObjectState_t::Zombie : ObjectState_t::Running;
+				check.dwPid = GetProcessId(hProcess);
+				CloseHandle(hProcess);
+				break;
+			}
+			return true;
+		});
+	for (const auto& holder : holderHandles)
+	{
+		if (nullptr != holder.second)
+			CloseHandle(holder.second);
+	}
+}
+
+/// <summary>
+/// Scans the system for zombie processes, checking process objects across nWorkers threads.
+/// </summary>
+ZombieScanResults_t ScanForZombies(unsigned int nWorkers)
+{
+	ZombieScanResults_t results;
+	if (0 == nWorkers)
+		nWorkers = (std::max)(std::thread::hardware_concurrency(), 1u);
+	results.nWorkers = nWorkers;
+
+	// A handle to this process, to find the object type index for processes in the handle snapshot
+	HANDLE hSelf = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentProcessId());
+	if (nullptr == hSelf)
+	{
+		results.ntStatus = StatusNotFound;
+		return results;
+	}
+
+	const LONGLONG llStart = PerfCounterNow();
+	std::vector<BYTE> processBuffer, handleBuffer;
+	results.ntStatus = QuerySystemInformation(SystemProcessInformation, processBuffer);
+	if (NT_SUCCESS(results.ntStatus))
+		results.ntStatus = QuerySystemInformation(SystemExtendedHandleInformation, handleBuffer);
+	results.llSnapshot = PerfCounterNow() - llStart;
+	if (!NT_SUCCESS(results.ntStatus))
+	{
+		CloseHandle(hSelf);
+		return results;
+	}
+
+	std::map<DWORD, std::wstring> imageNames;
+	for (const BYTE* pEntry = processBuffer.data(); ; )
+	{
+		const SYSTEM_PROCESS_INFORMATION* pProcess = reinterpret_cast<const SYSTEM_PROCESS_INFORMATION*>(pEntry);
+		const DWORD dwPid = DWORD(ULONG_PTR(pProcess->UniqueProcessId));
+		imageNames[dwPid] = (nullptr == pProcess->ImageName.Buffer) ? std::wstring(0 == dwPid ? L"Idle" : L"") :
+			std::wstring(pProcess->ImageName.Buffer, pProcess->ImageName.Length / sizeof(wchar_t));
+		if (0 == pProcess->NextEntryOffset)
+			break;
+		pEntry += pProcess->NextEntryOffset;
+	}
+
+	const LONGLONG llCheckStart = PerfCounterNow();
+	const SystemHandleInformationEx_t* pHandles = reinterpret_cast<const SystemHandleInformationEx_t*>(handleBuffer.data());
+	results.nHandles = size_t(pHandles->NumberOfHandles);
+	const DWORD dwSelfPid = GetCurrentProcessId();
+	bool bFoundSelf = false;
+	USHORT processTypeIndex = 0;
+	for (size_t ixHandle = 0; ixHandle < results.nHandles && !bFoundSelf; ++ixHandle)
+	{
+		const SystemHandleTableEntryInfoEx_t& entry = pHandles->Handles[ixHandle];
+		if (dwSelfPid == entry.UniqueProcessId && ULONG_PTR(hSelf) == entry.HandleValue)
+		{
+			processTypeIndex = entry.ObjectTypeIndex;
+			bFoundSelf = true;
+		}
+	}
+	CloseHandle(hSelf);
+	if (!bFoundSelf)
+	{
+		results.ntStatus = StatusNotFound;
+		return results;
+	}
+
+	// Group the process handles by object. Kernel object addresses are hidden from unelevated callers on recent versions
+	// of Windows, in which case every handle is checked separately.
+	std::vector<ProcessObject_t> objects;
+	std::map<PVOID, size_t> objectIndexes;
+	for (size_t ixHandle = 0; ixHandle < results.nHandles; ++ixHandle)
+	{
+		const SystemHandleTableEntryInfoEx_t& entry = pHandles->Handles[ixHandle];
+		if (processTypeIndex != entry.ObjectTypeIndex)
+			continue;
+		++results.nProcessHandles;
+		const std::pair<DWORD, HANDLE> handle(DWORD(entry.UniqueProcessId), HANDLE(entry.HandleValue));
+		if (nullptr != entry.Object)
+		{
+			auto iter = objectIndexes.find(entry.Object);
+			if (objectIndexes.end() != iter)
+			{
+				objects[iter->second].handles.push_back(handle);
+				continue;
+			}
+			objectIndexes[entry.Object] = objects.size();
+		}
+		objects.push_back(ProcessObject_t());
+		objects.back().handles.push_back(handle);
+	}
+	// The snapshot lists each holder's handles together; keep each object's first holder in that order.
+	std::stable_sort(objects.begin(), objects.end(),
+		[](const ProcessObject_t& a, const ProcessObject_t& b) { return a.handles[0].first < b.handles[0].first; });
+
+	std::vector<ObjectCheck_t> checks(objects.size());
+	// Runs of 64 objects, so that a run usually shares one holder
+	SharedWorkBudget budget(objects.size(), 64);
+	RunWorkerThreads(nWorkers, [&](unsigned int) { CheckerThread(objects, budget, checks); });
+
+	// Without object addresses, one zombie can appear as several objects; its process ID identifies it.
+	std::set<DWORD> zombiePids;
+	std::map<DWORD, size_t> zombieHandlesByHolder;
+	for (size_t ixObject = 0; ixObject < objects.size(); ++ixObject)
+	{
+		if (ObjectState_t::Inaccessible == checks[ixObject].state)
+		{
+			++results.nInaccessible;
+			continue;
+		}
+		++results.nObjectsChecked;
+		if (ObjectState_t::Zombie != checks[ixObject].state)
+			continue;
+		zombiePids.insert(checks[ixObject].dwPid);
+		for (const std::pair<DWORD, HANDLE>& handle : objects[ixObject].handles)
+		{
+			++zombieHandlesByHolder[handle.first];
+			++results.nZombieHandles;
+		}
+	}
+	results.llCheck = PerfCounterNow() - llCheckStart;
+	results.nZombies = zombiePids.size();
+	for (const auto& holder : zombieHandlesByHolder)
+	{
+		ZombieHolder_t zombieHolder;
+		zombieHolder.dwPid = holder.first;
+		zombieHolder.sImageName = imageNames[holder.first];
+		zombieHolder.nZombieHandles = holder.second;
+		results.holders.push_back(zombieHolder);
+	}
+	std::stable_sort(results.holders.begin(), results.holders.end(),
+		[](const ZombieHolder_t& a, const ZombieHolder_t& b) { return a.nZombieHandles > b.nZombieHandles; });
+	results.bValid = true;
+	return results;
+}
+
+/// <summary>
+/// Writes a scan's counts, timing, and up to nTopHolders holders.
+/// </summary>
+void WriteZombieScanReport(std::wostream& os, const ZombieScanResults_t& results, size_t nTopHolders)
+{
+	if (!results.bValid)
+	{
+		os << L"Zombie scan failed: " << SysErrorMessageWithCode(DWORD(results.ntStatus), true) << std::endl;
+		return;
+	}
+	os
+		<< L"Zombie scan (" << results.nWorkers << L" scan threads):" << std::endl
+		<< L"  Handles in snapshot:       " << results.nHandles << std::endl
+		<< L"  Process handles:           " << results.nProcessHandles << std::endl
+		<< L"  Process objects checked:   " << results.nObjectsChecked << std::endl
+		<< L"  Inaccessible objects:      " << results.nInaccessible << std::endl
+		<< L"  Zombie processes:          " << results.nZombies << std::endl
+		<< L"  Handles to zombies:        " << results.nZombieHandles << std::endl
+		<< L"  Holders:                   " << results.holders.size() << std::endl
+		<< L"  Snapshot ms:               " << PerfCounterToSeconds(results.llSnapshot) * 1000.0 << std::endl
+		<< L"  Check ms:                  " << PerfCounterToSeconds(results.llCheck) * 1000.0 << std::endl;
+	const size_t nHolders = (std::min)(nTopHolders, results.holders.size());
+	if (0 != nHolders)
+	{
+		os << L"  Top holders:" << std::endl;
+		for (size_t ixHolder = 0; ixHolder < nHolders; ++ixHolder)
+		{
+			const ZombieHolder_t& holder = results.holders[ixHolder];
+			os << L"    " << std::setw(8) << holder.nZombieHandles << L"  PID " << holder.dwPid << L"  " << holder.sImageName << std::endl;
+		}
+	}
+	os << std::endl;
+}
+
+/// <summary>
+/// Starts settings.numProcesses zombie processes in nPoints equal steps, scanning for zombies after each step.
+/// </summary>
+std::vector<ScanCurvePoint_t> RunScanCurve(const SpawnSettings_t& settings, unsigned int nThreads, unsigned int nPoints, unsigned int nWorkers, SpawnerResults_t& results)
+{
+	std::vector<ScanCurvePoint_t> points;
+	SpawnSettings_t stepSettings = settings;
+	// Latency is recorded by population index, which restarts with every step.
+	stepSettings.pLatency = nullptr;
+	for (unsigned int ixPoint = 0; ixPoint < nPoints; ++ixPoint)
+	{
+		stepSettings.numProcesses = int(LONGLONG(settings.numProcesses) * (ixPoint + 1) / nPoints - LONGLONG(settings.numProcesses) * ixPoint / nPoints);
+		if (0 == stepSettings.numProcesses)
+			continue;
+		LONGLONG llElapsed = 0;
+		SpawnerResults_t stepResults = SpawnZombieProcesses(stepSettings, nThreads, llElapsed);
+		for (HANDLE h : stepResults.leakedHandles)
+		{
+			WaitForSingleObject(h, INFINITE);
+		}
+		results.Merge(stepResults);
+
+		const ZombieScanResults_t scan = ScanForZombies(nWorkers);
+		if (!scan.bValid)
+		{
+			WriteZombieScanReport(std::wcout, scan, 0);
+			break;
+		}
+		ScanCurvePoint_t point;
+		point.nStarted = results.nStarted;
+		point.nFound = scan.nZombies;
+		point.nHandles = scan.nHandles;
+		point.dSnapshotMs = PerfCounterToSeconds(scan.llSnapshot) * 1000.0;
+		point.dCheckMs = PerfCounterToSeconds(scan.llCheck) * 1000.0;
+		points.push_back(point);
+		std::wcout << L"Scanned at " << results.nStarted << L" zombies: " << scan.nZombies << L" found in "
+			<< point.dSnapshotMs + point.dCheckMs << L" ms          " << std::endl;
+		if (0 != stepResults.nFailures)
+			break;
+	}
+	return points;
+}
+
+/// <summary>
+/// Writes the scan curve as a table, with the scan cost per thousand zombies found.
+/// </summary>
+void WriteScanCurve(std::wostream& os, const std::vector<ScanCurvePoint_t>& points)
+{
+	os
+		<< std::endl
+		<< L"Scan time versus zombie count:" << std::endl
+		<< L"   Started     Found    Handles  Snapshot ms  Check ms  Total ms  ms/1000 found" << std::endl;
+	for (const ScanCurvePoint_t& point : points)
+	{
+		const double dTotalMs = point.dSnapshotMs + point.dCheckMs;
+		FixedFormatGuard format(os, 1);
+		os << std::setw(10) << point.nStarted
+			<< std::setw(10) << point.nFound
+			<< std::setw(11) << point.nHandles
+			<< std::setw(13) << point.dSnapshotMs
+			<< std::setw(10) << point.dCheckMs
+			<< std::setw(10) << dTotalMs;
+		if (0 != point.nFound)
+			os << std::setw(15) << dTotalMs * 1000.0 / double(point.nFound);
+		os << std::endl;
+	}
+	os << std::endl;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Windows.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ZombieSpawner.h"
+
+// ------------------------------------------------------------------------------------------
+// Reference zombie detector: finds exited processes that are kept alive by open handles, and the processes holding them
+
+/// <summary>
+/// A process that holds handles to zombie processes.
+/// </summary>
+struct ZombieHolder_t
+{
+	DWORD dwPid = 0;
+	std::wstring sImageName;
+	// Handles this process holds to zombie processes
+	size_t nZombieHandles = 0;
+};
+
+/// <summary>
+/// Results and timing of one zombie scan.
+/// </summary>
+struct ZombieScanResults_t
+{
+	// false if a system snapshot couldn't be taken; see ntStatus
+	bool bValid = false;
+	LONG ntStatus = 0;
+	// Number of threads that checked process objects
+	unsigned int nWorkers = 0;
+	// Handles in the system handle snapshot, and how many of them refer to processes
+	size_t nHandles = 0;
+	size_t nProcessHandles = 0;
+	// Distinct process objects whose state was checked, and those that couldn't be (holder not accessible)
+	size_t nObjectsChecked = 0;
+	size_t nInaccessible = 0;
+	// Distinct zombie processes found, and the handles to them
+	size_t nZombies = 0;
+	size_t nZombieHandles = 0;
+	// Holders of zombie handles, most handles first
+	std::vector<ZombieHolder_t> holders;
+	// Time spent taking the process and handle snapshots, and checking the process objects, in performance counter units
+	LONGLONG llSnapshot = 0;
+	LONGLONG llCheck = 0;
+};
+
+/// <summary>
+/// Scans the system for zombie processes: takes process and handle snapshots with NtQuerySystemInformation, then checks
+/// every distinct process object that some handle refers to, spread across nWorkers threads. A process object is a
+/// zombie if it has exited. Each check duplicates one handle from its holder, so holders that this process can't open
+/// with PROCESS_DUP_HANDLE (protected and other users' processes, unless elevated) are counted as inaccessible.
+/// </summary>
+/// <param name="nWorkers">Input: number of checking threads, or 0 for one per logical processor</param>
+/// <returns>Results; bValid is false if a snapshot couldn't be taken</returns>
+ZombieScanResults_t ScanForZombies(unsigned int nWorkers);
+
+/// <summary>
+/// Writes a scan's counts, timing, and up to nTopHolders holders.
+/// </summary>
+void WriteZombieScanReport(std::wostream& os, const ZombieScanResults_t& results, size_t nTopHolders);
+
+/// <summary>
+/// One point on the scan-time-versus-zombie-count curve.
+/// </summary>
+struct ScanCurvePoint_t
+{
+	// Zombies started by this run so far, and zombies the scan found system-wide
+	int nStarted = 0;
+	size_t nFound = 0;
+	size_t nHandles = 0;
+	double dSnapshotMs = 0;
+	double dCheckMs = 0;
+};
+
+/// <summary>
+/// Starts settings.numProcesses zombie processes in nPoints equal steps. After each step, waits for the new children to
+/// exit and runs a zombie scan with nWorkers threads. Stops at the first step with a creation failure.
+/// </summary>
+/// <param name="settings">Input: settings for the run; numProcesses is the total for all steps</param>
+/// <param name="nThreads">Input: number of spawner threads</param>
+/// <param name="nPoints">Input: number of steps (1 or more)</param>
+/// <param name="nWorkers">Input: number of scan threads, or 0 for one per logical processor</param>
+/// <param name="results">Output: counts merged from all steps, including the leaked handles</param>
+/// <returns>One point per step</returns>
+std::vector<ScanCurvePoint_t> RunScanCurve(const SpawnSettings_t& settings, unsigned int nThreads, unsigned int nPoints, unsigned int nWorkers, SpawnerResults_t& results);
+
+/// <summary>
+/// Writes the scan curve as a table, with the scan cost per thousand zombies found.
+/// </summary>
+void WriteScanCurve(std::wostream& os, const std::vector<ScanCurvePoint_t>& points);
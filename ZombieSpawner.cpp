@@ -0,0 +1,426 @@
+// Zombie process creation, optionally spread across multiple spawner threads
+
+#include <Windows.h>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "ZombieSpawner.h"
+#include "LatencyStats.h"
+#include "RateScheduler.h"
+#include "Utilities.h"
+#include "EventTracer.h"
+#include "LiveStats.h"
+#include "ProcessorPlacement.h"
+#include "SysErrorMessage.h"
+#include "WorkerThreads.h"
+
+/// <summary>
+/// Adds another spawner thread's results into this one.
+/// </summary>
+void SpawnerResults_t::Merge(const SpawnerResults_t& other)
+{
+	nStarted += other.nStarted;
+	leakedHandles.insert(leakedHandles.end(), other.leakedHandles.begin(), other.leakedHandles.end());
+	nFailures += other.nFailures;
+	if (0 != other.dwLastError)
+		dwLastError = other.dwLastError;
+	threadCounts.insert(threadCounts.end(), other.threadCounts.begin(), other.threadCounts.end());
+}
+
+/// <summary>
+/// Returns the command-line name of a spawn strategy: createprocess, suspended, or jobattr.
+/// </summary>
+const wchar_t* SpawnStrategyName(SpawnStrategy_t strategy)
+{
+	switch (strategy)
+	{
+	case SpawnStrategy_t::CreateProcess: return L"createprocess";
+	case SpawnStrategy_t::SuspendedBatch: return L"suspended";
+	case SpawnStrategy_t::JobAttribute: return L"jobattr";
+	default: return L"unknown";
+	}
+}
+
+/// <summary>
+/// Converts a spawn strategy's command-line name to the strategy.
+/// </summary>
+bool ParseSpawnStrategy(const wchar_t* szName, SpawnStrategy_t& strategy)
+{
+	for (SpawnStrategy_t candidate : AllSpawnStrategies)
+	{
+		if (0 == wcscmp(szName, SpawnStrategyName(candidate)))
+		{
+			strategy = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// Process-thread attribute list naming the job for the JobAttribute strategy, the handles to inherit, and the child's
+/// processor placement, in any combination. Each spawner thread keeps its own, and reuses it for every spawn with the same
+/// job, handle list, and placement.
+/// </summary>
+class SpawnAttributeList
+{
+public:
+	~SpawnAttributeList() { Reset(); }
+
+	/// <summary>
+	/// Returns the attribute list for hJob, pInheritHandles, and pPlacement (any can be nullptr, but not all), creating it if
+	/// necessary.
+	/// </summary>
+	/// <returns>The list, or nullptr with GetLastError() set</returns>
+	LPPROC_THREAD_ATTRIBUTE_LIST Get(HANDLE hJob, const std::vector<HANDLE>* pInheritHandles, const ProcessorPlacement_t* pPlacement)
+	{
+		if (hJob == m_hJob && pInheritHandles == m_pInheritHandles && pPlacement == m_pPlacement && !m_buffer.empty())
+			return List();
+		Reset();
+		// A placement sets the initial thread's group affinity and the process's preferred node.
+		const DWORD nAttributes = DWORD(nullptr != hJob) + DWORD(nullptr != pInheritHandles) + (nullptr != pPlacement ? 2 : 0);
+		SIZE_T cbList = 0;
+		InitializeProcThreadAttributeList(nullptr, nAttributes, 0, &cbList);
+		m_buffer.resize(cbList);
+		if (!InitializeProcThreadAttributeList(List(), nAttributes, 0, &cbList))
+		{
+			m_buffer.clear();
+			return nullptr;
+		}
+		// The attributes refer to the handle values stored here and in the caller's vector, which must outlive the list.
+		m_hJob = hJob;
+		m_pInheritHandles = pInheritHandles;
+		m_pPlacement = pPlacement;
+		if (nullptr != pPlacement)
+		{
+			m_groupAffinity = pPlacement->affinity;
+			m_nPreferredNode = pPlacement->nNode;
+		}
+		if ((nullptr != hJob && !UpdateProcThreadAttribute(List(), 0, PROC_THREAD_ATTRIBUTE_JOB_LIST, &m_hJob, sizeof(m_hJob), nullptr, nullptr)) ||
+			(nullptr != pInheritHandles && !UpdateProcThreadAttribute(List(), 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+				const_cast<HANDLE*>(pInheritHandles->data()), pInheritHandles->size() * sizeof(HANDLE), nullptr, nullptr)) ||
+			(nullptr != pPlacement && (!UpdateProcThreadAttribute(List(), 0, PROC_THREAD_ATTRIBUTE_GROUP_AFFINITY, &m_groupAffinity, sizeof(m_groupAffinity), nullptr, nullptr) ||
+				!UpdateProcThreadAttribute(List(), 0, PROC_THREAD_ATTRIBUTE_PREFERRED_NODE, &m_nPreferredNode, sizeof(m_nPreferredNode), nullptr, nullptr))))
+		{
+			DWORD dwLastErr = GetLastError();
+			Reset();
+			SetLastError(dwLastErr);
+			return nullptr;
+		}
+		return List();
+	}
+
+private:
+	LPPROC_THREAD_ATTRIBUTE_LIST List() { return reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(m_buffer.data()); }
+
+	void Reset()
+	{
+		if (!m_buffer.empty())
+			DeleteProcThreadAttributeList(List());
+		m_buffer.clear();
+		m_hJob = nullptr;
+		m_pInheritHandles = nullptr;
+		m_pPlacement = nullptr;
+	}
+
+	std::vector<BYTE> m_buffer;
+	HANDLE m_hJob = nullptr;
+	const std::vector<HANDLE>* m_pInheritHandles = nullptr;
+	const ProcessorPlacement_t* m_pPlacement = nullptr;
+	GROUP_AFFINITY m_groupAffinity = { 0 };
+	USHORT m_nPreferredNode = 0;
+};
+
+/// <summary>
+/// The step that made the calling thread's last zombie process creation fail, for LastSpawnFailure.
+/// </summary>
+static thread_local const wchar_t* t_szSpawnFailure = L"CreateProcessW";
+
+/// <summary>
+/// Returns the step that made the calling thread's last zombie process creation fail.
+/// </summary>
+const wchar_t* LastSpawnFailure()
+{
+	return t_szSpawnFailure;
+}
+
+/// <summary>
+/// Records a failed creation step as a spawn failure: trace event, live statistics, and LastSpawnFailure.
+/// Leaves GetLastError() set to dwLastErr.
+/// </summary>
+static void OnSpawnFailed(const SpawnSettings_t& settings, const wchar_t* szStep, DWORD dwLastErr)
+{
+	t_szSpawnFailure = szStep;
+	TraceEvent(TraceEventKind_t::ProcessSpawnFailed, 0, 0, nullptr, dwLastErr);
+	if (nullptr != settings.pLiveStats)
+		settings.pLiveStats->OnFailed(dwLastErr);
+	SetLastError(dwLastErr);
+}
+
+/// <summary>
+/// Terminates a suspended process whose thread can't be resumed, since it would never run and become a zombie, and
+/// closes its handles.
+/// </summary>
+static void DiscardSuspendedProcess(const PROCESS_INFORMATION& pi)
+{
+	TerminateProcess(pi.hProcess, 1);
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+}
+
+/// <summary>
+/// Creates one instance of ZombieProc with the settings' creation options and strategy, and assigns it to the settings'
+/// job object if any, placing it on pPlacement's processors if that's not nullptr. If bLeaveSuspended, the caller must
+/// resume the process's thread, and count it in the live statistics once it's resumed.
+/// </summary>
+static bool CreateZombieProc(const SpawnSettings_t& settings, PROCESS_INFORMATION& pi, bool bLeaveSuspended, const ProcessorPlacement_t* pPlacement)
+{
+	const bool bJobAttribute = SpawnStrategy_t::JobAttribute == settings.strategy && nullptr != settings.hJob;
+	// A process that is assigned to the job after it's created must not run until then.
+	const bool bResumeAfterAssignment = settings.bResumeAfterJobAssignment && nullptr != settings.hJob && !bJobAttribute;
+	const bool bSuspended = bLeaveSuspended || bResumeAfterAssignment;
+	DWORD dwCreationFlags = CREATE_BREAKAWAY_FROM_JOB | CREATE_NEW_PROCESS_GROUP | (bSuspended ? CREATE_SUSPENDED : 0);
+	STARTUPINFOEXW startupInfo = { 0 };
+	startupInfo.StartupInfo.cb = sizeof(startupInfo.StartupInfo);
+	pi = { 0 };
+	// Only the listed handles are inherited, so that spawner threads don't hand each other's handles to their children.
+	const bool bInheritHandles = nullptr != settings.pInheritHandles && !settings.pInheritHandles->empty();
+	if (bJobAttribute || bInheritHandles || nullptr != pPlacement)
+	{
+		static thread_local SpawnAttributeList spawnAttributeList;
+		startupInfo.lpAttributeList = spawnAttributeList.Get(bJobAttribute ? settings.hJob : nullptr, bInheritHandles ? settings.pInheritHandles : nullptr, pPlacement);
+		if (nullptr == startupInfo.lpAttributeList)
+		{
+			OnSpawnFailed(settings, L"Process attribute list setup", GetLastError());
+			return false;
+		}
+		startupInfo.StartupInfo.cb = sizeof(startupInfo);
+		dwCreationFlags |= EXTENDED_STARTUPINFO_PRESENT;
+	}
+	LPVOID pEnvironment = nullptr;
+	if (!settings.sEnvironment.empty())
+	{
+		pEnvironment = const_cast<wchar_t*>(settings.sEnvironment.c_str());
+		dwCreationFlags |= CREATE_UNICODE_ENVIRONMENT;
+	}
+	// CreateProcessW can modify the command-line buffer, so it needs a writable copy.
+	std::wstring sCommandLine;
+	if (!settings.sChildArgs.empty())
+		sCommandLine = L"\"" + settings.sZombieProcPath + L"\" " + settings.sChildArgs;
+	LPWSTR szCommandLine = sCommandLine.empty() ? nullptr : &sCommandLine[0];
+	if (!CreateProcessW(settings.sZombieProcPath.c_str(), szCommandLine, nullptr, nullptr, bInheritHandles ? TRUE : FALSE, dwCreationFlags,
+		pEnvironment, nullptr, &startupInfo.StartupInfo, &pi))
+	{
+		OnSpawnFailed(settings, L"CreateProcessW", GetLastError());
+		return false;
+	}
+	TraceEvent(TraceEventKind_t::ProcessSpawn, pi.dwProcessId, pi.dwThreadId, pi.hProcess);
+	if (nullptr != settings.hJob && !bJobAttribute)
+	{
+		if (!AssignProcessToJobObject(settings.hJob, pi.hProcess))
+		{
+			DWORD dwLastErr = GetLastError();
+			std::wcerr << L"AssignProcessToJobObject failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		}
+	}
+	if (bSuspended && !bLeaveSuspended && DWORD(-1) == ResumeThread(pi.hThread))
+	{
+		const DWORD dwLastErr = GetLastError();
+		DiscardSuspendedProcess(pi);
+		pi = { 0 };
+		OnSpawnFailed(settings, L"ResumeThread", dwLastErr);
+		return false;
+	}
+	if (nullptr != settings.pLiveStats && !bLeaveSuspended)
+		settings.pLiveStats->OnSpawned();
+	return true;
+}
+
+/// <summary>
+/// Starts one instance of ZombieProc with the settings' creation options and strategy, and assigns it to the settings' job
+/// object if any. With the SuspendedBatch strategy, the process is resumed before returning (only SpawnZombieProcesses batches).
+/// Does not close or count the returned handles.
+/// </summary>
+bool StartZombieProc(const SpawnSettings_t& settings, PROCESS_INFORMATION& pi)
+{
+	const bool bPlaced = nullptr != settings.pChildPlacements && !settings.pChildPlacements->empty();
+	return CreateZombieProc(settings, pi, false, bPlaced ? &settings.pChildPlacements->front() : nullptr);
+}
+
+/// <summary>
+/// Keeps a started process's handles in the results as leaked, or closes them, according to the settings.
+/// </summary>
+static void KeepOrCloseHandles(const SpawnSettings_t& settings, const PROCESS_INFORMATION& pi, SpawnerResults_t& results)
+{
+	if (settings.bLeakProcessHandles)
+		results.leakedHandles.push_back(pi.hProcess);
+	else
+		CloseHandle(pi.hProcess);
+	if (settings.bLeakThreadHandles)
+		results.leakedHandles.push_back(pi.hThread);
+	else
+		CloseHandle(pi.hThread);
+	if (nullptr != settings.pLiveStats)
+		settings.pLiveStats->OnHandlesKept(size_t(settings.bLeakProcessHandles) + size_t(settings.bLeakThreadHandles));
+}
+
+/// <summary>
+/// Resumes every suspended process in the batch, then keeps or closes its handles. A process whose thread can't be
+/// resumed is discarded, and counted as a failure instead of as started.
+/// </summary>
+/// <returns>true if every process was resumed; false otherwise, with GetLastError() set by ResumeThread</returns>
+static bool ResumeBatch(const SpawnSettings_t& settings, std::vector<PROCESS_INFORMATION>& batch, SpawnerResults_t& results)
+{
+	DWORD dwLastErr = 0;
+	for (PROCESS_INFORMATION& pi : batch)
+	{
+		if (DWORD(-1) != ResumeThread(pi.hThread))
+		{
+			if (nullptr != settings.pLiveStats)
+				settings.pLiveStats->OnSpawned();
+			continue;
+		}
+		dwLastErr = GetLastError();
+		DiscardSuspendedProcess(pi);
+		pi.hProcess = pi.hThread = nullptr;
+		--results.nStarted;
+		++results.nFailures;
+		results.dwLastError = dwLastErr;
+		OnSpawnFailed(settings, L"ResumeThread", dwLastErr);
+	}
+	for (const PROCESS_INFORMATION& pi : batch)
+	{
+		if (nullptr != pi.hProcess)
+			KeepOrCloseHandles(settings, pi, results);
+	}
+	batch.clear();
+	if (0 != dwLastErr)
+	{
+		SetLastError(dwLastErr);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Returns the placement for a spawner thread, or its children, from a placement vector, or nullptr if there's none.
+/// </summary>
+static const ProcessorPlacement_t* PlacementForThread(const std::vector<ProcessorPlacement_t>* pPlacements, unsigned int ixThread)
+{
+	if (nullptr == pPlacements || pPlacements->empty())
+		return nullptr;
+	return &(*pPlacements)[ixThread % pPlacements->size()];
+}
+
+/// <summary>
+/// Body of each spawner thread: claims indexes from the shared budget and starts one ZombieProc per index.
+/// </summary>
+static void SpawnerThread(const SpawnSettings_t& settings, unsigned int ixThread, SharedWorkBudget& budget, SpawnerResults_t& threadResults)
+{
+	// Number of suspended processes each spawner thread resumes at once with the SuspendedBatch strategy
+	const size_t ResumeBatchSize = 64;
+
+	// Count into a local and copy out at the end, so that spawner threads don't share cache lines in the hot loop.
+	SpawnerResults_t results;
+	const bool bBatchResume = SpawnStrategy_t::SuspendedBatch == settings.strategy;
+	std::vector<PROCESS_INFORMATION> suspended;
+	if (bBatchResume)
+		suspended.reserve(ResumeBatchSize);
+	SpawnerThreadCounts_t counts;
+	counts.ixThread = ixThread;
+	const ProcessorPlacement_t* pChildPlacement = PlacementForThread(settings.pChildPlacements, ixThread);
+	// Pin before the first spawn; the calling thread gets its previous affinity back at the end.
+	const ProcessorPlacement_t* pSpawnerPlacement = PlacementForThread(settings.pSpawnerPlacements, ixThread);
+	GROUP_AFFINITY previousAffinity = { 0 };
+	bool bPinned = false;
+	if (nullptr != pSpawnerPlacement)
+	{
+		bPinned = FALSE != SetThreadGroupAffinity(GetCurrentThread(), &pSpawnerPlacement->affinity, &previousAffinity);
+		if (!bPinned)
+		{
+			DWORD dwLastErr = GetLastError();
+			std::lock_guard<std::mutex> lock(budget.ConsoleMutex());
+			std::wcerr << L"Cannot pin spawner thread " << ixThread << L" to " << PlacementName(*pSpawnerPlacement) << L": " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+		}
+	}
+	const auto writeFailure = [&budget](DWORD dwLastErr)
+	{
+		std::lock_guard<std::mutex> lock(budget.ConsoleMutex());
+		std::wcout << LastSpawnFailure() << L" failed: " << SysErrorMessageWithCode(dwLastErr) << std::endl;
+	};
+	ProcessClaimedItems(budget, [&](size_t ixSpawn)
+	{
+		if (nullptr != settings.pScheduler)
+			settings.pScheduler->WaitForToken();
+
+		PROCESS_INFORMATION pi;
+		const LONGLONG llSpawnStart = PerfCounterNow();
+		if (!CreateZombieProc(settings, pi, bBatchResume, pChildPlacement))
+		{
+			DWORD dwLastErr = GetLastError();
+			++results.nFailures;
+			results.dwLastError = dwLastErr;
+			writeFailure(dwLastErr);
+			return false;
+		}
+		const LONGLONG llSpawnTime = PerfCounterNow() - llSpawnStart;
+		if (nullptr != settings.pLatency)
+			settings.pLatency->Record(int(ixSpawn), llSpawnTime);
+		counts.llSpawnTime += llSpawnTime;
+		++results.nStarted;
+		if (bBatchResume)
+		{
+			suspended.push_back(pi);
+			if (suspended.size() >= ResumeBatchSize && !ResumeBatch(settings, suspended, results))
+			{
+				writeFailure(GetLastError());
+				return false;
+			}
+		}
+		else
+		{
+			KeepOrCloseHandles(settings, pi, results);
+		}
+		budget.OnCompleted(100);
+		if (0 != settings.dwMilliseconds)
+			Sleep(settings.dwMilliseconds);
+		return true;
+	});
+	if (!ResumeBatch(settings, suspended, results))
+	{
+		writeFailure(GetLastError());
+		budget.Stop();
+	}
+	if (bPinned)
+		SetThreadGroupAffinity(GetCurrentThread(), &previousAffinity, nullptr);
+	counts.nStarted = results.nStarted;
+	results.threadCounts.push_back(counts);
+	threadResults = std::move(results);
+}
+
+/// <summary>
+/// Starts settings.numProcesses instances of ZombieProc, spread across nThreads spawner threads that share the
+/// process budget. All threads stop after the first creation failure in any thread.
+/// With nThreads == 1, all processes are started on the calling thread.
+/// </summary>
+SpawnerResults_t SpawnZombieProcesses(const SpawnSettings_t& settings, unsigned int nThreads, LONGLONG& llElapsed)
+{
+	// Process creation takes far longer than claiming an index, so claim one at a time to spread the processes evenly.
+	SharedWorkBudget budget(size_t((std::max)(settings.numProcesses, 0)), 1);
+	std::vector<SpawnerResults_t> perThreadResults(nThreads);
+
+	const LONGLONG llStart = PerfCounterNow();
+	RunWorkerThreads(nThreads, [&](unsigned int ixThread)
+	{
+		SpawnerThread(settings, ixThread, budget, perThreadResults[ixThread]);
+	});
+	llElapsed = PerfCounterNow() - llStart;
+
+	SpawnerResults_t results;
+	for (const SpawnerResults_t& threadResults : perThreadResults)
+	{
+		results.Merge(threadResults);
+	}
+	return results;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+class SpawnLatencyRecorder;
+class RateScheduler;
+class LiveStats;
+struct ProcessorPlacement_t;
+
+// ------------------------------------------------------------------------------------------
+// Zombie process creation, optionally spread across multiple spawner threads
+
+/// <summary>
+/// Ways to create each zombie process.
+/// </summary>
+enum class SpawnStrategy_t
+{
+	// CreateProcessW, then AssignProcessToJobObject if there's a job
+	CreateProcess,
+	// CreateProcessW with CREATE_SUSPENDED; each spawner thread resumes its processes in batches
+	SuspendedBatch,
+	// CreateProcessW with a PROC_THREAD_ATTRIBUTE_JOB_LIST attribute, so that the process starts in the job
+	JobAttribute
+};
+
+/// <summary>
+/// All spawn strategies, in the order the benchmark runs them.
+/// </summary>
+const SpawnStrategy_t AllSpawnStrategies[] = { SpawnStrategy_t::CreateProcess, SpawnStrategy_t::SuspendedBatch, SpawnStrategy_t::JobAttribute };
+
+/// <summary>
+/// Returns the command-line name of a spawn strategy: createprocess, suspended, or jobattr.
+/// </summary>
+const wchar_t* SpawnStrategyName(SpawnStrategy_t strategy);
+
+/// <summary>
+/// Converts a spawn strategy's command-line name to the strategy.
+/// </summary>
+/// <returns>true if szName is a strategy name; false otherwise</returns>
+bool ParseSpawnStrategy(const wchar_t* szName, SpawnStrategy_t& strategy);
+
+/// <summary>
+/// Settings shared by all spawner threads for a zombie-process run.
+/// </summary>
+struct SpawnSettings_t
+{
+	// Full path to ZombieProc[32].exe
+	std::wstring sZombieProcPath;
+	// Command-line arguments for ZombieProc, if any
+	std::wstring sChildArgs;
+	// Total number of processes to start across all spawner threads
+	int numProcesses = 10;
+	// Milliseconds to wait after each CreateProcess
+	DWORD dwMilliseconds = 0;
+	bool bLeakProcessHandles = true;
+	bool bLeakThreadHandles = true;
+	// Job object to assign processes to, or nullptr
+	HANDLE hJob = nullptr;
+	// Create processes suspended and resume them only after they're assigned to hJob, so none can exit outside the job
+	bool bResumeAfterJobAssignment = false;
+	// How each process is created; JobAttribute requires hJob
+	SpawnStrategy_t strategy = SpawnStrategy_t::CreateProcess;
+	// Receives the latency of each spawn by population index, or nullptr
+	SpawnLatencyRecorder* pLatency = nullptr;
+	// Paces spawns to a target rate, or nullptr
+	RateScheduler* pScheduler = nullptr;
+	// Receives spawn, failure, and leaked-handle counts for the live statistics page, or nullptr
+	LiveStats* pLiveStats = nullptr;
+	// Handles for each process to inherit, passed explicitly with PROC_THREAD_ATTRIBUTE_HANDLE_LIST, or nullptr for none.
+	// They must be inheritable, and the vector must outlive the run.
+	const std::vector<HANDLE>* pInheritHandles = nullptr;
+	// Environment block for each process, or empty to inherit this process's environment
+	std::wstring sEnvironment;
+	// Processors for each spawner thread to run on, by thread index modulo the vector's size, or nullptr to leave the
+	// spawner threads unpinned
+	const std::vector<ProcessorPlacement_t>* pSpawnerPlacements = nullptr;
+	// Processors for the children of each spawner thread, by thread index modulo the vector's size, or nullptr to leave
+	// them to the scheduler. Set at creation with PROC_THREAD_ATTRIBUTE_GROUP_AFFINITY and PROC_THREAD_ATTRIBUTE_PREFERRED_NODE.
+	const std::vector<ProcessorPlacement_t>* pChildPlacements = nullptr;
+};
+
+/// <summary>
+/// Processes started by one spawner thread, and the time it spent creating them.
+/// </summary>
+struct SpawnerThreadCounts_t
+{
+	unsigned int ixThread = 0;
+	int nStarted = 0;
+	// Sum of the successful creations' latency, in performance counter units
+	LONGLONG llSpawnTime = 0;
+};
+
+/// <summary>
+/// Counts and failure state kept by each spawner thread, and merged across threads at the end of a run.
+/// </summary>
+struct SpawnerResults_t
+{
+	int nStarted = 0;
+	// Process and thread handles that were not closed
+	std::vector<HANDLE> leakedHandles;
+	int nFailures = 0;
+	// Last error code from a failed creation (see LastSpawnFailure), or 0 if none failed
+	DWORD dwLastError = 0;
+	// One entry per spawner thread (SpawnZombieProcesses only)
+	std::vector<SpawnerThreadCounts_t> threadCounts;
+
+	/// <summary>
+	/// Adds another spawner thread's results into this one.
+	/// </summary>
+	void Merge(const SpawnerResults_t& other);
+};
+
+/// <summary>
+/// Starts one instance of ZombieProc with the settings' creation options and strategy, and assigns it to the settings' job
+/// object if any. With the SuspendedBatch strategy, the process is resumed before returning (only SpawnZombieProcesses batches).
+/// The process gets the first of the settings' child placements, if any. Does not close or count the returned handles.
+/// </summary>
+/// <param name="settings">Input: settings for the run</param>
+/// <param name="pi">Output: process and thread handles and IDs of the new process</param>
+/// <returns>true if the process was started; false otherwise, with GetLastError() set by the step that failed (see
+/// LastSpawnFailure)</returns>
+bool StartZombieProc(const SpawnSettings_t& settings, PROCESS_INFORMATION& pi);
+
+/// <summary>
+/// Returns the step that made the calling thread's last zombie process creation fail, for error messages:
+/// "CreateProcessW", "ResumeThread", or "Process attribute list setup".
+/// </summary>
+const wchar_t* LastSpawnFailure();
+
+/// <summary>
+/// Starts settings.numProcesses instances of ZombieProc, spread across nThreads spawner threads that share the
+/// process budget. All threads stop after the first creation failure in any thread (CreateProcessW, ResumeThread, or the
+/// process attribute list).
+/// With nThreads == 1, all processes are started on the calling thread. With spawner placements, each thread (including
+/// the calling thread, until it returns) runs only on its placement's processors.
+/// </summary>
+/// <param name="settings">Input: settings for the run</param>
+/// <param name="nThreads">Input: number of spawner threads (1 or more)</param>
+/// <param name="llElapsed">Output: wall time for the run, in performance counter units</param>
+/// <returns>Counts merged from all spawner threads</returns>
+SpawnerResults_t SpawnZombieProcesses(const SpawnSettings_t& settings, unsigned int nThreads, LONGLONG& llElapsed);